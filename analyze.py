@@ -94,6 +94,62 @@ class BenchmarkAnalyzer:
         plt.tight_layout()
         self._save_or_show('pattern_breakdown.png')
     
+    def plot_latency_percentiles(self, results):
+        # concurrent-mode read latency, one panel per percentile
+        results = [r for r in results if any('readLatencyUs' in x for x in r['results'])]
+        if not results:
+            return
+        percentiles = [('p50', 'p50'), ('p99', 'p99'), ('p999', 'p99.9')]
+        fig, axes = plt.subplots(1, len(percentiles), figsize=(20, 8), sharey=True)
+        bar_width = 0.8 / len(results)
+        
+        for ax, (key, name) in zip(axes, percentiles):
+            for i, result in enumerate(results):
+                patterns = [r['pattern'] for r in result['results']]
+                values = [r.get('readLatencyUs', {}).get(key, 0) for r in result['results']]
+                pos = np.arange(len(patterns)) - 0.4 + (i + 0.5) * bar_width
+                ax.bar(pos, values, bar_width, label=result['label'])
+            ax.set_title(f'{name} read latency', fontsize=16)
+            ax.set_yscale('log')
+            ax.set_xticks(np.arange(len(patterns)))
+            ax.set_xticklabels(patterns, rotation=45, fontsize=12)
+            ax.grid(axis='y', linestyle='--', alpha=0.7)
+        axes[0].set_ylabel('Latency (us)', fontsize=16)
+        axes[0].legend(fontsize=12)
+        plt.tight_layout()
+        self._save_or_show('latency_percentiles.png')
+    
+    def plot_hit_ratio_breakdown(self, results):
+        # hit / partial / miss shares from the mount's Prometheus counters, stacked per pattern
+        results = [r for r in results if any('cache' in x for x in r['results'])]
+        if not results:
+            return
+        plt.figure(figsize=(14, 10))
+        bar_width = 0.8 / len(results)
+        shares = [('hitRatio', 'hit', 'green'), ('partialRatio', 'partial', 'orange'), ('missRatio', 'miss', 'red')]
+        
+        for i, result in enumerate(results):
+            patterns = [r['pattern'] for r in result['results']]
+            pos = np.arange(len(patterns)) - 0.4 + (i + 0.5) * bar_width
+            bottom = np.zeros(len(patterns))
+            for key, name, color in shares:
+                values = np.array([r.get('cache', {}).get(key, 0) * 100 for r in result['results']])
+                plt.bar(pos, values, bar_width, bottom=bottom, color=color, edgecolor='black',
+                        label=name if i == 0 else None)
+                bottom += values
+            for x in pos:
+                plt.text(x, 101, result['label'], rotation=90, ha='center', va='bottom', fontsize=10)
+        
+        plt.ylabel('Share of reads (%)', fontsize=16)
+        plt.ylim(0, 130)
+        plt.title('Cache Hit Ratio Breakdown by Access Pattern', fontsize=18)
+        plt.xticks(np.arange(len(patterns)), patterns, rotation=45, fontsize=14)
+        plt.yticks(fontsize=14)
+        plt.grid(axis='y', linestyle='--', alpha=0.7)
+        plt.legend(fontsize=14, loc='upper right')
+        plt.tight_layout()
+        self._save_or_show('hit_ratio_breakdown.png')
+    
     def _calculate_relative_performance(self, reference, result, metric):
         relative_values = []
         for i, ref_res in enumerate(reference['results']):
@@ -155,6 +211,17 @@ class BenchmarkAnalyzer:
             duration = self._normalize_duration(r['duration'])
             summary.append(f"| {r['pattern']} | {duration:.4f} | {r['mbytes_per_sec']:.2f} | {r['reads_per_sec']:.2f} |\n")
         
+        concurrent = [r for r in result['results'] if 'readLatencyUs' in r]
+        if concurrent:
+            summary.append(f"\n### Concurrent Reads ({concurrent[0]['clients']} clients)\n")
+            summary.append("| Pattern | Reads | Writes | p50 (us) | p99 (us) | p99.9 (us) | Hit ratio |\n")
+            summary.append("|---------|-------|--------|----------|----------|------------|-----------|\n")
+            for r in concurrent:
+                latency = r['readLatencyUs']
+                hit_ratio = f"{r['cache']['hitRatio'] * 100:.1f}%" if 'cache' in r else '-'
+                summary.append(f"| {r['pattern']} | {r['reads']} | {r.get('writes', 0)} | {latency['p50']:.1f} | "
+                               f"{latency['p99']:.1f} | {latency['p999']:.1f} | {hit_ratio} |\n")
+        
         return summary
 
 def load_benchmark_results(file_path):
@@ -213,6 +280,8 @@ def main():
         analyzer.plot_relative_performance(results, args.reference)
     
     analyzer.plot_pattern_breakdown(results)
+    analyzer.plot_latency_percentiles(results)
+    analyzer.plot_hit_ratio_breakdown(results)
     
     if args.summary:
         analyzer.generate_summary_report(results, args.summary)
@@ -1,30 +1,79 @@
 package main
 
 import (
+	"bufio"
 	"encoding/json"
 	"flag"
 	"fmt"
+	"io"
+	"math"
 	"math/rand"
+	"net/http"
 	"os"
 	"path/filepath"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
 	"time"
 )
 
 type BenchmarkConfig struct {
-	NumFiles        int    `json:"numFiles"`
-	FileSizeKB      int    `json:"fileSizeKB"`
-	ReadPatterns    []int  `json:"readPatterns"`
-	TargetDirectory string `json:"targetDirectory"`
-	Iterations      int    `json:"iterations"`
+	NumFiles        int     `json:"numFiles"`
+	FileSizeKB      int     `json:"fileSizeKB"`
+	ReadPatterns    []int   `json:"readPatterns"`
+	TargetDirectory string  `json:"targetDirectory"`
+	Iterations      int     `json:"iterations"`
+	Clients         int     `json:"clients"`              // 0 reads whole files one at a time
+	ReadSizeKB      int     `json:"readSizeKB"`           // Range read size in concurrent mode, 0 = whole file
+	WriteRatio      float64 `json:"writeRatio"`           // Share of concurrent operations that write
+	ThinkTimeMs     float64 `json:"thinkTimeMs"`          // Mean pause between a client's operations
+	MetricsURL      string  `json:"metricsURL,omitempty"` // quark's --metrics-port endpoint, for hit ratios
 }
 
 type BenchmarkResult struct {
-	Pattern      string        `json:"pattern"`
-	Duration     time.Duration `json:"duration"`
-	FileCount    int           `json:"fileCount"`
-	BytesRead    int64         `json:"bytesRead"`
-	ReadPerSec   float64       `json:"reads_per_sec"`
-	MBytesPerSec float64       `json:"mbytes_per_sec"`
+	Pattern      string          `json:"pattern"`
+	Duration     time.Duration   `json:"duration"`
+	FileCount    int             `json:"fileCount"`
+	BytesRead    int64           `json:"bytesRead"`
+	ReadPerSec   float64         `json:"reads_per_sec"`
+	MBytesPerSec float64         `json:"mbytes_per_sec"`
+	Clients      int             `json:"clients,omitempty"`
+	Reads        int64           `json:"reads,omitempty"`
+	Writes       int64           `json:"writes,omitempty"`
+	ReadLatency  *LatencySummary `json:"readLatencyUs,omitempty"`
+	WriteLatency *LatencySummary `json:"writeLatencyUs,omitempty"`
+	Cache        *CacheBreakdown `json:"cache,omitempty"`
+}
+
+// Per-operation latency in microseconds, over every iteration
+type LatencySummary struct {
+	Mean float64 `json:"mean"`
+	P50  float64 `json:"p50"`
+	P99  float64 `json:"p99"`
+	P999 float64 `json:"p999"`
+	Max  float64 `json:"max"`
+}
+
+// Change in the cache's Prometheus counters over a pattern's iterations
+type CacheBreakdown struct {
+	Hits           int64   `json:"hits"`
+	PartialHits    int64   `json:"partialHits"`
+	Misses         int64   `json:"misses"`
+	HitRatio       float64 `json:"hitRatio"`
+	PartialRatio   float64 `json:"partialRatio"`
+	MissRatio      float64 `json:"missRatio"`
+	BytesServed    int64   `json:"bytesServed"`
+	DiskReadBytes  int64   `json:"diskReadBytes"`
+	PrefetchUsed   int64   `json:"prefetchUsed"`
+	PrefetchWasted int64   `json:"prefetchWasted"`
+}
+
+type clientStats struct {
+	readLatencies  []time.Duration
+	writeLatencies []time.Duration
+	bytesRead      int64
+	err            error
 }
 
 type BenchmarkResults struct {
@@ -58,6 +107,11 @@ func main() {
 	fileSizeKB := flag.Int("size", 1024, "Size of each file in KB")
 	targetDir := flag.String("dir", "benchmark_files", "Directory to create files in")
 	iterations := flag.Int("iter", 10, "Number of iterations for each benchmark")
+	clients := flag.Int("clients", 0, "Concurrent reader goroutines (0 = read whole files one at a time)")
+	readSizeKB := flag.Int("read-size", 128, "Size of each range read in KB in concurrent mode (0 = whole file)")
+	writeRatio := flag.Float64("write-ratio", 0, "Share of concurrent operations that write instead of read")
+	thinkTimeMs := flag.Float64("think", 0, "Mean think time between a client's operations in ms")
+	metricsURL := flag.String("metrics", "", "Prometheus URL of the mount (quark.py --metrics-port), for hit ratios")
 	flag.Parse()
 
 	var config BenchmarkConfig
@@ -79,6 +133,11 @@ func main() {
 			ReadPatterns:    []int{PatternSequential, PatternReverseSeq, PatternRandom, PatternZipfian, PatternLocalityBased, PatternRepeatedAccess},
 			TargetDirectory: *targetDir,
 			Iterations:      *iterations,
+			Clients:         *clients,
+			ReadSizeKB:      *readSizeKB,
+			WriteRatio:      *writeRatio,
+			ThinkTimeMs:     *thinkTimeMs,
+			MetricsURL:      *metricsURL,
 		}
 	}
 
@@ -106,6 +165,12 @@ func main() {
 
 	for _, patternID := range config.ReadPatterns {
 		patternName := getPatternName(patternID)
+		if config.Clients > 0 {
+			fmt.Printf("Running concurrent benchmark for %s pattern (%d clients, %d iterations)...\n",
+				patternName, config.Clients, config.Iterations)
+			results.Results = append(results.Results, runConcurrentPattern(files, patternID, config))
+			continue
+		}
 		fmt.Printf("Running benchmark for %s pattern (%d iterations)...\n", patternName, config.Iterations)
 
 		var totalDuration time.Duration
@@ -168,6 +233,22 @@ func main() {
 			result.MBytesPerSec,
 			result.ReadPerSec)
 	}
+
+	if config.Clients > 0 {
+		fmt.Println("\nRead latency (us)     | p50      | p99      | p99.9    | Hit ratio")
+		fmt.Println("----------------------|----------|----------|----------|----------")
+		for _, result := range results.Results {
+			if result.ReadLatency == nil {
+				continue
+			}
+			hitRatio := "-"
+			if result.Cache != nil {
+				hitRatio = fmt.Sprintf("%.1f%%", result.Cache.HitRatio*100)
+			}
+			fmt.Printf("%-20s | %8.1f | %8.1f | %8.1f | %s\n", result.Pattern,
+				result.ReadLatency.P50, result.ReadLatency.P99, result.ReadLatency.P999, hitRatio)
+		}
+	}
 }
 
 func createTestFiles(dir string, count, sizeBytes int) ([]FileInfo, error) {
@@ -213,6 +294,256 @@ func runBenchmark(files []FileInfo, patternID int) (time.Duration, int64, error)
 	return duration, totalBytes, nil
 }
 
+// Run every iteration of one pattern with config.Clients goroutines and
+// summarize them, taking the cache's counters around the whole run
+func runConcurrentPattern(files []FileInfo, patternID int, config BenchmarkConfig) BenchmarkResult {
+	var before map[string]float64
+	if config.MetricsURL != "" {
+		var err error
+		if before, err = scrapeMetrics(config.MetricsURL); err != nil {
+			fmt.Printf("  Cannot read cache metrics: %v\n", err)
+		}
+	}
+
+	var totalDuration time.Duration
+	var totalBytes int64
+	var reads, writes []time.Duration
+	completed := 0
+	for i := 0; i < config.Iterations; i++ {
+		fmt.Printf("  Iteration %d/%d...\n", i+1, config.Iterations)
+		duration, stats := runConcurrentBenchmark(files, patternID, config)
+		failed := false
+		for _, s := range stats {
+			if s.err != nil {
+				fmt.Printf("Error running benchmark: %v\n", s.err)
+				failed = true
+				break
+			}
+		}
+		if failed {
+			continue
+		}
+		completed++
+		totalDuration += duration
+		for _, s := range stats {
+			totalBytes += s.bytesRead
+			reads = append(reads, s.readLatencies...)
+			writes = append(writes, s.writeLatencies...)
+		}
+	}
+
+	result := BenchmarkResult{
+		Pattern:      getPatternName(patternID),
+		FileCount:    len(files),
+		Clients:      config.Clients,
+		Reads:        int64(len(reads)),
+		Writes:       int64(len(writes)),
+		ReadLatency:  summarizeLatencies(reads),
+		WriteLatency: summarizeLatencies(writes),
+	}
+	if completed > 0 {
+		result.Duration = totalDuration / time.Duration(completed)
+		result.BytesRead = totalBytes / int64(completed)
+		seconds := result.Duration.Seconds()
+		result.ReadPerSec = float64(len(reads)) / float64(completed) / seconds
+		result.MBytesPerSec = float64(result.BytesRead) / 1024 / 1024 / seconds
+	}
+	if before != nil {
+		if after, err := scrapeMetrics(config.MetricsURL); err != nil {
+			fmt.Printf("  Cannot read cache metrics: %v\n", err)
+		} else {
+			result.Cache = cacheBreakdown(before, after)
+		}
+	}
+
+	fmt.Printf("  Result: %.2f MB/s, %.2f reads/s", result.MBytesPerSec, result.ReadPerSec)
+	if result.ReadLatency != nil {
+		fmt.Printf(", read p50 %.1fus p99 %.1fus p99.9 %.1fus",
+			result.ReadLatency.P50, result.ReadLatency.P99, result.ReadLatency.P999)
+	}
+	if result.Cache != nil {
+		fmt.Printf(", %.1f%% hits", result.Cache.HitRatio*100)
+	}
+	fmt.Println()
+	return result
+}
+
+// One iteration: every client walks its own copy of the access pattern,
+// rotated so the clients start spread over the files
+func runConcurrentBenchmark(files []FileInfo, patternID int, config BenchmarkConfig) (time.Duration, []clientStats) {
+	stats := make([]clientStats, config.Clients)
+	orders := make([][]int, config.Clients)
+	for c := range orders {
+		order := createAccessPattern(files, patternID)
+		shift := c * len(order) / config.Clients
+		orders[c] = append(order[shift:], order[:shift]...)
+	}
+
+	var wg sync.WaitGroup
+	seed := time.Now().UnixNano()
+	startTime := time.Now()
+	for c := 0; c < config.Clients; c++ {
+		wg.Add(1)
+		go func(c int) {
+			defer wg.Done()
+			stats[c] = runClient(files, orders[c], config, rand.New(rand.NewSource(seed+int64(c))))
+		}(c)
+	}
+	wg.Wait()
+	return time.Since(startTime), stats
+}
+
+// Read (or, at config.WriteRatio, overwrite) one readSizeKB range at a
+// random aligned offset of each file in `order`. Only the ReadAt or
+// WriteAt is timed, not the open and close around it.
+func runClient(files []FileInfo, order []int, config BenchmarkConfig, rng *rand.Rand) clientStats {
+	var stats clientStats
+	readSize := int64(config.ReadSizeKB) * 1024
+	var buf, data []byte
+
+	for _, idx := range order {
+		if config.ThinkTimeMs > 0 {
+			time.Sleep(time.Duration(rng.ExpFloat64() * config.ThinkTimeMs * float64(time.Millisecond)))
+		}
+		file := files[idx]
+		size := readSize
+		if size <= 0 || size > file.Size {
+			size = file.Size
+		}
+		offset := int64(0)
+		if ranges := file.Size / size; ranges > 1 {
+			offset = rng.Int63n(ranges) * size
+		}
+		write := rng.Float64() < config.WriteRatio
+
+		flags := os.O_RDONLY
+		if write {
+			flags = os.O_WRONLY
+		}
+		f, err := os.OpenFile(file.Path, flags, 0)
+		if err != nil {
+			stats.err = fmt.Errorf("failed to open file %s: %w", file.Path, err)
+			return stats
+		}
+		var n int
+		opStart := time.Now()
+		if write {
+			if int64(len(data)) < size {
+				data = make([]byte, size)
+				rng.Read(data)
+			}
+			n, err = f.WriteAt(data[:size], offset)
+		} else {
+			if int64(len(buf)) < size {
+				buf = make([]byte, size)
+			}
+			n, err = f.ReadAt(buf[:size], offset)
+			if err == io.EOF {
+				err = nil
+			}
+		}
+		elapsed := time.Since(opStart)
+		f.Close()
+		if err != nil {
+			stats.err = fmt.Errorf("failed to access file %s at %d: %w", file.Path, offset, err)
+			return stats
+		}
+		if write {
+			stats.writeLatencies = append(stats.writeLatencies, elapsed)
+		} else {
+			stats.readLatencies = append(stats.readLatencies, elapsed)
+			stats.bytesRead += int64(n)
+		}
+	}
+	return stats
+}
+
+func summarizeLatencies(latencies []time.Duration) *LatencySummary {
+	if len(latencies) == 0 {
+		return nil
+	}
+	sort.Slice(latencies, func(i, j int) bool { return latencies[i] < latencies[j] })
+	var total time.Duration
+	for _, l := range latencies {
+		total += l
+	}
+	us := func(d time.Duration) float64 { return float64(d) / float64(time.Microsecond) }
+	quantile := func(q float64) float64 {
+		rank := int(math.Ceil(q*float64(len(latencies)))) - 1
+		if rank < 0 {
+			rank = 0
+		}
+		return us(latencies[rank])
+	}
+	return &LatencySummary{
+		Mean: us(total) / float64(len(latencies)),
+		P50:  quantile(0.5),
+		P99:  quantile(0.99),
+		P999: quantile(0.999),
+		Max:  us(latencies[len(latencies)-1]),
+	}
+}
+
+// Samples of a Prometheus text exposition, keyed by name and labels
+func scrapeMetrics(url string) (map[string]float64, error) {
+	client := http.Client{Timeout: 5 * time.Second}
+	resp, err := client.Get(url)
+	if err != nil {
+		return nil, err
+	}
+	defer resp.Body.Close()
+	if resp.StatusCode != http.StatusOK {
+		return nil, fmt.Errorf("%s: %s", url, resp.Status)
+	}
+
+	samples := make(map[string]float64)
+	scanner := bufio.NewScanner(resp.Body)
+	for scanner.Scan() {
+		line := scanner.Text()
+		if line == "" || strings.HasPrefix(line, "#") {
+			continue
+		}
+		split := strings.LastIndexByte(line, ' ')
+		if split < 0 {
+			continue
+		}
+		if value, err := strconv.ParseFloat(line[split+1:], 64); err == nil {
+			samples[line[:split]] = value
+		}
+	}
+	return samples, scanner.Err()
+}
+
+func cacheBreakdown(before, after map[string]float64) *CacheBreakdown {
+	delta := func(series string) int64 { return int64(after[series] - before[series]) }
+	// Summed over every label, e.g. each prefetch source
+	family := func(name string) int64 {
+		var total float64
+		for series, value := range after {
+			if series == name || strings.HasPrefix(series, name+"{") {
+				total += value - before[series]
+			}
+		}
+		return int64(total)
+	}
+
+	breakdown := &CacheBreakdown{
+		Hits:           delta(`fcache_reads_total{result="hit"}`),
+		PartialHits:    delta(`fcache_reads_total{result="partial"}`),
+		Misses:         delta(`fcache_reads_total{result="miss"}`),
+		BytesServed:    delta("fcache_served_bytes_total"),
+		DiskReadBytes:  delta("fcache_disk_read_bytes_total"),
+		PrefetchUsed:   family("fcache_prefetch_used_total"),
+		PrefetchWasted: family("fcache_prefetch_wasted_total"),
+	}
+	if total := breakdown.Hits + breakdown.PartialHits + breakdown.Misses; total > 0 {
+		breakdown.HitRatio = float64(breakdown.Hits) / float64(total)
+		breakdown.PartialRatio = float64(breakdown.PartialHits) / float64(total)
+		breakdown.MissRatio = float64(breakdown.Misses) / float64(total)
+	}
+	return breakdown
+}
+
 func createAccessPattern(files []FileInfo, patternID int) []int {
 	n := len(files)
 	indices := make([]int, n)
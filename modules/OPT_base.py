@@ -1,11 +1,108 @@
+import json
+import os
+from collections import deque, OrderedDict
+from itertools import islice
+
+class RingHistory(deque):
+    '''Fixed-capacity access history; the oldest reads fall off the front.'''
+    def __init__(self, capacity=1024):
+        super().__init__(maxlen=max(1, capacity))
+
+    def tail(self, n):
+        # last n reads, oldest first
+        if n <= 0:
+            return []
+        return list(islice(reversed(self), n))[::-1]
+
+class TransitionTable:
+    '''
+    Capacity-bounded state -> {successor: weight} table.
+    Each state keeps at most max_successors successors: a new successor
+    replaces the lightest one and inherits its weight (space-saving), so
+    heavy edges survive. Once max_states is reached the least recently
+    updated state is dropped.
+    '''
+    def __init__(self, max_states=65536, max_successors=8):
+        self.max_states = max(1, max_states)
+        self.max_successors = max(1, max_successors)
+        self.states = OrderedDict()
+
+    def add(self, state, successor, weight=1):
+        successors = self.states.get(state)
+        if successors is None:
+            successors = self.states[state] = {}
+            if len(self.states) > self.max_states:
+                self.states.popitem(last=False)
+        else:
+            self.states.move_to_end(state)
+        if successor in successors:
+            successors[successor] += weight
+        elif len(successors) < self.max_successors:
+            successors[successor] = weight
+        else:
+            lightest = min(successors, key=successors.get)
+            successors[successor] = successors.pop(lightest) + weight
+
+    def __contains__(self, state):
+        return state in self.states
+
+    def __getitem__(self, state):
+        return self.states[state]
+
+    def __len__(self):
+        return len(self.states)
+
+def encode_state(value):
+    # JSON has no tuples, deques or non-string keys, so those are tagged
+    if isinstance(value, RingHistory):
+        return {'ring': value.maxlen, 'items': [encode_state(v) for v in value]}
+    if isinstance(value, deque):
+        return {'deque': value.maxlen, 'items': [encode_state(v) for v in value]}
+    if isinstance(value, TransitionTable):
+        return {'table': [value.max_states, value.max_successors],
+                'states': [[encode_state(state), [[encode_state(k), w] for k, w in successors.items()]]
+                           for state, successors in value.states.items()]}
+    if isinstance(value, tuple):
+        return {'tuple': [encode_state(v) for v in value]}
+    if isinstance(value, dict):
+        return {'dict': [[encode_state(k), encode_state(v)] for k, v in value.items()]}
+    if isinstance(value, list):
+        return [encode_state(v) for v in value]
+    if value is None or isinstance(value, (str, int, float)):
+        return value
+    raise ValueError(f'cannot save {type(value).__name__} in predictor state')
+
+def decode_state(value):
+    if isinstance(value, list):
+        return [decode_state(v) for v in value]
+    if not isinstance(value, dict):
+        return value
+    if 'ring' in value:
+        history = RingHistory(value['ring'])
+        history.extend(decode_state(v) for v in value['items'])
+        return history
+    if 'deque' in value:
+        return deque((decode_state(v) for v in value['items']), maxlen=value['deque'])
+    if 'table' in value:
+        table = TransitionTable(*value['table'])
+        for state, successors in value['states']:
+            table.states[decode_state(state)] = {decode_state(k): w for k, w in successors}
+        return table
+    if 'tuple' in value:
+        return tuple(decode_state(v) for v in value['tuple'])
+    return {decode_state(k): decode_state(v) for k, v in value['dict']}
+
 class Base_Opt:
-    history: list[str] | list
+    history: RingHistory
     file_exists_cache: dict
     source_dir: str
     name: str = 'Base'
+    min_confidence: float = 0.2  # guesses below this are not prefetched
+    source: int | None = None  # prefetch source id, registered with the cache on first prefetch
+    transient = ('source',)  # attributes not saved by save_state
 
-    def __init__(self):
-        self.history = []
+    def __init__(self, history_size=1024):
+        self.history = RingHistory(history_size)
 
     def last_file_read(self, other_than=None) -> str | None:
         if not self.history:
@@ -23,6 +120,65 @@ class Base_Opt:
     def predict_nexts(self, file_read=None, num_predictions=1):
         return
 
+    def predict_scored(self, file_read=None, num_predictions=1):
+        # [(file, confidence)], best first; predictors without a score report 1.0
+        predictions = self.predict_nexts(file_read, num_predictions=num_predictions)
+        if not predictions:
+            return []
+        if isinstance(predictions, str):
+            predictions = [predictions]
+        return [(file, 1.0) for file in predictions]
+
+    def log_predict(self, file_read: str, fcache, prefetch: bool, num_predictions=2):
+        # logs the read and, if prefetch is on, requests the predicted next files.
+        # num_predictions is the most the cache will be asked for; it scales that
+        # down with the measured accuracy of this predictor's earlier prefetches
+        if self.last_file_read() == file_read:
+            return
+        self.log_read(file_read)
+        if prefetch:
+            if self.source is None:
+                self.source = fcache.register_source(self.name)
+            depth = fcache.prefetch_depth(self.source, num_predictions)
+            if not depth:
+                return
+            predictions = [file for file, confidence in self.predict_scored(file_read, depth)
+                           if confidence >= self.min_confidence]
+            # newest requests are served first, so queue the best guess last
+            for file in reversed(predictions):
+                fcache.request_file(file, 0, self.source)
+
+    def log_predict_batch(self, files_read, fcache, prefetch: bool, num_predictions=2):
+        # called by the predictor thread with reads drained from the access queue;
+        # only the newest read is worth prefetching for
+        for i, file_read in enumerate(files_read):
+            last = i == len(files_read) - 1
+            self.log_predict(file_read, fcache, prefetch and last, num_predictions)
+
+    def save_state(self, filepath):
+        # saves the model next to the cache snapshot; written to a temp file first.
+        # Unlike the native predictors' snapshot this is plain JSON, read back in
+        # full at startup, so it suits the bounded tables of the Python models only
+        state = {k: encode_state(v) for k, v in vars(self).items() if k not in self.transient}
+        with open(filepath + '.tmp', 'w') as f:
+            json.dump({'predictor': type(self).__name__, 'state': state}, f, separators=(',', ':'))
+        os.replace(filepath + '.tmp', filepath)
+
+    def load_state(self, filepath):
+        # returns False if there is no saved state for this predictor; ValueError if it is corrupt
+        if not os.path.exists(filepath):
+            return False
+        with open(filepath) as f:
+            saved = json.load(f)
+        try:
+            if saved['predictor'] != type(self).__name__:
+                return False
+            state = {k: decode_state(v) for k, v in saved['state'].items()}
+        except (KeyError, TypeError, AttributeError) as e:
+            raise ValueError(f'malformed predictor state in {filepath}') from e
+        vars(self).update(state)
+        return True
+
     def status_fmt(self):
         # prints last 5 items from history
-        print(self.history[-5:])
+        print(self.history.tail(5))
@@ -0,0 +1,139 @@
+'''
+Ensemble of predictors with online model selection
+
+Markov and Adaptive Markov each win on different patterns (see Notes.txt),
+and which one fits can change while the mount runs. This meta-predictor
+feeds every member the same access stream and, on each read, checks
+whether each member's last guesses contained it. Members are weighted by
+multiplicative weights: a member that missed has its weight multiplied by
+beta, then a small fixed share of the total is spread evenly so a member
+that lost out recovers within a few dozen reads once the workload shifts.
+
+The prefetch budget of a read is split by weight, best member first. Each
+member prefetches under its own source id, so the cache's per-source
+accuracy stats and its prefetch_depth throttling apply to every member on
+its own. A sliding window of recent hits is kept for status only.
+
+At most one native member fits per cache, since fcache_cpp runs a single
+native predictor.
+'''
+
+from collections import deque
+from modules.OPT_base import Base_Opt
+
+class Ensemble_Opt(Base_Opt):
+    name: str = 'Ensemble'
+    transient = ('source', 'members', 'sources', 'guesses')
+
+    def __init__(self, members, history_size=1024, beta=0.8, share=0.05, window=100, eval_depth=4):
+        super().__init__(history_size)
+        self.members = list(members)
+        self.beta = min(max(0.01, beta), 0.99)
+        self.share = min(max(0.0, share), 0.5)
+        self.eval_depth = max(1, eval_depth)
+        self.window = max(1, window)
+        self.weights = [1 / len(self.members)] * len(self.members)
+        self.recent = [deque(maxlen=self.window) for _ in self.members]
+        self.sources = [None] * len(self.members)
+        self.guesses = [[] for _ in self.members]  # each member's scored guesses after the last read
+
+    @staticmethod
+    def _guesses(member, file_read, num_predictions):
+        # native members name files without the leading slash
+        return [('/' + file.lstrip('/'), confidence)
+                for file, confidence in member.predict_scored(file_read, num_predictions)]
+
+    def log_read(self, file_read):
+        super().log_read(file_read)
+        target = '/' + file_read.lstrip('/')
+        for i, member in enumerate(self.members):
+            # a member with nothing to offer scores a miss as well
+            hit = any(file == target for file, _ in self.guesses[i])
+            self.recent[i].append(hit)
+            if not hit:
+                self.weights[i] *= self.beta
+            member.log_read(file_read)
+            self.guesses[i] = self._guesses(member, file_read, self.eval_depth)
+        total = sum(self.weights)
+        self.weights = [(1 - self.share) * w / total + self.share / len(self.weights) for w in self.weights]
+
+    def ranked(self):
+        # member indexes, heaviest first
+        return sorted(range(len(self.members)), key=lambda i: self.weights[i], reverse=True)
+
+    def predict_scored(self, file_read=None, num_predictions=1):
+        # weighted vote: a file scores the weight-averaged confidence of the members guessing it
+        if file_read and file_read != self.last_file_read():
+            guesses = [self._guesses(member, file_read, num_predictions) for member in self.members]
+        else:
+            guesses = self.guesses
+        scores = {}
+        for i, member_guesses in enumerate(guesses):
+            for file, confidence in member_guesses[:num_predictions]:
+                scores[file] = scores.get(file, 0) + self.weights[i] * confidence
+        return sorted(scores.items(), key=lambda x: x[1], reverse=True)[:num_predictions]
+
+    def predict_nexts(self, file_read=None, num_predictions=1):
+        result = self.predict_scored(file_read, num_predictions)
+        if not result:
+            return None
+        if num_predictions == 1:
+            return result[0][0]
+        return [file for file, _ in result]
+
+    def log_predict(self, file_read, fcache, prefetch, num_predictions=2):
+        if self.last_file_read() == file_read:
+            return
+        self.log_read(file_read)
+        if not prefetch:
+            return
+        # give each member its weight's share of the budget, the leader at least one
+        requests = []
+        queued = set()
+        remaining = num_predictions
+        for rank, i in enumerate(self.ranked()):
+            share = min(remaining, max(1 if rank == 0 else 0, round(num_predictions * self.weights[i])))
+            if share == 0:
+                continue
+            if self.sources[i] is None:
+                self.sources[i] = fcache.register_source(f'{self.name}/{self.members[i].name}')
+            depth = fcache.prefetch_depth(self.sources[i], share)
+            remaining -= share
+            for file, confidence in self.guesses[i][:depth]:
+                if confidence >= self.members[i].min_confidence and file not in queued:
+                    queued.add(file)
+                    requests.append((file, self.sources[i]))
+        # newest requests are served first, so queue the leader's best guess last
+        for file, source in reversed(requests):
+            fcache.request_file(file, 0, source)
+
+    def save_state(self, filepath):
+        # members are saved without their own transient attributes
+        self.member_states = [(type(member).__name__,
+                               {k: v for k, v in vars(member).items() if k not in member.transient})
+                              for member in self.members]
+        try:
+            super().save_state(filepath)
+        finally:
+            del self.member_states
+
+    def load_state(self, filepath):
+        if not super().load_state(filepath):
+            return False
+        states = vars(self).pop('member_states', [])
+        if len(states) != len(self.members):
+            # saved with other members; keep the fresh models and start the weights over
+            self.weights = [1 / len(self.members)] * len(self.members)
+            self.recent = [deque(maxlen=self.window) for _ in self.members]
+            return False
+        for member, (name, state) in zip(self.members, states):
+            if name == type(member).__name__:
+                vars(member).update(state)
+        return True
+
+    def status_fmt(self):
+        super().status_fmt()
+        for i in self.ranked():
+            recent = self.recent[i]
+            rate = f'{sum(recent) / len(recent):.0%}' if recent else 'n/a'
+            print(f'  {self.members[i].name}: weight {self.weights[i]:.2f}, recent hit rate {rate}')
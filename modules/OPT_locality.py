@@ -0,0 +1,145 @@
+'''
+Directory and path locality predictor
+
+The transition models only know files they have seen followed by others, so
+a file read for the first time predicts nothing. Builds, training jobs and
+media players mostly walk a directory in name order or step through
+numbered files, which the tree itself shows. Besides learned file-to-file
+transitions this predictor guesses from:
+
+1. numeric successors: the last run of digits in the name, advanced with
+   its zero padding kept (shard_0041 -> shard_0042)
+2. sibling order: the names after the file in its directory's sorted
+   listing, read through the cache's metadata cache
+3. co-access: the files read from the same directory before, by weight
+
+A candidate backed by several signals combines them as independent
+evidence, 1 - prod(1 - p). Only existing regular files are predicted;
+the checks go through the metadata cache, so a wrong numeric guess costs
+a cached ENOENT.
+'''
+
+import bisect
+import posixpath
+import re
+import stat
+from modules.OPT_base import Base_Opt, TransitionTable
+
+class Locality_Opt(Base_Opt):
+    name: str = 'Locality'
+    transient = ('source', 'fcache', 'listings')
+    successor_confidence = 0.6  # first numeric successor; each further one multiplies it again
+    sibling_confidence = 0.4  # next sibling; the i-th one gets this / i
+    coaccess_confidence = 0.3  # scaled by the file's share of its directory's reads
+    max_listings = 64
+
+    def __init__(self, fcache, history_size=1024, max_states=65536, max_successors=8, max_dirs=4096,
+                 max_members=16):
+        super().__init__(history_size)
+        self.fcache = fcache
+        self.transitions = TransitionTable(max_states, max_successors)
+        self.directories = TransitionTable(max_dirs, max_members)
+        self.listings = {}  # directory -> (mtime, sorted names)
+
+    def log_read(self, file_read):
+        previous = self.last_file_read(file_read)
+        super().log_read(file_read)
+        if previous:
+            self.transitions.add(previous, file_read)
+        self.directories.add(posixpath.dirname(file_read), file_read)
+
+    @staticmethod
+    def numeric_successor(file_read, step=1):
+        # digits in the stem win over the extension: take2.mp3 -> take3.mp3, archive.001 -> archive.002
+        directory, base = posixpath.split(file_read)
+        stem, ext = posixpath.splitext(base)
+        match = re.search(r'(\d+)(\D*)$', stem)
+        if match:
+            base, start, end = stem, match.start(1), match.end(1)
+            suffix = ext
+        else:
+            match = re.search(r'(\d+)(\D*)$', base)
+            if not match:
+                return None
+            start, end = match.start(1), match.end(1)
+            suffix = ''
+        digits = base[start:end]
+        return posixpath.join(directory, base[:start] + str(int(digits) + step).zfill(len(digits)) +
+                              base[end:] + suffix)
+
+    def _sorted_listing(self, directory):
+        # re-sorted only when the directory's mtime says its entries changed
+        try:
+            mtime = self.fcache.stat(directory)['st_mtime']
+            cached = self.listings.get(directory)
+            if cached and cached[0] == mtime:
+                return cached[1]
+            names = sorted(self.fcache.listdir(directory))
+        except OSError:
+            return None
+        if directory not in self.listings and len(self.listings) >= self.max_listings:
+            self.listings.pop(next(iter(self.listings)))
+        self.listings[directory] = (mtime, names)
+        return names
+
+    def _is_file(self, path):
+        try:
+            mode = self.fcache.stat(path)['st_mode']
+        except OSError:
+            return False
+        return stat.S_ISREG(mode) or stat.S_ISLNK(mode)
+
+    def predict_scored(self, file_read=None, num_predictions=1):
+        file_read = file_read or self.last_file_read()
+        if not file_read:
+            return []
+        scores = {}
+
+        def vote(candidate, confidence):
+            scores[candidate] = 1 - (1 - scores.get(candidate, 0)) * (1 - confidence)
+
+        if file_read in self.transitions:
+            successors = self.transitions[file_read]
+            total = sum(successors.values())
+            for candidate, weight in successors.items():
+                vote(candidate, weight / total)
+        confidence = self.successor_confidence
+        for step in range(1, num_predictions + 1):
+            candidate = self.numeric_successor(file_read, step)
+            if candidate is None:
+                break
+            vote(candidate, confidence)
+            confidence *= self.successor_confidence
+        directory, base = posixpath.split(file_read)
+        names = self._sorted_listing(directory)
+        if names:
+            # twice as many as wanted, since some siblings are directories
+            first = bisect.bisect_right(names, base)
+            for i, name in enumerate(names[first:first + 2 * num_predictions]):
+                vote(posixpath.join(directory, name), self.sibling_confidence / (i + 1))
+        if directory in self.directories:
+            members = self.directories[directory]
+            total = sum(members.values())
+            for candidate, weight in members.items():
+                vote(candidate, self.coaccess_confidence * weight / total)
+
+        result = []
+        for candidate, score in sorted(scores.items(), key=lambda x: x[1], reverse=True):
+            if len(result) == num_predictions:
+                break
+            if candidate != file_read and self._is_file(candidate):
+                result.append((candidate, score))
+        return result
+
+    def predict_nexts(self, file_read=None, num_predictions=1):
+        result = self.predict_scored(file_read, num_predictions)
+        if not result:
+            return None
+        if num_predictions == 1:
+            return result[0][0]
+        return [file for file, _ in result]
+
+    def status_fmt(self):
+        super().status_fmt()
+        print(f"Locality model - Transitions: {len(self.transitions)}, Directories: {len(self.directories)}, "
+              f"Listings: {len(self.listings)}")
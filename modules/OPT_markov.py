@@ -1,11 +1,11 @@
-from modules.OPT_base import Base_Opt
+from modules.OPT_base import Base_Opt, TransitionTable
 
 class Markov_Opt(Base_Opt):
     name: str = 'Markov'
-    def __init__(self, order=2):
-        super().__init__()
+    def __init__(self, order=2, history_size=1024, max_states=65536, max_successors=8):
+        super().__init__(max(history_size, order + 1))
         self.order = max(1, order)
-        self.transitions = {}
+        self.transitions = TransitionTable(max_states, max_successors)
     
     def log_read(self, file_read):
         super().log_read(file_read)
@@ -13,15 +13,15 @@ class Markov_Opt(Base_Opt):
         if len(self.history) <= self.order:
             return
             
-        state = tuple(self.history[-self.order-1:-1])
-        
-        if state not in self.transitions:
-            self.transitions[state] = {}
-        
-        self.transitions[state].setdefault(file_read, 0)
-        self.transitions[state][file_read] += 1
+        state = tuple(self.history.tail(self.order + 1)[:-1])
+        self.transitions.add(state, file_read)
     
     def _get_next(self, context):
+        scored = self._get_next_scored(context)
+        return scored[0] if scored else None
+
+    def _get_next_scored(self, context):
+        # (best successor, its share of the state's weight)
         state = tuple(context[-self.order:])
         
         # Try reducing order if needed
@@ -33,39 +33,47 @@ class Markov_Opt(Base_Opt):
             
         # Get best prediction for this state
         transitions = self.transitions[state]
-        return max(transitions.items(), key=lambda x: x[1])[0]
+        best, weight = max(transitions.items(), key=lambda x: x[1])
+        return best, weight / sum(transitions.values())
     
-    def predict_nexts(self, file_read=None, num_predictions=1):
-        # Start with current context
-        context = list(self.history)
+    def predict_scored(self, file_read=None, num_predictions=1):
+        # Start with current context; only the last `order` reads matter
+        context = self.history.tail(self.order)
         if file_read and (not context or context[-1] != file_read):
             context.append(file_read)
         
         if len(context) < self.order:
-            return None
-        
-        # Single prediction case
-        if num_predictions == 1:
-            return self._get_next(context)
+            return []
         
-        # Multiple predictions case
+        # Chain predictions; each one is only as likely as the ones before it
         result = []
+        confidence = 1.0
         for _ in range(num_predictions):
-            next_file = self._get_next(context)
-            if not next_file:
+            scored = self._get_next_scored(context)
+            if not scored:
                 break
-                
-            result.append(next_file)
+            
+            next_file, share = scored
+            confidence *= share
+            result.append((next_file, confidence))
             context.append(next_file)
         
-        return result or None
+        return result
+    
+    def predict_nexts(self, file_read=None, num_predictions=1):
+        result = self.predict_scored(file_read, num_predictions)
+        if not result:
+            return None
+        if num_predictions == 1:
+            return result[0][0]
+        return [file for file, _ in result]
     
     def status_fmt(self):
         super().status_fmt()
         print(f"Markov model - Order: {self.order}, States: {len(self.transitions)}")
         
         if len(self.history) >= self.order:
-            state = tuple(self.history[-self.order:])
+            state = tuple(self.history.tail(self.order))
             
             if state in self.transitions:
                 print(f"Transitions from {state}:")
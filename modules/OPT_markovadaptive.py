@@ -11,38 +11,39 @@ Unlike traditional fixed-order Markov models that use exact state tuples,
 this model weighs influence from all recent states based on recency.
 '''
 
-from modules.OPT_base import Base_Opt
+from modules.OPT_base import Base_Opt, TransitionTable
 from collections import defaultdict
 
 class AdaptiveMarkov_Opt(Base_Opt):
     name: str = 'Adaptive Weighted Markov'
-    def __init__(self, history_length=5, learning_rate=0.1, decay=0.9):
-        super().__init__()
+    def __init__(self, history_length=5, learning_rate=0.1, decay=0.9, history_size=1024,
+                 max_states=65536, max_successors=16):
+        super().__init__(max(history_size, 11))
         self.history_length = min(max(1, history_length), 10)  # Clamp between 1 and 10
         self.learning_rate = min(max(0.01, learning_rate), 1.0)  # Clamp between 0.01 and 1.0
         self.decay = min(max(0.5, decay), 0.99)  # Clamp between 0.5 and 0.99
-        self.transitions = defaultdict(lambda: defaultdict(float))
+        self.transitions = TransitionTable(max_states, max_successors)
     
     def log_read(self, file_read):
         super().log_read(file_read)
         
         # Update transition weights from recent history to current file
-        history = self.history[:-1]  # All except current
-        for i, prev_file in enumerate(history[-self.history_length:]):
+        history = self.history.tail(self.history_length + 1)[:-1]  # Recent reads except current
+        for i, prev_file in enumerate(history):
             if prev_file != file_read:  # Avoid self-transitions
                 # Calculate influence based on recency (more recent = higher influence)
-                influence = self.decay ** (len(history[-self.history_length:]) - i - 1)
+                influence = self.decay ** (len(history) - i - 1)
                 # Update weight
-                self.transitions[prev_file][file_read] += self.learning_rate * influence
+                self.transitions.add(prev_file, file_read, self.learning_rate * influence)
     
-    def predict_nexts(self, file_read=None, num_predictions=1):
-        # Start with full history
-        context = list(self.history)
+    def predict_scored(self, file_read=None, num_predictions=1):
+        # Start with the recent history
+        context = self.history.tail(self.history_length)
         if file_read and (not context or context[-1] != file_read):
             context.append(file_read)
         
         if not context:
-            return None
+            return []
         
         # Calculate scores for all potential next files
         scores = defaultdict(float)
@@ -68,15 +69,20 @@ class AdaptiveMarkov_Opt(Base_Opt):
             del scores[current]
         
         if not scores:
-            return None
+            return []
         
+        # Return top N files with their share of the total score
+        total = sum(scores.values())
+        sorted_files = sorted(scores.items(), key=lambda x: x[1], reverse=True)[:num_predictions]
+        return [(file, score / total) for file, score in sorted_files]
+    
+    def predict_nexts(self, file_read=None, num_predictions=1):
+        result = self.predict_scored(file_read, num_predictions)
+        if not result:
+            return None
         if num_predictions == 1:
-            # Return highest scoring file
-            return max(scores.items(), key=lambda x: x[1])[0]
-        else:
-            # Return top N files
-            sorted_files = sorted(scores.items(), key=lambda x: x[1], reverse=True)[:num_predictions]
-            return [file for file, _ in sorted_files] or None
+            return result[0][0]
+        return [file for file, _ in result]
     
     def status_fmt(self):
         super().status_fmt()
@@ -0,0 +1,62 @@
+'''
+Native Markov predictors
+
+Runs the Markov models inside fcache_cpp, next to the cache. Paths are
+interned to integer ids and every state keeps a fixed-size top-K successor
+array, so per-read cost does not grow with uptime. Logging a read,
+predicting and queueing the prefetches is one GIL-released call, and a
+batch drained from the access queue is logged in one call as well.
+
+variant='markov' mirrors Markov_Opt (order-k with back-off to shorter
+contexts), variant='adaptive' mirrors AdaptiveMarkov_Opt (decayed weights
+over the last history_length reads). NativeLocality_Opt mirrors
+Locality_Opt, reading the tree through the cache's metadata cache.
+'''
+
+from modules.OPT_base import Base_Opt
+
+class NativeMarkov_Opt(Base_Opt):
+    name: str = 'Native Markov'
+    transient = ('source', 'fcache')  # the model itself is saved with the cache snapshot
+    def __init__(self, fcache, variant='markov', order=2, history_length=5, learning_rate=0.1, decay=0.9,
+                 max_states=65536, history_size=1024, min_confidence=0.2):
+        super().__init__(history_size)
+        self.fcache = fcache
+        self.variant = variant
+        self.min_confidence = min_confidence
+        self.fcache.configure_predictor(variant, order, history_length, learning_rate, decay, max_states,
+                                        min_confidence)
+
+    def log_read(self, file_read):
+        super().log_read(file_read)
+        self.fcache.log_read(file_read, 0, False)
+
+    def predict_nexts(self, file_read=None, num_predictions=1):
+        predictions = self.fcache.predict(file_read or self.last_file_read() or '', num_predictions)
+        if not predictions:
+            return None
+        if num_predictions == 1:
+            return predictions[0]
+        return predictions
+
+    def log_predict(self, file_read, fcache, prefetch, num_predictions=2):
+        if self.last_file_read() == file_read:
+            return
+        super().log_read(file_read)
+        self.fcache.log_read(file_read, num_predictions if prefetch else 0, prefetch)
+
+    def log_predict_batch(self, files_read, fcache, prefetch, num_predictions=2):
+        for file_read in files_read:
+            if self.last_file_read() != file_read:
+                super().log_read(file_read)
+        self.fcache.log_reads(files_read, num_predictions if prefetch else 0, prefetch)
+
+    def status_fmt(self):
+        super().status_fmt()
+        self.fcache.predictor_status()
+
+class NativeLocality_Opt(NativeMarkov_Opt):
+    name: str = 'Native Locality'
+    def __init__(self, fcache, max_states=65536, history_size=1024, min_confidence=0.2):
+        super().__init__(fcache, 'locality', max_states=max_states, history_size=history_size,
+                         min_confidence=min_confidence)
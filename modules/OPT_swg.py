@@ -2,13 +2,13 @@
     Simple Weighted Graph that will be used to predict the next potential read.
     It will greedly pick the edge with highest weight.
 '''
-from modules.OPT_base import Base_Opt
+from modules.OPT_base import Base_Opt, TransitionTable
 
 class SWG_Opt(Base_Opt):
     name: str = 'Simple Weighted Graph'
-    graph: dict
+    graph: TransitionTable
     '''
-    Example Graph Structure:
+    Example Graph Structure (bounded to max_nodes nodes of max_edges edges):
     ```
         graph = {
             'A': {
@@ -19,27 +19,27 @@ class SWG_Opt(Base_Opt):
     ```
     '''
 
-    def __init__(self):
-        super().__init__()
-        self.graph = {}
+    def __init__(self, history_size=1024, max_nodes=65536, max_edges=8):
+        super().__init__(history_size)
+        self.graph = TransitionTable(max_nodes, max_edges)
 
     def log_read(self, file_read: str):
         super().log_read(file_read)
         last_file_read = self.last_file_read(file_read)
         if last_file_read:
             # l_f_r -> f_r (weight++)
-            if last_file_read not in self.graph:
-                self.graph[last_file_read] = {}
-            if file_read not in self.graph[last_file_read]:
-                self.graph[last_file_read][file_read] = 0
-            self.graph[last_file_read][file_read] += 1
+            self.graph.add(last_file_read, file_read)
 
-    def predict_nexts(self, file_read=None, num_predictions=1):
+    def predict_scored(self, file_read=None, num_predictions=1):
         if file_read in self.graph:
             file_graph = self.graph[file_read]
             assert isinstance(file_graph, dict)
             # check if the dict is not empty
             if file_graph:
                 next_file = max(file_graph, key=lambda k: file_graph[k])
-                return next_file
-        return None 
+                return [(next_file, file_graph[next_file] / sum(file_graph.values()))]
+        return []
+
+    def predict_nexts(self, file_read=None, num_predictions=1):
+        scored = self.predict_scored(file_read, num_predictions)
+        return scored[0][0] if scored else None 
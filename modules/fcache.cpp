@@ -1,19 +1,64 @@
 // fcache.cpp - C++ implementation of FileCacheManager
+// Built with FCACHE_NO_PYTHON, only the cache itself is compiled, for
+// standalone tools such as replay.cpp
+#ifndef FCACHE_NO_PYTHON
 #include <Python.h>
+#endif
 #include <string>
+#include <string_view>
 #include <vector>
+#include <array>
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <list>
+#include <memory>
+#include <tuple>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <cctype>
 #include <thread>
+#include <system_error>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
+#include <chrono>
 #include <queue>
-#include <fstream>
+#include <deque>
 #include <iostream>
+#include <sstream>
 #include <filesystem>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <linux/io_uring.h>
+#include <linux/openat2.h>
+#ifdef FCACHE_FUSE
+#define FUSE_USE_VERSION 31
+#include <fuse_lowlevel.h>
+#include <sys/statvfs.h>
+#endif
 
 namespace fs = std::filesystem;
 
+// Stat mtime in nanoseconds, the version stamp cached chunks are checked against
+static int64_t mtime_ns(const struct timespec& ts) {
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 // Helper function to normalize paths
 std::string normalize_path(const std::string& path) {
     std::string result = path;
@@ -28,367 +73,7831 @@ std::string normalize_path(const std::string& path) {
     return result;
 }
 
-// LRU cache implementation
-class FileCache {
+// True if normalized `path` is `prefix` itself or lies under it as a directory
+static bool under_path(std::string_view path, std::string_view prefix) {
+    return path.size() >= prefix.size() && path.compare(0, prefix.size(), prefix) == 0 &&
+           (path.size() == prefix.size() || path[prefix.size()] == '/');
+}
+
+class SlabAllocator;
+
+// Uninitialized byte buffer for chunk data. Either a block owned by a
+// SlabAllocator, a heap block for sizes above the largest slab class, or a
+// read-only mapping of the file region itself.
+class SlabBuffer {
+private:
+    friend class SlabAllocator;
+    std::shared_ptr<SlabAllocator> owner;  // Null for heap blocks and mappings
+    std::shared_ptr<const void> pin;  // A mapping's MappedFiles token
+    char* ptr;
+    size_t length;
+    size_t block;  // Bytes actually reserved for this buffer
+    bool mapped;
+    
+    void reset();
+    
+public:
+    SlabBuffer() : ptr(nullptr), length(0), block(0), mapped(false) {}
+    SlabBuffer(const SlabBuffer&) = delete;
+    SlabBuffer& operator=(const SlabBuffer&) = delete;
+    SlabBuffer(SlabBuffer&& other) noexcept
+        : owner(std::move(other.owner)), pin(std::move(other.pin)), ptr(other.ptr), length(other.length),
+          block(other.block),
+          mapped(other.mapped) {
+        other.ptr = nullptr;
+        other.length = other.block = 0;
+        other.mapped = false;
+    }
+    SlabBuffer& operator=(SlabBuffer&& other) noexcept {
+        if (this != &other) {
+            reset();
+            owner = std::move(other.owner);
+            pin = std::move(other.pin);
+            ptr = other.ptr;
+            length = other.length;
+            block = other.block;
+            mapped = other.mapped;
+            other.ptr = nullptr;
+            other.length = other.block = 0;
+            other.mapped = false;
+        }
+        return *this;
+    }
+    ~SlabBuffer() { reset(); }
+    
+    static SlabBuffer heap(size_t n) {
+        SlabBuffer buffer;
+        buffer.ptr = n ? new char[n] : nullptr;  // Default-initialized, not zeroed
+        buffer.length = buffer.block = n;
+        return buffer;
+    }
+    
+    // Map `n` bytes of `fd` at page-aligned `offset` and fault them in, so
+    // the buffer is the page cache's copy rather than a second one. Fails
+    // (empty, errno set) unless every page came in; a page past EOF would
+    // otherwise raise SIGBUS on first touch. Must not be written to. `pin`
+    // is the file's MappedFiles token; without one nothing is mapped.
+    static SlabBuffer map(int fd, uint64_t offset, size_t n, std::shared_ptr<const void> pin) {
+        SlabBuffer buffer;
+        if (n == 0 || !pin) {
+            errno = n == 0 ? EINVAL : EBUSY;
+            return buffer;
+        }
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t block = (n + page - 1) / page * page;
+        void* region = mmap(nullptr, block, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, offset);
+        if (region == MAP_FAILED) {
+            return buffer;
+        }
+        std::vector<unsigned char> resident(block / page);
+        if (mincore(region, block, resident.data()) != 0 ||
+            !std::all_of(resident.begin(), resident.end(), [](unsigned char r) { return r & 1; })) {
+            munmap(region, block);
+            errno = EAGAIN;
+            return buffer;
+        }
+        buffer.ptr = (char*)region;
+        buffer.length = n;
+        buffer.block = block;
+        buffer.mapped = true;
+        buffer.pin = std::move(pin);
+        return buffer;
+    }
+    
+    bool is_mapped() const { return mapped; }
+    
+    char* data() { return ptr; }
+    const char* data() const { return ptr; }
+    size_t size() const { return length; }
+    size_t footprint() const { return block; }
+};
+
+// Size-class slab allocator for chunk data. Blocks are power-of-two sizes
+// from one page up to the chunk size, carved from large anonymous mmap
+// arenas and recycled through per-class free lists, so LRU churn never
+// fragments the general heap and no buffer is zero-filled.
+class SlabAllocator : public std::enable_shared_from_this<SlabAllocator> {
 private:
-    struct CacheEntry {
-        std::vector<char> data;
-        size_t size;
+    static constexpr size_t MIN_BLOCK = 4096;
+    static constexpr size_t MIN_ARENA = 64 * 1024 * 1024;
+    
+    struct SizeClass {
+        size_t block_size;
+        void* free_list;  // Freed blocks, linked through their first word
+        std::mutex mutex;
     };
     
-    std::list<std::string> lru_order;
-    std::unordered_map<std::string, std::pair<std::list<std::string>::iterator, CacheEntry>> cache;
-    size_t current_size;
-    size_t max_size;
-    std::mutex mutex;
+    std::vector<std::unique_ptr<SizeClass>> classes;
+    size_t arena_size;
+    std::vector<std::pair<void*, size_t>> arenas;
+    char* arena_cursor;
+    size_t arena_left;
+    std::mutex arena_mutex;
+    std::atomic<size_t> mapped_bytes;
+    std::atomic<size_t> used_bytes;
+    std::atomic<bool> release_freed{false};
+    
+    // Hand a free block's pages back to the kernel, all but the first, which
+    // holds the free-list link. Blocks are page aligned.
+    static void discard(char* block, size_t block_size) {
+        if (block_size > MIN_BLOCK) madvise(block + MIN_BLOCK, block_size - MIN_BLOCK, MADV_DONTNEED);
+    }
+    
+    SizeClass* class_for(size_t n) {
+        for (auto& size_class : classes) {
+            if (n <= size_class->block_size) return size_class.get();
+        }
+        return nullptr;
+    }
+    
+    char* carve(size_t n) {
+        std::lock_guard<std::mutex> lock(arena_mutex);
+        if (arena_left < n) {
+            size_t size = std::max(arena_size, n);
+            void* arena = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (arena == MAP_FAILED) {
+                return nullptr;
+            }
+            arenas.emplace_back(arena, size);
+            mapped_bytes += size;
+            arena_cursor = (char*)arena;
+            arena_left = size;
+        }
+        char* block = arena_cursor;
+        arena_cursor += n;
+        arena_left -= n;
+        return block;
+    }
+    
+public:
+    SlabAllocator(size_t max_block) : arena_cursor(nullptr), arena_left(0), mapped_bytes(0), used_bytes(0) {
+        max_block = (max_block + MIN_BLOCK - 1) / MIN_BLOCK * MIN_BLOCK;
+        for (size_t size = MIN_BLOCK; ; size *= 2) {
+            auto size_class = std::make_unique<SizeClass>();
+            size_class->block_size = std::min(size, max_block);
+            size_class->free_list = nullptr;
+            classes.push_back(std::move(size_class));
+            if (size >= max_block) break;
+        }
+        arena_size = std::max(MIN_ARENA, max_block * 16);
+    }
+    
+    ~SlabAllocator() {
+        for (auto& arena : arenas) {
+            munmap(arena.first, arena.second);
+        }
+    }
+    
+    SlabBuffer allocate(size_t n) {
+        SizeClass* size_class = n ? class_for(n) : nullptr;
+        if (size_class == nullptr) {
+            return SlabBuffer::heap(n);
+        }
+        
+        char* block = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(size_class->mutex);
+            if (size_class->free_list) {
+                block = (char*)size_class->free_list;
+                size_class->free_list = *(void**)block;
+            }
+        }
+        if (block == nullptr) {
+            block = carve(size_class->block_size);
+            if (block == nullptr) {
+                return SlabBuffer::heap(n);
+            }
+        }
+        used_bytes += size_class->block_size;
+        
+        SlabBuffer buffer;
+        buffer.owner = shared_from_this();
+        buffer.ptr = block;
+        buffer.length = n;
+        buffer.block = size_class->block_size;
+        return buffer;
+    }
+    
+    void release(char* block, size_t block_size) {
+        SizeClass* size_class = class_for(block_size);
+        used_bytes -= block_size;
+        if (release_freed.load(std::memory_order_relaxed)) discard(block, block_size);
+        std::lock_guard<std::mutex> lock(size_class->mutex);
+        *(void**)block = size_class->free_list;
+        size_class->free_list = block;
+    }
+    
+    // Discard every block on the free lists. Each list is detached while its
+    // blocks are discarded, so allocations meanwhile just carve new ones.
+    void purge_free() {
+        for (auto& size_class : classes) {
+            void* list;
+            {
+                std::lock_guard<std::mutex> lock(size_class->mutex);
+                list = size_class->free_list;
+                size_class->free_list = nullptr;
+            }
+            if (list == nullptr) continue;
+            void* tail = list;
+            for (void* block = list; block; block = *(void**)block) {
+                discard((char*)block, size_class->block_size);
+                tail = block;
+            }
+            std::lock_guard<std::mutex> lock(size_class->mutex);
+            *(void**)tail = size_class->free_list;
+            size_class->free_list = list;
+        }
+    }
+    
+    // With `release`, freed blocks go back to the kernel as they are freed,
+    // at the cost of a madvise per free and a page fault per reuse
+    void set_release_freed(bool release) {
+        if (release && !release_freed.exchange(true)) {
+            purge_free();
+        } else if (!release) {
+            release_freed = false;
+        }
+    }
+    
+    size_t get_mapped_bytes() const {
+        return mapped_bytes;
+    }
+    
+    size_t get_used_bytes() const {
+        return used_bytes;
+    }
+};
+
+inline void SlabBuffer::reset() {
+    if (owner) {
+        owner->release(ptr, block);
+        owner.reset();
+    } else if (mapped) {
+        munmap(ptr, block);
+        mapped = false;
+        pin.reset();
+    } else {
+        delete[] ptr;
+    }
+    ptr = nullptr;
+    length = block = 0;
+}
+
+// Cache entries are keyed by file and chunk index
+struct ChunkKey {
+    std::string path;
+    uint64_t index;
+    
+    bool operator==(const ChunkKey& other) const {
+        return index == other.index && path == other.path;
+    }
+};
+
+// Non-owning form of ChunkKey for lookups, so probing the cache never
+// copies the path
+struct ChunkRef {
+    std::string_view path;
+    uint64_t index;
+    
+    ChunkRef(std::string_view path, uint64_t index) : path(path), index(index) {}
+    ChunkRef(const ChunkKey& key) : path(key.path), index(key.index) {}
+};
+
+struct ChunkKeyHash {
+    size_t operator()(const ChunkRef& key) const {
+        size_t h = std::hash<std::string_view>()(key.path);
+        return h ^ (std::hash<uint64_t>()(key.index) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+    }
+    
+    size_t operator()(const ChunkKey& key) const {
+        return (*this)(ChunkRef(key));
+    }
+};
+
+// One cached chunk of a file. file_size lets readers clamp to EOF and find
+// the last chunk without touching the disk; together with mtime_ns it is the
+// version of the file the bytes were read from.
+struct CachedChunk {
+    SlabBuffer bytes;
+    uint64_t file_size;
+    uint8_t source = 0;  // Prefetch source that requested the chunk, 0 for demand reads
+    int64_t mtime_ns = 0;
+};
+
+// Per-source prefetch accounting, shared by every shard. A source is one
+// predictor; source 0 (demand reads and read-ahead) is not tracked. A
+// prefetched chunk resolves exactly once: as a hit on its first access, or
+// as wasted when it is evicted before anyone read it.
+struct PrefetchStats {
+    static constexpr size_t MAX_SOURCES = 16;
+    
+    struct Source {
+        std::atomic<uint64_t> issued{0};
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> wasted{0};
+    };
+    
+    std::array<Source, MAX_SOURCES> sources;
+    std::atomic<int64_t> outstanding_bytes{0};  // Prefetched and not read yet
+    
+    void inserted(uint8_t source, size_t size) {
+        sources[source].issued.fetch_add(1, std::memory_order_relaxed);
+        outstanding_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    
+    void resolved(uint8_t source, size_t size, bool hit) {
+        (hit ? sources[source].hits : sources[source].wasted).fetch_add(1, std::memory_order_relaxed);
+        outstanding_bytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+};
+
+// Hot-path counters and latency histograms. Each thread records into its
+// own cache-line-aligned slot with relaxed atomic adds, so recording takes
+// no lock and no line bounces between cores; readers sum the slots. Past
+// SLOTS threads, slots are shared, which only costs contention.
+class Metrics {
+public:
+    enum Counter { Hits, PartialHits, Misses, BytesServed, BytesRead, Evictions, PeerHits, PeerMisses, PeerServed,
+                   NUM_COUNTERS };
+    enum Latency { HitLatency, FillLatency, PrefetchLatency, NUM_LATENCIES };
+    
+    // HDR-style log-linear buckets over nanoseconds: exact below SUB, then
+    // every power of two split into SUB buckets, so a bucket's bound is
+    // within 1/SUB of its values up to 2^(MAX_EXPONENT + 1) ns (~18 min)
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr uint64_t SUB = 1 << SUB_BITS;
+    static constexpr unsigned MAX_EXPONENT = 39;
+    static constexpr size_t BUCKETS = SUB + (MAX_EXPONENT - SUB_BITS + 1) * SUB;
+    static constexpr size_t SLOTS = 16;
+    
+    static size_t bucket_of(uint64_t ns) {
+        if (ns < SUB) return ns;
+        unsigned exponent = 63 - __builtin_clzll(ns);
+        if (exponent > MAX_EXPONENT) return BUCKETS - 1;
+        return SUB + (exponent - SUB_BITS) * SUB + ((ns >> (exponent - SUB_BITS)) & (SUB - 1));
+    }
+    
+    // Smallest value past the bucket
+    static uint64_t bucket_limit(size_t bucket) {
+        if (bucket < SUB) return bucket + 1;
+        size_t exponent = (bucket - SUB) / SUB + SUB_BITS;
+        return (SUB + (bucket - SUB) % SUB + 1) << (exponent - SUB_BITS);
+    }
+    
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    struct Histogram {
+        uint64_t count = 0;
+        uint64_t sum_ns = 0;
+        std::array<uint64_t, BUCKETS> buckets{};
+    
+        // Upper bound of the bucket holding quantile q; 0 when empty
+        uint64_t quantile(double q) const {
+            if (count == 0) return 0;
+            uint64_t rank = std::max<uint64_t>(1, (uint64_t)(q * count + 0.5));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                seen += buckets[i];
+                if (seen >= rank) return bucket_limit(i);
+            }
+            return bucket_limit(BUCKETS - 1);
+        }
+    
+        // Values below `limit`, which should be a bucket boundary
+        uint64_t count_below(uint64_t limit) const {
+            uint64_t total = 0;
+            for (size_t i = 0; i < BUCKETS && bucket_limit(i) <= limit; ++i) total += buckets[i];
+            return total;
+        }
+    };
+    
+    struct Snapshot {
+        std::array<uint64_t, NUM_COUNTERS> counters{};
+        std::array<Histogram, NUM_LATENCIES> latencies;
+    };
+    
+private:
+    struct alignas(64) Slot {
+        std::array<std::atomic<uint64_t>, NUM_COUNTERS> counters{};
+        std::array<std::atomic<uint64_t>, NUM_LATENCIES> sums{};
+        std::array<std::array<std::atomic<uint64_t>, BUCKETS>, NUM_LATENCIES> buckets{};
+    };
+    
+    std::unique_ptr<Slot[]> slots{new Slot[SLOTS]};
+    static inline std::atomic<size_t> next_thread{0};
+    
+    Slot& slot() {
+        static thread_local const size_t index = next_thread.fetch_add(1, std::memory_order_relaxed) % SLOTS;
+        return slots[index];
+    }
+    
+public:
+    void add(Counter counter, uint64_t n = 1) {
+        slot().counters[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+    
+    // Record the time since `start`, from now_ns()
+    void record(Latency latency, uint64_t start) {
+        uint64_t ns = now_ns() - start;
+        Slot& s = slot();
+        s.sums[latency].fetch_add(ns, std::memory_order_relaxed);
+        s.buckets[latency][bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    // Counters are exact; a histogram may miss events recorded while it is summed
+    Snapshot snapshot() const {
+        Snapshot result;
+        for (size_t i = 0; i < SLOTS; ++i) {
+            const Slot& s = slots[i];
+            for (size_t c = 0; c < NUM_COUNTERS; ++c) {
+                result.counters[c] += s.counters[c].load(std::memory_order_relaxed);
+            }
+            for (size_t l = 0; l < NUM_LATENCIES; ++l) {
+                Histogram& histogram = result.latencies[l];
+                histogram.sum_ns += s.sums[l].load(std::memory_order_relaxed);
+                for (size_t b = 0; b < BUCKETS; ++b) {
+                    uint64_t n = s.buckets[l][b].load(std::memory_order_relaxed);
+                    histogram.buckets[b] += n;
+                    histogram.count += n;
+                }
+            }
+        }
+        return result;
+    }
+    
+    static const char* counter_name(size_t counter) {
+        static const char* const names[NUM_COUNTERS] = {"hits", "partial_hits", "misses", "bytes_served",
+                                                        "bytes_read", "evictions", "peer_hits", "peer_misses",
+                                                        "peer_served"};
+        return names[counter];
+    }
+    
+    static const char* latency_name(size_t latency) {
+        static const char* const names[NUM_LATENCIES] = {"hit_latency", "fill_latency", "prefetch_latency"};
+        return names[latency];
+    }
+};
+
+// Cached chunks are shared so a reader can pin them without holding the
+// cache lock. An evicted chunk stays alive until its last pin is dropped.
+using CacheData = std::shared_ptr<const CachedChunk>;
+
+// One cache entry. Holds its key once and is linked intrusively into
+// whichever list its eviction policy keeps it on.
+struct LruLink {
+    LruLink* prev;
+    LruLink* next;
+};
+
+struct CacheNode : LruLink {
+    ChunkKey key;
+    size_t hash;
+    CacheData data;
+    size_t size;
+    uint8_t segment;  // Which of the policy's lists the node is on
+    // Entries arrive through prefetch, so the first hit is the first real
+    // access; frequency-aware policies only count hits after that as reuse
+    bool referenced;
+    uint32_t hits;  // Saturating; ranks hot files for snapshots
+};
+
+struct EvictedChunk {
+    ChunkKey key;
+    CacheData data;
+};
+
+// A write that left a chunk's bytes alone lets it take the file's new
+// version, if it was of the version before the write and keeps its length
+struct Restamp {
+    uint64_t old_size;
+    int64_t old_mtime_ns;
+    uint64_t new_size;
+    int64_t new_mtime_ns;
+    size_t chunk_size;
+    
+    bool applies(uint64_t index, size_t length, uint64_t file_size, int64_t mtime_ns) const {
+        uint64_t start = index * chunk_size;
+        return file_size == old_size && mtime_ns == old_mtime_ns && start < new_size &&
+               length == std::min<uint64_t>(chunk_size, new_size - start);
+    }
+};
+
+// Intrusive doubly linked list of nodes, most recent at the front
+class NodeList {
+private:
+    LruLink head;  // Sentinel: head.next is most recent, head.prev least recent
+    size_t total_bytes;
+    
+public:
+    NodeList() : total_bytes(0) {
+        head.prev = head.next = &head;
+    }
+    
+    NodeList(const NodeList&) = delete;
+    NodeList& operator=(const NodeList&) = delete;
+    
+    bool empty() const {
+        return head.next == &head;
+    }
+    
+    size_t bytes() const {
+        return total_bytes;
+    }
+    
+    CacheNode* back() const {
+        return empty() ? nullptr : static_cast<CacheNode*>(head.prev);
+    }
+    
+    void push_front(CacheNode* node) {
+        node->prev = &head;
+        node->next = head.next;
+        head.next->prev = node;
+        head.next = node;
+        total_bytes += node->size;
+    }
+    
+    void remove(CacheNode* node) {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        total_bytes -= node->size;
+    }
+    
+    void move_to_front(CacheNode* node) {
+        remove(node);
+        push_front(node);
+    }
+};
+
+// Decides which entries a shard evicts. The shard owns the nodes and the
+// index; the policy only orders them. All calls happen under the shard lock.
+class EvictionPolicy {
+public:
+    virtual ~EvictionPolicy() = default;
+    
+    // A lookup found `node`
+    virtual void on_hit(CacheNode* node) = 0;
+    
+    // A lookup found nothing for `hash`
+    virtual void on_miss(size_t /*hash*/) {}
+    
+    // Called before making room for a new entry of `size` bytes
+    virtual void before_insert(size_t /*hash*/, size_t /*size*/) {}
+    
+    // A new node has entered the cache
+    virtual void on_insert(CacheNode* node) = 0;
+    
+    // `node` is leaving the cache; `evicted` is false when it is being replaced
+    virtual void on_remove(CacheNode* node, bool evicted) = 0;
+    
+    // Next node the shard should evict, or nullptr if the cache is empty
+    virtual CacheNode* victim() = 0;
+    
+    // The victim is pinned by a reader; move it out of the way and let the
+    // shard ask for another one
+    virtual void skip(CacheNode* node) = 0;
+    
+    // The shard's budget changed to `capacity` bytes
+    virtual void resize(size_t /*capacity*/) {}
+};
+
+// Plain least-recently-used eviction
+class LruPolicy : public EvictionPolicy {
+private:
+    NodeList order;
+    
+public:
+    void on_hit(CacheNode* node) override {
+        order.move_to_front(node);
+    }
+    
+    void on_insert(CacheNode* node) override {
+        order.push_front(node);
+    }
+    
+    void on_remove(CacheNode* node, bool) override {
+        order.remove(node);
+    }
+    
+    CacheNode* victim() override {
+        return order.back();
+    }
+    
+    void skip(CacheNode* node) override {
+        order.move_to_front(node);
+    }
+};
+
+// Adaptive Replacement Cache (Megiddo & Modha), sized in bytes. T1 holds
+// entries seen once, T2 entries seen again; the ghost lists B1/B2 remember
+// the hashes recently evicted from each and steer the T1 target `p`, so a
+// one-pass scan only cycles through T1 and leaves the T2 working set alone.
+class ArcPolicy : public EvictionPolicy {
+private:
+    enum Segment : uint8_t { T1, T2 };
+    
+    struct GhostList {
+        std::list<std::pair<size_t, size_t>> order;  // (hash, size), most recent first
+        std::unordered_map<size_t, std::list<std::pair<size_t, size_t>>::iterator> index;
+        size_t bytes = 0;
+        
+        bool take(size_t hash) {
+            auto it = index.find(hash);
+            if (it == index.end()) return false;
+            bytes -= it->second->second;
+            order.erase(it->second);
+            index.erase(it);
+            return true;
+        }
+        
+        void add(size_t hash, size_t size, size_t limit) {
+            take(hash);
+            order.emplace_front(hash, size);
+            index[hash] = order.begin();
+            bytes += size;
+            while (bytes > limit && !order.empty()) {
+                bytes -= order.back().second;
+                index.erase(order.back().first);
+                order.pop_back();
+            }
+        }
+    };
+    
+    NodeList t1, t2;
+    GhostList b1, b2;
+    size_t capacity;
+    size_t p;  // Target bytes for T1
+    bool pending_ghost_hit;
+    
+public:
+    ArcPolicy(size_t capacity) : capacity(capacity), p(0), pending_ghost_hit(false) {}
+    
+    void on_hit(CacheNode* node) override {
+        (node->segment == T1 ? t1 : t2).remove(node);
+        if (node->referenced) {
+            node->segment = T2;
+        }
+        (node->segment == T1 ? t1 : t2).push_front(node);
+    }
+    
+    void before_insert(size_t hash, size_t size) override {
+        // A ghost hit means the entry was evicted too early; grow the list it
+        // came from
+        if (b1.take(hash)) {
+            size_t delta = std::max(size, b1.bytes ? b2.bytes / b1.bytes * size : size);
+            p = std::min(capacity, p + delta);
+            pending_ghost_hit = true;
+        } else if (b2.take(hash)) {
+            size_t delta = std::max(size, b2.bytes ? b1.bytes / b2.bytes * size : size);
+            p = p > delta ? p - delta : 0;
+            pending_ghost_hit = true;
+        } else {
+            pending_ghost_hit = false;
+        }
+    }
+    
+    void on_insert(CacheNode* node) override {
+        node->segment = pending_ghost_hit ? T2 : T1;
+        (node->segment == T1 ? t1 : t2).push_front(node);
+        pending_ghost_hit = false;
+    }
+    
+    void on_remove(CacheNode* node, bool evicted) override {
+        if (node->segment == T1) {
+            t1.remove(node);
+            if (evicted) b1.add(node->hash, node->size, capacity);
+        } else {
+            t2.remove(node);
+            if (evicted) b2.add(node->hash, node->size, capacity);
+        }
+    }
+    
+    CacheNode* victim() override {
+        if (!t1.empty() && (t1.bytes() > p || t2.empty())) {
+            return t1.back();
+        }
+        return t2.back();
+    }
+    
+    void skip(CacheNode* node) override {
+        (node->segment == T1 ? t1 : t2).move_to_front(node);
+    }
+    
+    // The ghost lists shrink to the new capacity as they are next added to
+    void resize(size_t new_capacity) override {
+        capacity = new_capacity;
+        p = std::min(p, capacity);
+    }
+};
+
+// Count-min sketch of 4-bit counters with periodic halving, used by
+// TinyLFU to estimate how often a key has been seen recently
+class FrequencySketch {
+private:
+    std::vector<uint64_t> table;  // 16 counters per word
+    size_t mask;
+    size_t additions;
+    size_t sample_size;
+    
+    size_t index_of(size_t hash, unsigned i) const {
+        uint64_t h = (hash + i) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+        return h & mask;
+    }
+    
+    unsigned counter_of(size_t hash, unsigned i) const {
+        return ((hash >> (i * 8)) & 15);
+    }
+    
+public:
+    FrequencySketch(size_t expected_entries) : additions(0) {
+        size_t width = 64;
+        while (width < expected_entries) width <<= 1;
+        table.assign(width, 0);
+        mask = width - 1;
+        sample_size = width * 10;
+    }
+    
+    unsigned frequency(size_t hash) const {
+        unsigned freq = 15;
+        for (unsigned i = 0; i < 4; ++i) {
+            unsigned shift = counter_of(hash, i) * 4;
+            freq = std::min<unsigned>(freq, (table[index_of(hash, i)] >> shift) & 15);
+        }
+        return freq;
+    }
+    
+    void increment(size_t hash) {
+        bool added = false;
+        for (unsigned i = 0; i < 4; ++i) {
+            uint64_t& word = table[index_of(hash, i)];
+            unsigned shift = counter_of(hash, i) * 4;
+            if (((word >> shift) & 15) < 15) {
+                word += 1ULL << shift;
+                added = true;
+            }
+        }
+        if (added && ++additions >= sample_size) {
+            // Age every counter so old popularity fades
+            for (auto& word : table) {
+                word = (word >> 1) & 0x7777777777777777ULL;
+            }
+            additions /= 2;
+        }
+    }
+};
+
+// W-TinyLFU (Einziger, Friedman & Manes). New entries land in a small LRU
+// window; when the window overflows, its oldest entry must beat the main
+// cache's eviction candidate on sketch frequency to be admitted. The main
+// cache is a segmented LRU (probation/protected), so one-hit scans are
+// filtered at the window instead of flushing frequently used entries.
+class TinyLfuPolicy : public EvictionPolicy {
+private:
+    enum Segment : uint8_t { Window, Probation, Protected };
+    
+    NodeList window, probation, protected_;
+    FrequencySketch sketch;
+    size_t window_target;
+    size_t main_target;
+    size_t protected_target;
+    
+    NodeList& list_for(CacheNode* node) {
+        switch (node->segment) {
+            case Window: return window;
+            case Probation: return probation;
+            default: return protected_;
+        }
+    }
+    
+    void demote_protected_overflow() {
+        while (protected_.bytes() > protected_target && !protected_.empty()) {
+            CacheNode* node = protected_.back();
+            protected_.remove(node);
+            node->segment = Probation;
+            probation.push_front(node);
+        }
+    }
+    
+    CacheNode* main_victim() {
+        CacheNode* node = probation.back();
+        return node ? node : protected_.back();
+    }
     
 public:
-    FileCache(size_t max_size) : current_size(0), max_size(max_size) {}
+    TinyLfuPolicy(size_t capacity, size_t expected_entries) : sketch(expected_entries) {
+        set_targets(capacity);
+    }
+    
+    void set_targets(size_t capacity) {
+        window_target = std::max<size_t>(capacity / 100, 1);
+        main_target = capacity - std::min(capacity, window_target);
+        protected_target = main_target / 5 * 4;
+    }
+    
+    void on_hit(CacheNode* node) override {
+        sketch.increment(node->hash);
+        if (node->segment == Probation && node->referenced) {
+            probation.remove(node);
+            node->segment = Protected;
+            protected_.push_front(node);
+            demote_protected_overflow();
+        } else {
+            list_for(node).move_to_front(node);
+        }
+    }
+    
+    void on_miss(size_t hash) override {
+        sketch.increment(hash);
+    }
+    
+    void on_insert(CacheNode* node) override {
+        node->segment = Window;
+        window.push_front(node);
+        
+        // While the main cache has room, window overflow moves there freely
+        while (window.bytes() > window_target && window.back() != node &&
+               probation.bytes() + protected_.bytes() + window.back()->size <= main_target) {
+            CacheNode* oldest = window.back();
+            window.remove(oldest);
+            oldest->segment = Probation;
+            probation.push_front(oldest);
+        }
+    }
+    
+    void on_remove(CacheNode* node, bool) override {
+        list_for(node).remove(node);
+    }
+    
+    CacheNode* victim() override {
+        CacheNode* victim = main_victim();
+        if (window.bytes() <= window_target || window.empty()) {
+            return victim ? victim : window.back();
+        }
+        
+        // Window overflow: its oldest entry duels the main cache's victim
+        CacheNode* candidate = window.back();
+        if (victim == nullptr) {
+            return candidate;
+        }
+        if (sketch.frequency(candidate->hash) > sketch.frequency(victim->hash)) {
+            window.remove(candidate);
+            candidate->segment = Probation;
+            probation.push_front(candidate);
+            return victim;
+        }
+        return candidate;
+    }
+    
+    void skip(CacheNode* node) override {
+        list_for(node).move_to_front(node);
+    }
+    
+    // The sketch keeps its width; it only loses some precision if the cache grew a lot
+    void resize(size_t capacity) override {
+        set_targets(capacity);
+        demote_protected_overflow();
+    }
+};
+
+enum class PolicyKind {
+    Lru,
+    Arc,
+    TinyLfu,
+};
+
+static std::unique_ptr<EvictionPolicy> make_policy(PolicyKind kind, size_t capacity, size_t chunk_size) {
+    switch (kind) {
+        case PolicyKind::Arc:
+            return std::make_unique<ArcPolicy>(capacity);
+        case PolicyKind::TinyLfu:
+            return std::make_unique<TinyLfuPolicy>(capacity, capacity / std::max<size_t>(chunk_size, 1) * 4);
+        default:
+            return std::make_unique<LruPolicy>();
+    }
+}
+
+// Cache for a single shard. Each entry is one node that holds its key once;
+// an open-addressing table (linear probing, backward-shift deletion) of
+// node pointers indexes them by the precomputed key hash, and the eviction
+// policy orders them through intrusive links.
+class CacheShard {
+private:
+    std::vector<CacheNode*> table;
+    size_t count;
+    unsigned shift;  // 64 - log2(table.size()), for Fibonacci hashing
+    std::unique_ptr<EvictionPolicy> policy;
+    // Bytes still allocated, including evicted entries that are pinned by a
+    // reader. Shared with the entry deleters, which may outlive the shard.
+    std::shared_ptr<std::atomic<size_t>> resident_size;
+    size_t max_size;
+    std::shared_ptr<PrefetchStats> prefetch_stats;
+    std::shared_ptr<Metrics> metrics;
+    std::mutex mutex;
+    
+    // Prefetched entries nobody has read yet
+    static bool is_unread_prefetch(const CacheNode* node) {
+        return !node->referenced && node->data->source != 0;
+    }
+    
+    CacheData make_data(CachedChunk&& chunk) {
+        size_t size = chunk.bytes.footprint();
+        auto resident = resident_size;
+        *resident += size;
+        return CacheData(new CachedChunk(std::move(chunk)),
+                         [resident, size](const CachedChunk* p) {
+                             *resident -= size;
+                             delete p;
+                         });
+    }
+    
+    // The node holds one reference; anything beyond that is a reader's pin
+    static bool is_pinned(const CacheNode* node) {
+        return node->data.use_count() > 1;
+    }
+    
+    size_t home_slot(size_t hash) const {
+        return (hash * 0x9e3779b97f4a7c15ULL) >> shift;
+    }
+    
+    size_t mask() const {
+        return table.size() - 1;
+    }
+    
+    // Slot holding `key`, or the empty slot where it would go
+    size_t find_slot(const ChunkRef& key, size_t hash) const {
+        size_t i = home_slot(hash);
+        while (CacheNode* node = table[i]) {
+            if (node->hash == hash && node->key.index == key.index && node->key.path == key.path) {
+                break;
+            }
+            i = (i + 1) & mask();
+        }
+        return i;
+    }
+    
+    CacheNode* find(const ChunkRef& key, size_t hash) const {
+        return table[find_slot(key, hash)];
+    }
+    
+    void grow() {
+        std::vector<CacheNode*> old(table.size() * 2, nullptr);
+        old.swap(table);
+        --shift;
+        for (CacheNode* node : old) {
+            if (node) {
+                size_t i = home_slot(node->hash);
+                while (table[i]) i = (i + 1) & mask();
+                table[i] = node;
+            }
+        }
+    }
+    
+    // Remove `node` from the table, shifting back later members of its probe
+    // run so lookups never need tombstones
+    void unlink_slot(CacheNode* node) {
+        size_t i = home_slot(node->hash);
+        while (table[i] != node) i = (i + 1) & mask();
+        table[i] = nullptr;
+        for (size_t j = (i + 1) & mask(); table[j]; j = (j + 1) & mask()) {
+            size_t home = home_slot(table[j]->hash);
+            bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+            if (!stays) {
+                table[i] = table[j];
+                table[j] = nullptr;
+                i = j;
+            }
+        }
+        --count;
+    }
+    
+    void erase(CacheNode* node, bool evicted) {
+        if (is_unread_prefetch(node)) {
+            // A replaced entry was re-read, not mispredicted; only count evictions
+            if (evicted) {
+                prefetch_stats->resolved(node->data->source, node->size, false);
+            } else {
+                prefetch_stats->outstanding_bytes.fetch_sub(node->size, std::memory_order_relaxed);
+            }
+        }
+        if (evicted) metrics->add(Metrics::Evictions);
+        policy->on_remove(node, evicted);
+        unlink_slot(node);
+        delete node;
+    }
+    
+    void restamp_node(CacheNode* node, const Restamp& restamp) {
+        const CachedChunk& chunk = *node->data;
+        if (is_pinned(node) || !restamp.applies(node->key.index, chunk.bytes.size(), chunk.file_size, chunk.mtime_ns)) {
+            erase(node, false);
+            return;
+        }
+        // Nobody else holds the chunk, so it can change in place
+        CachedChunk& owned = const_cast<CachedChunk&>(chunk);
+        owned.file_size = restamp.new_size;
+        owned.mtime_ns = restamp.new_mtime_ns;
+    }
+    
+    // Evict until `incoming` more bytes fit, counting `max_victims` down to
+    // 0, and skipping entries a reader still holds. Pinned bytes stay counted
+    // in resident_size until they are released. With `evicted`, victims are
+    // handed back instead of freed; returns the bytes handed back.
+    size_t make_room(size_t incoming, std::vector<EvictedChunk>* evicted, size_t& max_victims) {
+        size_t released = 0;
+        size_t skipped = 0;
+        while (*resident_size - released + incoming > max_size && skipped < count && max_victims > 0) {
+            CacheNode* node = policy->victim();
+            if (node == nullptr) {
+                break;
+            }
+            if (is_pinned(node)) {
+                policy->skip(node);
+                ++skipped;
+                continue;
+            }
+            if (evicted) {
+                evicted->push_back({node->key, node->data});
+                released += node->size;
+            }
+            erase(node, true);
+            --max_victims;
+        }
+        return released;
+    }
+    
+public:
+    CacheShard(size_t max_size, std::unique_ptr<EvictionPolicy> policy,
+               std::shared_ptr<PrefetchStats> prefetch_stats, std::shared_ptr<Metrics> metrics)
+        : table(64, nullptr), count(0), shift(64 - 6), policy(std::move(policy)),
+          resident_size(std::make_shared<std::atomic<size_t>>(0)), max_size(max_size),
+          prefetch_stats(std::move(prefetch_stats)), metrics(std::move(metrics)) {}
+    
+    ~CacheShard() {
+        for (CacheNode* node : table) {
+            delete node;
+        }
+    }
+    
+    bool contains(const ChunkRef& key, size_t hash) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return find(key, hash) != nullptr;
+    }
+    
+    CacheData get(const ChunkRef& key, size_t hash) {
+        std::lock_guard<std::mutex> lock(mutex);
+        CacheNode* node = find(key, hash);
+        if (node == nullptr) {
+            policy->on_miss(hash);
+            return nullptr;
+        }
+        
+        policy->on_hit(node);
+        if (is_unread_prefetch(node)) {
+            prefetch_stats->resolved(node->data->source, node->size, true);
+        }
+        node->referenced = true;
+        if (node->hits < UINT32_MAX) ++node->hits;
+        return node->data;
+    }
+    
+    // get without counting as an access: no policy update, no prefetch
+    // accounting and no hit counts
+    CacheData peek(const ChunkRef& key, size_t hash) {
+        std::lock_guard<std::mutex> lock(mutex);
+        CacheNode* node = find(key, hash);
+        return node ? node->data : nullptr;
+    }
+    
+    // Returns false if the chunk cannot fit without evicting pinned entries.
+    // With `evicted`, victims are handed back instead of freed so a lower tier
+    // can keep them once the lock is released; their bytes count as freed.
+    // On success `inserted`, if given, pins the new entry
+    bool insert(const ChunkKey& key, size_t hash, CachedChunk&& chunk,
+                std::vector<EvictedChunk>* evicted = nullptr, CacheData* inserted = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t size = chunk.bytes.footprint();
+        
+        // Replace an existing entry; its old data is freed once unpinned
+        if (CacheNode* existing = find(key, hash)) {
+            erase(existing, false);
+        }
+        
+        policy->before_insert(hash, size);
+        size_t unlimited = SIZE_MAX;
+        size_t released = make_room(size, evicted, unlimited);
+        if (*resident_size - released + size > max_size) {
+            return false;
+        }
+        
+        // Add new entry
+        if ((count + 1) * 10 > table.size() * 7) {
+            grow();
+        }
+        CacheNode* node = new CacheNode();
+        node->key = key;
+        node->hash = hash;
+        node->data = make_data(std::move(chunk));
+        node->size = size;
+        table[find_slot(key, hash)] = node;
+        ++count;
+        policy->on_insert(node);
+        if (node->data->source != 0) {
+            prefetch_stats->inserted(node->data->source, size);
+        }
+        if (inserted) *inserted = node->data;
+        return true;
+    }
+    
+    // Re-stamp `key` with the new version, or drop it if `restamp` does not
+    // apply. A chunk a reader holds is dropped too: its version must not
+    // change under the reader.
+    void restamp(const ChunkRef& key, size_t hash, const Restamp& restamp) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (CacheNode* node = find(key, hash)) restamp_node(node, restamp);
+    }
+    
+    // restamp() every chunk of `path`, scanning the table for them
+    void restamp_path(std::string_view path, const Restamp& restamp) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<CacheNode*> matches;
+        for (CacheNode* node : table) {
+            if (node && node->key.path == path) matches.push_back(node);
+        }
+        for (CacheNode* node : matches) {
+            restamp_node(node, restamp);
+        }
+    }
+    
+    // Drop `key`, handing its data to `removed` if given
+    void erase(const ChunkRef& key, size_t hash, std::vector<EvictedChunk>* removed = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        CacheNode* node = find(key, hash);
+        if (node == nullptr) return;
+        if (removed) removed->push_back({node->key, node->data});
+        erase(node, false);
+    }
+    
+    // Drop every chunk of `prefix` and the files under it, handing their data
+    // to `removed` if given. Pinned chunks stay alive for their readers.
+    void erase_path(std::string_view prefix, std::vector<EvictedChunk>* removed = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Collect first; erasing shifts later table entries back
+        std::vector<CacheNode*> matches;
+        for (CacheNode* node : table) {
+            if (node && under_path(node->key.path, prefix)) matches.push_back(node);
+        }
+        for (CacheNode* node : matches) {
+            if (removed) removed->push_back({node->key, node->data});
+            erase(node, false);
+        }
+    }
+    
+    size_t get_current_size() const {
+        return *resident_size;
+    }
+    
+    void set_max_size(size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        max_size = size;
+        policy->resize(size);
+    }
+    
+    // Evict at most `max_victims` entries towards the budget, so a shrink
+    // holds the lock only briefly at a time. Returns true once the shard
+    // fits, or has nothing left it may evict.
+    bool trim(size_t max_victims, std::vector<EvictedChunk>* evicted) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t released = make_room(0, evicted, max_victims);
+        return max_victims > 0 || *resident_size - released <= max_size;
+    }
+    
+    size_t get_count() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count;
+    }
+    
+    // Add every cached chunk's hits, plus one for being resident, to its path
+    void add_path_scores(std::unordered_map<std::string, uint64_t>& scores) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (CacheNode* node : table) {
+            if (node) scores[node->key.path] += node->hits + 1;
+        }
+    }
+};
+
+// LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md),
+// kept in-tree like the io_uring bindings so the extension has no extra
+// build dependency. Greedy single-probe matching: not the best ratio, but
+// compression runs at memory speed.
+namespace lz4 {
+    constexpr size_t MIN_MATCH = 4;
+    constexpr size_t LAST_LITERALS = 5;  // The block must end in this many literals
+    constexpr size_t MF_LIMIT = 12;      // No match may start in the last 12 bytes
+    constexpr unsigned HASH_BITS = 14;
+    
+    inline uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    
+    // Append a length's 255-continuation bytes; false if out of room
+    inline bool write_length(uint8_t*& op, const uint8_t* oend, size_t length) {
+        for (; length >= 255; length -= 255) {
+            if (op == oend) return false;
+            *op++ = 255;
+        }
+        if (op == oend) return false;
+        *op++ = (uint8_t)length;
+        return true;
+    }
+    
+    inline bool write_sequence(uint8_t*& op, const uint8_t* oend, const uint8_t* literals, size_t literal_length,
+                               size_t offset, size_t match_length, bool last) {
+        if (op == oend) return false;
+        uint8_t* token = op++;
+        *token = (uint8_t)(std::min<size_t>(literal_length, 15) << 4);
+        if (literal_length >= 15 && !write_length(op, oend, literal_length - 15)) return false;
+        if ((size_t)(oend - op) < literal_length) return false;
+        std::memcpy(op, literals, literal_length);
+        op += literal_length;
+        if (last) return true;
+        if (oend - op < 2) return false;
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        size_t extra = match_length - MIN_MATCH;
+        *token |= (uint8_t)std::min<size_t>(extra, 15);
+        return extra < 15 || write_length(op, oend, extra - 15);
+    }
+    
+    // Compress `n` bytes into at most `capacity` bytes; returns the
+    // compressed size, or 0 if it does not fit
+    inline size_t compress(const char* input, size_t n, char* output, size_t capacity) {
+        const uint8_t* src = (const uint8_t*)input;
+        const uint8_t* end = src + n;
+        const uint8_t* ip = src;
+        const uint8_t* anchor = src;
+        uint8_t* op = (uint8_t*)output;
+        const uint8_t* oend = op + capacity;
+        
+        if (n >= MF_LIMIT) {
+            std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+            const uint8_t* mflimit = end - MF_LIMIT;
+            const uint8_t* matchlimit = end - LAST_LITERALS;
+            while (ip <= mflimit) {
+                uint32_t sequence = read32(ip);
+                uint32_t h = (sequence * 2654435761u) >> (32 - HASH_BITS);
+                const uint8_t* ref = src + table[h];
+                table[h] = ip - src;
+                if (ref >= ip || ip - ref > 65535 || read32(ref) != sequence) {
+                    ++ip;
+                    continue;
+                }
+                const uint8_t* match_start = ip;
+                size_t offset = ip - ref;
+                ip += MIN_MATCH;
+                ref += MIN_MATCH;
+                while (ip < matchlimit && *ip == *ref) {
+                    ++ip;
+                    ++ref;
+                }
+                if (!write_sequence(op, oend, anchor, match_start - anchor, offset, ip - match_start, false)) {
+                    return 0;
+                }
+                anchor = ip;
+            }
+        }
+        if (!write_sequence(op, oend, anchor, end - anchor, 0, 0, true)) return 0;
+        return op - (uint8_t*)output;
+    }
+    
+    // Decompress exactly `length` bytes; false on malformed input
+    inline bool decompress(const char* input, size_t n, char* output, size_t length) {
+        const uint8_t* ip = (const uint8_t*)input;
+        const uint8_t* iend = ip + n;
+        uint8_t* op = (uint8_t*)output;
+        uint8_t* const dst = op;
+        const uint8_t* oend = op + length;
+        auto read_length = [&](size_t& value) {
+            uint8_t b;
+            do {
+                if (ip == iend) return false;
+                b = *ip++;
+                value += b;
+            } while (b == 255);
+            return true;
+        };
+        
+        for (;;) {
+            if (ip == iend) return false;
+            uint8_t token = *ip++;
+            size_t literal_length = token >> 4;
+            if (literal_length == 15 && !read_length(literal_length)) return false;
+            if ((size_t)(iend - ip) < literal_length || (size_t)(oend - op) < literal_length) return false;
+            std::memcpy(op, ip, literal_length);
+            ip += literal_length;
+            op += literal_length;
+            if (ip == iend) return op == oend;  // The last sequence has no match
+            
+            if (iend - ip < 2) return false;
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            if (offset == 0 || offset > (size_t)(op - dst)) return false;
+            size_t match_length = token & 15;
+            if (match_length == 15 && !read_length(match_length)) return false;
+            match_length += MIN_MATCH;
+            if ((size_t)(oend - op) < match_length) return false;
+            const uint8_t* match = op - offset;
+            for (size_t i = 0; i < match_length; ++i) {
+                op[i] = match[i];  // Byte by byte: the match may overlap the output
+            }
+            op += match_length;
+        }
+    }
+}
+
+// Compressed tier under the sharded cache. Chunks evicted from RAM are
+// compressed by whichever reader thread evicted them, after the shard lock
+// is released, and kept in an LRU of their own. A hit decompresses only
+// that chunk and promotes it back. Chunks that do not shrink by at least
+// 1/8 are dropped, since keeping them would cost almost as much as the hot
+// tier.
+class CompressedTier {
+private:
+    struct Entry {
+        std::unique_ptr<char[]> bytes;
+        uint32_t compressed_size;
+        uint32_t raw_size;
+        uint64_t file_size;
+        int64_t mtime_ns;
+        std::list<ChunkKey>::iterator lru;
+    };
+    
+    std::unordered_map<ChunkKey, Entry, ChunkKeyHash> entries;
+    std::list<ChunkKey> lru;  // Most recent at the front
+    size_t budget;
+    size_t compressed_bytes = 0;
+    size_t raw_bytes = 0;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> rejected{0};  // Did not compress well enough
+    std::mutex mutex;
+    
+    void remove(std::unordered_map<ChunkKey, Entry, ChunkKeyHash>::iterator it) {
+        compressed_bytes -= it->second.compressed_size;
+        raw_bytes -= it->second.raw_size;
+        lru.erase(it->second.lru);
+        entries.erase(it);
+    }
+    
+public:
+    CompressedTier(size_t budget) : budget(budget) {}
+    
+    void store(const ChunkKey& key, const CachedChunk& chunk) {
+        size_t raw_size = chunk.bytes.size();
+        size_t capacity = raw_size - raw_size / 8;
+        std::unique_ptr<char[]> scratch(new char[std::max<size_t>(1, capacity)]);
+        size_t compressed_size = lz4::compress(chunk.bytes.data(), raw_size, scratch.get(), capacity);
+        if (compressed_size == 0 && raw_size > 0) {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::unique_ptr<char[]> bytes(new char[std::max<size_t>(1, compressed_size)]);
+        std::memcpy(bytes.get(), scratch.get(), compressed_size);
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        auto existing = entries.find(key);
+        if (existing != entries.end()) remove(existing);
+        while (compressed_bytes + compressed_size > budget && !lru.empty()) {
+            remove(entries.find(lru.back()));
+        }
+        if (compressed_bytes + compressed_size > budget) return;
+        lru.push_front(key);
+        entries.emplace(key, Entry{std::move(bytes), (uint32_t)compressed_size, (uint32_t)raw_size,
+                                   chunk.file_size, chunk.mtime_ns, lru.begin()});
+        compressed_bytes += compressed_size;
+        raw_bytes += raw_size;
+    }
+    
+    bool contains(const ChunkRef& key) {
+        ChunkKey owned{std::string(key.path), key.index};
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.count(owned) != 0;
+    }
+    
+    // Remove `key` and decompress it into `chunk`
+    bool take(const ChunkRef& key, SlabAllocator& allocator, CachedChunk& chunk) {
+        ChunkKey owned{std::string(key.path), key.index};
+        Entry entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(owned);
+            if (it == entries.end()) return false;
+            entry = std::move(it->second);
+            compressed_bytes -= entry.compressed_size;
+            raw_bytes -= entry.raw_size;
+            lru.erase(entry.lru);
+            entries.erase(it);
+        }
+        chunk = CachedChunk{allocator.allocate(entry.raw_size), entry.file_size, 0, entry.mtime_ns};
+        if (!lz4::decompress(entry.bytes.get(), entry.compressed_size, chunk.bytes.data(), entry.raw_size)) {
+            return false;
+        }
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    
+    void erase(const ChunkKey& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end()) remove(it);
+    }
+    
+    // Drop chunks [first, end) of `path`
+    void erase_range(const std::string& path, uint64_t first, uint64_t end) {
+        ChunkKey key{path, first};
+        std::lock_guard<std::mutex> lock(mutex);
+        for (; key.index < end && !entries.empty(); ++key.index) {
+            auto it = entries.find(key);
+            if (it != entries.end()) remove(it);
+        }
+    }
+    
+    // Re-stamp or drop chunks [0, chunks) of `path`, as CacheShard::restamp does
+    void restamp_file(const std::string& path, uint64_t chunks, const Restamp& restamp) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto apply = [&](std::unordered_map<ChunkKey, Entry, ChunkKeyHash>::iterator it) {
+            Entry& entry = it->second;
+            if (restamp.applies(it->first.index, entry.raw_size, entry.file_size, entry.mtime_ns)) {
+                entry.file_size = restamp.new_size;
+                entry.mtime_ns = restamp.new_mtime_ns;
+            } else {
+                remove(it);
+            }
+        };
+        if (chunks > entries.size()) {
+            for (auto it = entries.begin(); it != entries.end();) {
+                auto next = std::next(it);
+                if (it->first.path == path) apply(it);
+                it = next;
+            }
+            return;
+        }
+        for (ChunkKey key{path, 0}; key.index < chunks; ++key.index) {
+            auto it = entries.find(key);
+            if (it != entries.end()) apply(it);
+        }
+    }
+    
+    size_t get_count() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+    
+    void erase_path(std::string_view prefix) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = entries.begin(); it != entries.end();) {
+            auto next = std::next(it);
+            if (under_path(it->first.path, prefix)) remove(it);
+            it = next;
+        }
+    }
+    
+    size_t get_size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return compressed_bytes;
+    }
+    
+    void set_budget(size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = size;
+        while (compressed_bytes > budget && !lru.empty()) {
+            remove(entries.find(lru.back()));
+        }
+    }
+    
+    void status(std::ostream& os) {
+        std::lock_guard<std::mutex> lock(mutex);
+        os << "Compressed: " << compressed_bytes / (1024.0 * 1024.0) << " MB holding "
+           << raw_bytes / (1024.0 * 1024.0) << " MB in " << entries.size() << " chunks | Hits: "
+           << hits.load(std::memory_order_relaxed) << " | Rejected: " << rejected.load(std::memory_order_relaxed)
+           << std::endl;
+    }
+};
+
+// Read exactly `length` bytes at `offset`, retrying short reads. Returns the
+// number of bytes read, which is less than `length` only at EOF or on error.
+static size_t pread_fully(int fd, char* buf, size_t length, uint64_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, buf + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    return done;
+}
+
+// preadv counterpart of pread_fully. Consumes `iov` as bytes arrive.
+static size_t preadv_fully(int fd, struct iovec* iov, int count, uint64_t offset) {
+    size_t done = 0;
+    while (count > 0) {
+        ssize_t n = preadv(fd, iov, count, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+        for (; count > 0 && (size_t)n >= iov->iov_len; ++iov, --count) {
+            n -= iov->iov_len;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return done;
+}
+
+static bool pwrite_fully(int fd, const char* buf, size_t length, uint64_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pwrite(fd, buf + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+// Local-disk tier under the in-memory ones, for sources that are slower to
+// reread than local NVMe. Every chunk evicted from RAM is queued to a writer
+// thread that copies it into a fixed-size slot of a preallocated file; the
+// index lives in memory, so the file is scratch space and is removed on
+// shutdown. Reads pread the slot back and promote the chunk into RAM while
+// the slot stays valid for the next eviction. A slot being read is never
+// reused until the read finishes.
+class SpillTier {
+private:
+    struct Slot {
+        ChunkKey key;
+        uint32_t length = 0;
+        uint64_t file_size = 0;
+        int64_t mtime_ns = 0;
+        uint32_t readers = 0;
+        bool used = false;
+        bool orphaned = false;  // Erased while being read; freed by the last reader
+        std::list<uint32_t>::iterator lru;
+    };
+    
+    static constexpr size_t MAX_PENDING = 64;  // Chunks waiting to be written
+    
+    std::string filepath;
+    int fd = -1;
+    size_t slot_size;
+    std::vector<Slot> slots;
+    std::unordered_map<ChunkKey, uint32_t, ChunkKeyHash> index;
+    std::list<uint32_t> lru;  // Used slots, most recent at the front
+    std::vector<uint32_t> free_slots;
+    uint64_t erasures = 0;  // Bumped by erasing, so in-progress writes of stale chunks are dropped
+    std::mutex mutex;
+    
+    std::deque<EvictedChunk> pending;
+    std::mutex pending_mutex;
+    std::condition_variable pending_cv;
+    bool running = true;
+    std::thread writer;
+    
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> writes{0};
+    std::atomic<uint64_t> dropped{0};  // Queue full or no reusable slot
+    
+    // A free slot, or the least recently used one nobody is reading. Caller holds mutex.
+    bool claim_slot(uint32_t& id) {
+        if (!free_slots.empty()) {
+            id = free_slots.back();
+            free_slots.pop_back();
+            return true;
+        }
+        for (auto it = lru.rbegin(); it != lru.rend(); ++it) {
+            Slot& slot = slots[*it];
+            if (slot.readers == 0) {
+                id = *it;
+                index.erase(slot.key);
+                lru.erase(slot.lru);
+                slot.used = false;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Unindex a slot; its space is reused once nobody reads it. Caller holds mutex.
+    std::unordered_map<ChunkKey, uint32_t, ChunkKeyHash>::iterator
+    release(std::unordered_map<ChunkKey, uint32_t, ChunkKeyHash>::iterator it) {
+        Slot& slot = slots[it->second];
+        lru.erase(slot.lru);
+        slot.used = false;
+        if (slot.readers > 0) {
+            slot.orphaned = true;
+        } else {
+            free_slots.push_back(it->second);
+        }
+        return index.erase(it);
+    }
+    
+    // Forget queued chunks whose key matches
+    template <typename Match>
+    void drop_pending(Match match) {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                     [&](const EvictedChunk& victim) { return match(victim.key); }),
+                      pending.end());
+    }
+    
+    void write_chunk(const EvictedChunk& victim) {
+        uint32_t id;
+        uint64_t seen;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (index.count(victim.key)) return;  // Still on disk from an earlier eviction
+            if (!claim_slot(id)) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            seen = erasures;
+        }
+        const CachedChunk& chunk = *victim.data;
+        size_t length = std::min(chunk.bytes.size(), slot_size);
+        if (!pwrite_fully(fd, chunk.bytes.data(), length, (uint64_t)id * slot_size)) {
+            std::cerr << "Failed to write spill file " << filepath << ": " << std::strerror(errno) << std::endl;
+            std::lock_guard<std::mutex> lock(mutex);
+            free_slots.push_back(id);
+            return;
+        }
+        writes.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index.count(victim.key) || erasures != seen) {
+            free_slots.push_back(id);
+            return;
+        }
+        Slot& slot = slots[id];
+        slot.key = victim.key;
+        slot.length = length;
+        slot.file_size = chunk.file_size;
+        slot.mtime_ns = chunk.mtime_ns;
+        slot.used = true;
+        lru.push_front(id);
+        slot.lru = lru.begin();
+        index.emplace(victim.key, id);
+    }
+    
+    void writer_loop() {
+        std::unique_lock<std::mutex> lock(pending_mutex);
+        for (;;) {
+            pending_cv.wait(lock, [this] { return !pending.empty() || !running; });
+            if (pending.empty()) return;
+            EvictedChunk victim = std::move(pending.front());
+            pending.pop_front();
+            lock.unlock();
+            write_chunk(victim);
+            victim.data.reset();  // Free the RAM copy before taking the lock again
+            lock.lock();
+        }
+    }
+    
+public:
+    SpillTier(std::string filepath, size_t slot_size)
+        : filepath(std::move(filepath)), slot_size(std::max<size_t>(1, slot_size)) {}
+    
+    ~SpillTier() {
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            running = false;
+            pending.clear();
+        }
+        pending_cv.notify_all();
+        if (writer.joinable()) writer.join();
+        if (fd >= 0) {
+            close(fd);
+            unlink(filepath.c_str());
+        }
+    }
+    
+    // Create and preallocate the file; false (with errno set) if that fails
+    bool open(size_t size) {
+        size_t count = size / slot_size;
+        if (count == 0 || count > UINT32_MAX) {
+            errno = EINVAL;
+            return false;
+        }
+        fd = ::open(filepath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
+        int err = posix_fallocate(fd, 0, (off_t)(count * slot_size));
+        if (err != 0) {
+            close(fd);
+            fd = -1;
+            unlink(filepath.c_str());
+            errno = err;
+            return false;
+        }
+        slots.resize(count);
+        for (size_t i = count; i-- > 0;) free_slots.push_back(i);
+        writer = std::thread(&SpillTier::writer_loop, this);
+        return true;
+    }
+    
+    // Queue an evicted chunk for writing; dropped when the writer is behind
+    void offer(EvictedChunk&& victim) {
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            if (pending.size() >= MAX_PENDING) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            pending.push_back(std::move(victim));
+        }
+        pending_cv.notify_one();
+    }
+    
+    bool contains(const ChunkRef& key) {
+        ChunkKey owned{std::string(key.path), key.index};
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.count(owned) != 0;
+    }
+    
+    bool read(const ChunkRef& key, SlabAllocator& allocator, CachedChunk& chunk) {
+        ChunkKey owned{std::string(key.path), key.index};
+        uint32_t id;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(owned);
+            if (it == index.end()) return false;
+            id = it->second;
+            Slot& slot = slots[id];
+            ++slot.readers;
+            lru.splice(lru.begin(), lru, slot.lru);
+            chunk = CachedChunk{allocator.allocate(slot.length), slot.file_size, 0, slot.mtime_ns};
+        }
+        bool ok = pread_fully(fd, chunk.bytes.data(), chunk.bytes.size(), (uint64_t)id * slot_size) ==
+                  chunk.bytes.size();
+        std::lock_guard<std::mutex> lock(mutex);
+        Slot& slot = slots[id];
+        if (--slot.readers == 0 && slot.orphaned) {
+            slot.orphaned = false;
+            free_slots.push_back(id);
+        }
+        if (ok) hits.fetch_add(1, std::memory_order_relaxed);
+        return ok;
+    }
+    
+    // Drop chunks [first, end) of `path`
+    void erase_range(const std::string& path, uint64_t first, uint64_t end) {
+        drop_pending([&](const ChunkKey& key) { return key.path == path && key.index >= first && key.index < end; });
+        ChunkKey key{path, first};
+        std::lock_guard<std::mutex> lock(mutex);
+        ++erasures;
+        for (; key.index < end && !index.empty(); ++key.index) {
+            auto it = index.find(key);
+            if (it != index.end()) release(it);
+        }
+    }
+    
+    // Re-stamp or drop chunks [0, chunks) of `path`, as CacheShard::restamp
+    // does. Queued and in-progress writes of the path are dropped, since
+    // they carry the old version.
+    void restamp_file(const std::string& path, uint64_t chunks, const Restamp& restamp) {
+        drop_pending([&](const ChunkKey& key) { return key.path == path; });
+        std::lock_guard<std::mutex> lock(mutex);
+        ++erasures;
+        auto apply = [&](std::unordered_map<ChunkKey, uint32_t, ChunkKeyHash>::iterator it) {
+            Slot& slot = slots[it->second];
+            if (restamp.applies(it->first.index, slot.length, slot.file_size, slot.mtime_ns)) {
+                slot.file_size = restamp.new_size;
+                slot.mtime_ns = restamp.new_mtime_ns;
+                return std::next(it);
+            }
+            return release(it);
+        };
+        if (chunks > index.size()) {
+            for (auto it = index.begin(); it != index.end();) {
+                it = it->first.path == path ? apply(it) : std::next(it);
+            }
+            return;
+        }
+        for (ChunkKey key{path, 0}; key.index < chunks; ++key.index) {
+            auto it = index.find(key);
+            if (it != index.end()) apply(it);
+        }
+    }
+    
+    size_t get_count() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.size();
+    }
+    
+    void erase_path(std::string_view prefix) {
+        drop_pending([&](const ChunkKey& key) { return under_path(key.path, prefix); });
+        std::lock_guard<std::mutex> lock(mutex);
+        ++erasures;
+        for (auto it = index.begin(); it != index.end();) {
+            if (under_path(it->first.path, prefix)) {
+                it = release(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    void status(std::ostream& os) {
+        std::lock_guard<std::mutex> lock(mutex);
+        os << "Spill: " << index.size() << " of " << slots.size() << " slots | Hits: "
+           << hits.load(std::memory_order_relaxed) << " | Writes: " << writes.load(std::memory_order_relaxed)
+           << " | Dropped: " << dropped.load(std::memory_order_relaxed) << std::endl;
+    }
+};
+
+// Sharded cache: each chunk hashes to one shard with its own lock, LRU and
+// slice of the memory budget, so lookups on different shards never contend.
+// The key hash is computed once here and reused by the shard's table.
+class FileCache {
+private:
+    std::vector<std::unique_ptr<CacheShard>> shards;
+    std::shared_ptr<PrefetchStats> prefetch_stats;
+    std::shared_ptr<Metrics> metrics;
+    std::shared_ptr<SlabAllocator> allocator;
+    std::unique_ptr<CompressedTier> compressed;  // Null unless enabled
+    std::unique_ptr<SpillTier> spill;            // Null unless enabled
+    // Inserts hold this shared and invalidations exclusive, so an insert
+    // either lands before an invalidation sweeps its tiers or sees the new
+    // generation. A disk read that started before the bump is dropped.
+    std::shared_mutex coherence_mutex;
+    std::atomic<uint64_t> generation{0};
+    double compressed_share = 0;  // Of the memory limit, for resizing
+    size_t limit;
+    size_t chunk_size;
+    static constexpr size_t TRIM_BATCH = 64;  // Evictions per shard lock while shrinking
+    
+    CacheShard& shard_for(size_t hash) {
+        return *shards[hash % shards.size()];
+    }
+    
+    // Victims go to every lower tier: the compressed one keeps the warmest,
+    // the spill file is inclusive of both. Caller holds coherence_mutex.
+    bool insert_hashed(const ChunkKey& key, size_t hash, CachedChunk&& chunk, CacheData* pinned = nullptr) {
+        if (!compressed && !spill) {
+            return shard_for(hash).insert(key, hash, std::move(chunk), nullptr, pinned);
+        }
+        std::vector<EvictedChunk> evicted;
+        bool inserted = shard_for(hash).insert(key, hash, std::move(chunk), &evicted, pinned);
+        if (inserted && compressed) {
+            compressed->erase(key);  // A stale compressed copy would shadow nothing but waste space
+        }
+        demote(evicted);
+        return inserted;
+    }
+    
+    // Caller holds coherence_mutex
+    void demote(std::vector<EvictedChunk>& evicted) {
+        for (auto& victim : evicted) {
+            if (compressed) compressed->store(victim.key, *victim.data);
+            if (spill) spill->offer(std::move(victim));
+        }
+    }
+    
+    // Look `key` up in the lower tiers and promote it into its shard
+    CacheData promote(const ChunkRef& key, size_t hash, bool access) {
+        std::shared_lock<std::shared_mutex> lock(coherence_mutex);
+        CachedChunk chunk;
+        if (!(compressed && compressed->take(key, *allocator, chunk)) &&
+            !(spill && spill->read(key, *allocator, chunk))) {
+            return nullptr;
+        }
+        ChunkKey owned{std::string(key.path), key.index};
+        insert_hashed(owned, hash, std::move(chunk));
+        return access ? shard_for(hash).get(key, hash) : shard_for(hash).peek(key, hash);
+    }
+    
+    // Chunks in every tier, an upper bound on how many a file can have cached
+    size_t entry_count() {
+        size_t total = get_chunk_count();
+        if (compressed) total += compressed->get_count();
+        if (spill) total += spill->get_count();
+        return total;
+    }
+    
+    // Drop `path` from every tier, handing its in-memory chunks to `removed`
+    // if given. A file of at most `file_size` bytes has its chunk indexes
+    // probed; a directory, or a path of UNKNOWN_SIZE, has every table
+    // scanned for the path and everything under it, as does a file with
+    // more chunk indexes than the cache has entries. Caller holds
+    // coherence_mutex exclusively.
+    void erase_path_locked(const std::string& path, uint64_t file_size, std::vector<EvictedChunk>* removed) {
+        uint64_t chunks = file_size == UNKNOWN_SIZE ? UINT64_MAX : file_size / chunk_size + 1;
+        if (chunks > entry_count()) {
+            for (auto& shard : shards) {
+                shard->erase_path(path, removed);
+            }
+            if (compressed) compressed->erase_path(path);
+            if (spill) spill->erase_path(path);
+            return;
+        }
+        for (uint64_t index = 0; index < chunks; ++index) {
+            ChunkRef key{path, index};
+            size_t hash = ChunkKeyHash()(key);
+            shard_for(hash).erase(key, hash, removed);
+        }
+        if (compressed) compressed->erase_range(path, 0, chunks);
+        if (spill) spill->erase_range(path, 0, chunks);
+    }
+    
+    // Re-stamp `path`'s chunks in every tier after a write, probing its chunk
+    // indexes or scanning as erase_path_locked does. Caller holds
+    // coherence_mutex exclusively.
+    void restamp_locked(const std::string& path, const Restamp& restamp) {
+        uint64_t chunks = restamp.new_size / chunk_size + 1;
+        if (chunks > get_chunk_count()) {
+            for (auto& shard : shards) {
+                shard->restamp_path(path, restamp);
+            }
+        } else {
+            for (uint64_t index = 0; index < chunks; ++index) {
+                ChunkRef key{path, index};
+                size_t hash = ChunkKeyHash()(key);
+                shard_for(hash).restamp(key, hash, restamp);
+            }
+        }
+        if (compressed) compressed->restamp_file(path, chunks, restamp);
+        if (spill) spill->restamp_file(path, chunks, restamp);
+    }
+    
+    // The chunk behind `data`, for a new entry: its bytes are moved out if
+    // nobody else holds it, copied otherwise
+    CachedChunk take_chunk(CacheData data) {
+        const CachedChunk& old = *data;
+        if (data.use_count() == 1) {
+            CachedChunk& owned = const_cast<CachedChunk&>(old);
+            return CachedChunk{std::move(owned.bytes), old.file_size, 0, old.mtime_ns};
+        }
+        CachedChunk chunk{allocator->allocate(old.bytes.size()), old.file_size, 0, old.mtime_ns};
+        std::memcpy(chunk.bytes.data(), old.bytes.data(), old.bytes.size());
+        return chunk;
+    }
+    
+public:
+    // Size of a path that may be a directory, or a file of any size
+    static constexpr uint64_t UNKNOWN_SIZE = UINT64_MAX;
+    
+    // compressed_size of max_size goes to the compressed tier, the rest to the shards
+    // spill_size bytes of disk at spill_path hold everything evicted from RAM
+    FileCache(size_t max_size, size_t num_shards, PolicyKind policy, size_t chunk_size,
+              std::shared_ptr<SlabAllocator> allocator, size_t compressed_size = 0,
+              const std::string& spill_path = "", size_t spill_size = 0)
+        : prefetch_stats(std::make_shared<PrefetchStats>()), metrics(std::make_shared<Metrics>()),
+          allocator(std::move(allocator)), limit(max_size), chunk_size(std::max<size_t>(1, chunk_size)) {
+        if (!spill_path.empty() && spill_size > 0) {
+            spill = std::make_unique<SpillTier>(spill_path, chunk_size);
+            if (!spill->open(spill_size)) {
+                std::cerr << "Cannot create spill file " << spill_path << ": " << std::strerror(errno)
+                          << ", running without it" << std::endl;
+                spill.reset();
+            }
+        }
+        if (compressed_size > 0) {
+            compressed_size = std::min(compressed_size, max_size);
+            compressed = std::make_unique<CompressedTier>(compressed_size);
+            compressed_share = max_size ? (double)compressed_size / max_size : 1.0;
+            max_size -= compressed_size;
+        }
+        num_shards = std::max<size_t>(1, num_shards);
+        for (size_t i = 0; i < num_shards; ++i) {
+            size_t budget = shard_budget(max_size, i, num_shards);
+            shards.push_back(std::make_unique<CacheShard>(budget, make_policy(policy, budget, chunk_size),
+                                                          prefetch_stats, metrics));
+        }
+    }
+    
+    // Hand the remainder to the first shard so budgets sum to `total`
+    static size_t shard_budget(size_t total, size_t index, size_t num_shards) {
+        return total / num_shards + (index == 0 ? total % num_shards : 0);
+    }
+    
+    // Change the memory limit, split between the compressed tier and the
+    // shards as at construction. A shrink evicts TRIM_BATCH entries per shard
+    // lock, round robin, into the lower tiers as usual, then returns the
+    // freed slab blocks to the kernel. Callers serialize resizes.
+    void set_max_size(size_t max_size) {
+        bool shrinking = max_size < limit;
+        limit = max_size;
+        if (compressed) {
+            size_t compressed_size = (size_t)(max_size * compressed_share);
+            compressed->set_budget(compressed_size);
+            max_size -= compressed_size;
+        }
+        for (size_t i = 0; i < shards.size(); ++i) {
+            shards[i]->set_max_size(shard_budget(max_size, i, shards.size()));
+        }
+        
+        if (!shrinking) return;
+        std::vector<bool> done(shards.size(), false);
+        size_t remaining = shards.size();
+        std::vector<EvictedChunk> evicted;
+        while (remaining > 0) {
+            for (size_t i = 0; i < shards.size(); ++i) {
+                if (done[i]) continue;
+                std::shared_lock<std::shared_mutex> lock(coherence_mutex);
+                evicted.clear();
+                bool fits = shards[i]->trim(TRIM_BATCH, compressed || spill ? &evicted : nullptr);
+                demote(evicted);
+                if (fits) {
+                    done[i] = true;
+                    --remaining;
+                }
+            }
+        }
+        evicted.clear();  // Drop the last batch's references before purging
+        allocator->purge_free();
+    }
+    
+    bool contains(const ChunkRef& key) {
+        size_t hash = ChunkKeyHash()(key);
+        return shard_for(hash).contains(key, hash) || (compressed && compressed->contains(key)) ||
+               (spill && spill->contains(key));
+    }
+    
+    // A hit in a lower tier is promoted back into its shard
+    CacheData get(const ChunkRef& key) {
+        size_t hash = ChunkKeyHash()(key);
+        CacheData data = shard_for(hash).get(key, hash);
+        if (data || (!compressed && !spill)) {
+            return data;
+        }
+        return promote(key, hash, true);
+    }
+    
+    // get on behalf of someone else, such as a peer node: lower tiers are
+    // still promoted, but nothing counts as a local access
+    CacheData peek(const ChunkRef& key) {
+        size_t hash = ChunkKeyHash()(key);
+        CacheData data = shard_for(hash).peek(key, hash);
+        if (data || (!compressed && !spill)) {
+            return data;
+        }
+        return promote(key, hash, false);
+    }
+    
+    // Generation to pass to fill(); take it before reading from disk
+    uint64_t fill_generation() const {
+        return generation.load(std::memory_order_acquire);
+    }
+    
+    // Insert a chunk read from disk. A chunk read before an invalidation of
+    // any path is silently dropped, since it may hold the old contents;
+    // false only means there was no room for it. `pinned`, if given, is set
+    // to the cached entry; while it stays empty `chunk` was not consumed.
+    bool fill(const ChunkKey& key, CachedChunk&& chunk, uint64_t seen, CacheData* pinned = nullptr) {
+        std::shared_lock<std::shared_mutex> lock(coherence_mutex);
+        if (generation.load(std::memory_order_relaxed) != seen) {
+            return true;
+        }
+        return insert_hashed(key, ChunkKeyHash()(key), std::move(chunk), pinned);
+    }
+    
+    // Drop `path` and everything under it from every tier. `file_size`, if
+    // known, bounds the chunks a file can have cached, which saves scanning
+    // the whole cache for them.
+    void invalidate(const std::string& path, uint64_t file_size = UNKNOWN_SIZE) {
+        std::unique_lock<std::shared_mutex> lock(coherence_mutex);
+        ++generation;
+        erase_path_locked(path, file_size, nullptr);
+    }
+    
+    // Re-key the in-memory chunks under `from` to `to`, replacing whatever
+    // was cached under `to`. Their bytes move to the new entries; only a
+    // chunk a reader still holds is copied. The sizes bound the files `from`
+    // and `to` held, as for invalidate(). Lower tiers just drop both; a
+    // rename is rare enough that rereading them costs less than re-keying
+    // the disk index.
+    void rename(const std::string& from, const std::string& to, uint64_t from_size = UNKNOWN_SIZE,
+                uint64_t to_size = UNKNOWN_SIZE) {
+        std::unique_lock<std::shared_mutex> lock(coherence_mutex);
+        ++generation;
+        std::vector<EvictedChunk> moved;
+        erase_path_locked(from, from_size, &moved);
+        erase_path_locked(to, to_size, nullptr);
+        for (auto& entry : moved) {
+            ChunkKey key{to + entry.key.path.substr(from.size()), entry.key.index};
+            insert_hashed(key, ChunkKeyHash()(key), take_chunk(std::move(entry.data)));
+        }
+    }
+    
+    // Apply a write of [offset, offset + length) that already reached the
+    // file, which is now file_size bytes with mtime_ns. The chunks it touched
+    // are rebuilt from their old bytes and the new data, as long as together
+    // they cover the whole chunk. The rest keep their bytes and take the new
+    // version if they were of the version before the write, old_size and
+    // old_mtime_ns; without that version, or of another one, they are dropped.
+    void write_through(const std::string& path, uint64_t offset, const char* data, size_t length,
+                       uint64_t file_size, int64_t mtime_ns, uint64_t old_size = UNKNOWN_SIZE,
+                       int64_t old_mtime_ns = 0) {
+        std::unique_lock<std::shared_mutex> lock(coherence_mutex);
+        ++generation;
+        uint64_t write_end = offset + length;
+        uint64_t first = offset / chunk_size;
+        uint64_t touched_end = length ? (write_end - 1) / chunk_size + 1 : first;
+        std::vector<EvictedChunk> old_chunks;
+        for (uint64_t index = first; index < touched_end; ++index) {
+            ChunkRef key{path, index};
+            size_t hash = ChunkKeyHash()(key);
+            shard_for(hash).erase(key, hash, &old_chunks);
+        }
+        if (compressed) compressed->erase_range(path, first, touched_end);
+        if (spill) spill->erase_range(path, first, touched_end);
+        // A write never shrinks the file, so its chunks all lie below file_size
+        if (old_size == UNKNOWN_SIZE) {
+            erase_path_locked(path, file_size, nullptr);
+        } else {
+            restamp_locked(path, {old_size, old_mtime_ns, file_size, mtime_ns, chunk_size});
+        }
+        std::unordered_map<uint64_t, CacheData> old_by_index;
+        for (auto& entry : old_chunks) {
+            old_by_index.emplace(entry.key.index, std::move(entry.data));
+        }
+        
+        for (uint64_t index = first; index < touched_end; ++index) {
+            uint64_t start = index * chunk_size;
+            if (start >= file_size) break;
+            size_t size = std::min<uint64_t>(chunk_size, file_size - start);
+            uint64_t end = start + size;
+            
+            // Old bytes are known up to old_end; past the old EOF the file reads as zeros
+            auto it = old_by_index.find(index);
+            const CachedChunk* old = it != old_by_index.end() ? it->second.get() : nullptr;
+            if (old && old_size != UNKNOWN_SIZE && (old->file_size != old_size || old->mtime_ns != old_mtime_ns)) {
+                old = nullptr;  // Another version's bytes
+            }
+            uint64_t old_end = start;
+            if (old) {
+                old_end = old->file_size <= start + chunk_size ? UINT64_MAX : start + old->bytes.size();
+            }
+            if (std::max(start, offset) > old_end || (end > write_end && end > old_end)) {
+                continue;  // Part of the chunk is neither in the cache nor in the write
+            }
+            
+            CachedChunk chunk{allocator->allocate(size), file_size, 0, mtime_ns};
+            size_t kept = old ? std::min(old->bytes.size(), size) : 0;
+            if (kept > 0) std::memcpy(chunk.bytes.data(), old->bytes.data(), kept);
+            std::memset(chunk.bytes.data() + kept, 0, size - kept);
+            uint64_t from = std::max(start, offset);
+            uint64_t to = std::min(end, write_end);
+            std::memcpy(chunk.bytes.data() + (from - start), data + (from - offset), to - from);
+            ChunkKey key{path, index};
+            insert_hashed(key, ChunkKeyHash()(key), std::move(chunk));
+        }
+    }
+    
+    size_t get_shard_count() const {
+        return shards.size();
+    }
+    
+    size_t get_current_size() const {
+        size_t total = compressed ? compressed->get_size() : 0;
+        for (const auto& shard : shards) {
+            total += shard->get_current_size();
+        }
+        return total;
+    }
+    
+    void status(std::ostream& os) {
+        if (compressed) compressed->status(os);
+        if (spill) spill->status(os);
+    }
+    
+    std::shared_ptr<PrefetchStats> get_prefetch_stats() const {
+        return prefetch_stats;
+    }
+    
+    Metrics& get_metrics() {
+        return *metrics;
+    }
+    
+    // Chunks in memory, counted one shard lock at a time
+    size_t get_chunk_count() {
+        size_t total = 0;
+        for (auto& shard : shards) {
+            total += shard->get_count();
+        }
+        return total;
+    }
+    
+    // Up to `limit` cached paths with their scores, hottest first
+    std::vector<std::pair<std::string, uint64_t>> get_hot_files(size_t limit) {
+        std::unordered_map<std::string, uint64_t> scores;
+        for (auto& shard : shards) {
+            shard->add_path_scores(scores);
+        }
+        std::vector<std::pair<std::string, uint64_t>> files(scores.begin(), scores.end());
+        size_t take = std::min(limit, files.size());
+        std::partial_sort(files.begin(), files.begin() + take, files.end(),
+                          [](const auto& a, const auto& b) { return a.second > b.second; });
+        files.resize(take);
+        return files;
+    }
+};
+
+// TTL cache of lstat results and directory listings, keyed by normalized
+// path. ENOENT is cached too, since FUSE looks up many names that do not
+// exist. Striped like FileCache; a TTL of 0 disables it.
+class MetadataCache {
+private:
+    using Names = std::shared_ptr<const std::vector<std::string>>;
+    
+    struct StatEntry {
+        struct stat st;
+        int error;  // Cached errno, 0 for a successful lstat
+        int64_t expires;
+    };
+    
+    struct DirEntry {
+        Names names;
+        int error;
+        int64_t expires;
+    };
+    
+    // Entries of one kind, with their keys in insertion order. Every entry
+    // lives for the same TTL, so the oldest is also the first to expire.
+    template <typename Entry>
+    class Table {
+    private:
+        using Order = std::list<const std::string*>;  // Keys in `map`, oldest first
+        
+        struct Slot {
+            Entry entry;
+            Order::iterator age;
+        };
+        
+        std::unordered_map<std::string, Slot> map;
+        Order order;
+        
+        void erase(typename std::unordered_map<std::string, Slot>::iterator it) {
+            order.erase(it->second.age);
+            map.erase(it);
+        }
+        
+    public:
+        size_t size() const {
+            return map.size();
+        }
+        
+        const Entry* find(const std::string& path) const {
+            auto it = map.find(path);
+            return it == map.end() ? nullptr : &it->second.entry;
+        }
+        
+        // Entry for `path`, now the newest. Makes room for a new one first:
+        // expired entries go, then the oldest until fewer than `limit` remain.
+        Entry& put(const std::string& path, int64_t time, size_t limit) {
+            auto it = map.find(path);
+            if (it != map.end()) {
+                order.splice(order.end(), order, it->second.age);
+                return it->second.entry;
+            }
+            while (!order.empty()) {
+                auto oldest = map.find(*order.front());
+                if (map.size() < limit && oldest->second.entry.expires > time) break;
+                erase(oldest);
+            }
+            it = map.emplace(path, Slot{}).first;
+            it->second.age = order.insert(order.end(), &it->first);
+            return it->second.entry;
+        }
+        
+        void erase(const std::string& path) {
+            auto it = map.find(path);
+            if (it != map.end()) erase(it);
+        }
+        
+        // Drop every entry whose key satisfies `match`
+        template <typename Match>
+        void erase_if(Match match) {
+            for (auto it = map.begin(); it != map.end();) {
+                if (match(it->first)) {
+                    order.erase(it->second.age);
+                    it = map.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    };
+    
+    struct Shard {
+        Table<StatEntry> stats;
+        Table<DirEntry> dirs;
+        std::mutex mutex;
+    };
+    
+    std::vector<Shard> shards;
+    int64_t ttl_ns;
+    size_t max_per_shard;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    Shard& shard_for(std::string_view path) {
+        return shards[std::hash<std::string_view>()(path) % shards.size()];
+    }
+    
+    static std::string parent_of(const std::string& path) {
+        size_t slash = path.rfind('/');
+        return slash == std::string::npos ? std::string() : path.substr(0, slash);
+    }
+    
+public:
+    MetadataCache(int64_t ttl_ms, size_t max_entries, size_t num_shards)
+        : shards(std::max<size_t>(1, num_shards)), ttl_ns(ttl_ms * 1000000),
+          max_per_shard(std::max<size_t>(1, max_entries / std::max<size_t>(1, num_shards))) {}
+    
+    // Cached lstat of `path`; false if unknown or expired
+    bool get_stat(const std::string& path, struct stat& st, int& error) {
+        if (ttl_ns <= 0) return false;
+        Shard& shard = shard_for(path);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const StatEntry* entry = shard.stats.find(path);
+        if (entry == nullptr || entry->expires <= now()) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        hits.fetch_add(1, std::memory_order_relaxed);
+        st = entry->st;
+        error = entry->error;
+        return true;
+    }
+    
+    // Cache an lstat result, or `error` when `st` is null
+    void put_stat(const std::string& path, const struct stat* st, int error) {
+        if (ttl_ns <= 0) return;
+        int64_t time = now();
+        Shard& shard = shard_for(path);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        StatEntry& entry = shard.stats.put(path, time, max_per_shard);
+        if (st) entry.st = *st;
+        entry.error = st ? 0 : error;
+        entry.expires = time + ttl_ns;
+    }
+    
+    bool get_dir(const std::string& path, Names& names, int& error) {
+        if (ttl_ns <= 0) return false;
+        Shard& shard = shard_for(path);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const DirEntry* entry = shard.dirs.find(path);
+        if (entry == nullptr || entry->expires <= now()) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        hits.fetch_add(1, std::memory_order_relaxed);
+        names = entry->names;
+        error = entry->error;
+        return true;
+    }
+    
+    void put_dir(const std::string& path, Names names, int error) {
+        if (ttl_ns <= 0) return;
+        int64_t time = now();
+        Shard& shard = shard_for(path);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.dirs.put(path, time, max_per_shard) = DirEntry{std::move(names), error, time + ttl_ns};
+    }
+    
+    // True unless `path` is cached as something other than a directory
+    bool maybe_directory(const std::string& path) {
+        struct stat st;
+        int error;
+        return !get_stat(path, st, error) || (error == 0 && S_ISDIR(st.st_mode));
+    }
+    
+    // Drop what a change to `path` makes stale: its own entries and its
+    // parent's listing, plus everything cached under it with `subtree`
+    void forget(const std::string& path, bool subtree) {
+        if (ttl_ns <= 0) return;
+        std::string parent = parent_of(path);
+        {
+            Shard& shard = shard_for(parent);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.dirs.erase(parent);
+        }
+        if (!subtree) {
+            Shard& shard = shard_for(path);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.stats.erase(path);
+            shard.dirs.erase(path);
+            return;
+        }
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto under = [&](const std::string& key) { return under_path(key, path); };
+            shard.stats.erase_if(under);
+            shard.dirs.erase_if(under);
+        }
+    }
+    
+    // (hits, misses) of stat and listing lookups
+    std::pair<uint64_t, uint64_t> get_counts() const {
+        return {hits.load(std::memory_order_relaxed), misses.load(std::memory_order_relaxed)};
+    }
+    
+    void status(std::ostream& os) {
+        if (ttl_ns <= 0) return;
+        size_t stats = 0, dirs = 0;
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            stats += shard.stats.size();
+            dirs += shard.dirs.size();
+        }
+        os << "Metadata: " << stats << " stats, " << dirs << " listings | Hits: "
+           << hits.load(std::memory_order_relaxed) << " | Misses: " << misses.load(std::memory_order_relaxed)
+           << std::endl;
+    }
+};
+
+// Descriptors of the files the filesystem has open, keyed by path and shared
+// with the prefetcher and the miss path so neither reopens a file by name.
+// Each path holds a dup of its first readable handle's descriptor, so a
+// handle released mid-read never closes the descriptor under a reader.
+class FdTable {
+public:
+    struct OpenFile {
+        int fd;
+        explicit OpenFile(int fd) : fd(fd) {}
+        ~OpenFile() { close(fd); }
+    };
+    using FileRef = std::shared_ptr<const OpenFile>;
+    
+private:
+    struct Entry {
+        FileRef file;
+        size_t handles;
+        uint64_t id;  // Tells a re-created entry from the one a handle joined
+    };
+    
+    struct Handle {
+        std::string path;
+        uint64_t id;
+    };
+    
+    std::unordered_map<std::string, Entry> files;
+    std::unordered_map<uint64_t, Handle> handles;
+    uint64_t next_id = 0;
+    mutable std::shared_mutex mutex;
+    
+    // Caller holds mutex exclusively
+    void detach_locked(uint64_t fh) {
+        auto it = handles.find(fh);
+        if (it == handles.end()) return;
+        auto entry = files.find(it->second.path);
+        if (entry != files.end() && entry->second.id == it->second.id && --entry->second.handles == 0) {
+            files.erase(entry);
+        }
+        handles.erase(it);
+    }
+    
+public:
+    // Register open handle `fh` of `path`, whose descriptor is `fd`.
+    // Write-only and O_DIRECT descriptors are tracked but not shared, since
+    // cache reads need plain buffered preads.
+    void attach(uint64_t fh, const std::string& path, int fd) {
+        int flags = fcntl(fd, F_GETFL);
+        bool readable = flags >= 0 && (flags & O_ACCMODE) != O_WRONLY && !(flags & O_DIRECT);
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        detach_locked(fh);  // A handle number whose release we never saw
+        auto it = files.find(path);
+        if (it == files.end()) {
+            if (!readable) return;
+            int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+            if (copy < 0) return;
+            it = files.emplace(path, Entry{std::make_shared<OpenFile>(copy), 0, next_id++}).first;
+        }
+        ++it->second.handles;
+        handles[fh] = {path, it->second.id};
+    }
+    
+    void detach(uint64_t fh) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        detach_locked(fh);
+    }
+    
+    FileRef find(const std::string& path) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = files.find(path);
+        return it == files.end() ? nullptr : it->second.file;
+    }
+    
+    // Stop sharing descriptors of `prefix` and everything under it. Their
+    // handles stay registered and detach as usual.
+    void erase_path(const std::string& prefix) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (auto it = files.begin(); it != files.end();) {
+            it = under_path(it->first, prefix) ? files.erase(it) : std::next(it);
+        }
+    }
+    
+    // Follow a rename of `from` (a file or a directory) to `to`
+    void rename(const std::string& from, const std::string& to) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        std::vector<std::pair<std::string, Entry>> moved;
+        for (auto it = files.begin(); it != files.end();) {
+            if (under_path(it->first, from)) {
+                moved.emplace_back(to + it->first.substr(from.size()), std::move(it->second));
+                it = files.erase(it);
+            } else {
+                it = under_path(it->first, to) ? files.erase(it) : std::next(it);
+            }
+        }
+        for (auto& [path, entry] : moved) {
+            files[path] = std::move(entry);
+        }
+        for (auto& [fh, handle] : handles) {
+            if (under_path(handle.path, from)) handle.path = to + handle.path.substr(from.size());
+        }
+    }
+    
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return files.size();
+    }
+};
+
+// Files with chunks mapped, by inode. Every mapping holds its file's token,
+// so the mount's own truncates can wait for the mappings to go: touching a
+// mapped page past a new EOF raises SIGBUS. While a file is being resized
+// it gets no token and its chunks are copied instead.
+class MappedFiles {
+private:
+    struct Entry {
+        std::weak_ptr<const void> token;
+        int resizing = 0;
+    };
+    
+    std::map<std::pair<dev_t, ino_t>, Entry> files;
+    size_t sweep_at = 64;  // Drop expired entries once there are this many
+    std::mutex mutex;
+    
+public:
+    // Token to keep alive with every mapping of the file `st` describes, or
+    // null while it is being resized
+    std::shared_ptr<const void> pin(const struct stat& st) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (files.size() >= sweep_at) {
+            for (auto it = files.begin(); it != files.end();) {
+                it = it->second.token.expired() && it->second.resizing == 0 ? files.erase(it) : std::next(it);
+            }
+            sweep_at = std::max<size_t>(64, files.size() * 2);
+        }
+        Entry& entry = files[{st.st_dev, st.st_ino}];
+        if (entry.resizing > 0) return nullptr;
+        std::shared_ptr<const void> token = entry.token.lock();
+        if (!token) {
+            token = std::make_shared<char>();
+            entry.token = token;
+        }
+        return token;
+    }
+    
+    // Stop mapping the file until end_resize
+    void begin_resize(const struct stat& st) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++files[{st.st_dev, st.st_ino}].resizing;
+    }
+    
+    // Wait up to `timeout_ms` for the file's mappings to be released; false
+    // if some still are
+    bool wait_unmapped(const struct stat& st, int timeout_ms) {
+        std::pair<dev_t, ino_t> key{st.st_dev, st.st_ino};
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (files[key].token.expired()) return true;
+            }
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    
+    void end_resize(const struct stat& st) {
+        std::lock_guard<std::mutex> lock(mutex);
+        --files[{st.st_dev, st.st_ino}].resizing;
+    }
+};
+
+// lstat-style struct stat from a statx result
+static void stat_from_statx(const struct statx& stx, struct stat& st) {
+    st = {};
+    st.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st.st_ino = stx.stx_ino;
+    st.st_mode = stx.stx_mode;
+    st.st_nlink = stx.stx_nlink;
+    st.st_uid = stx.stx_uid;
+    st.st_gid = stx.stx_gid;
+    st.st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+    st.st_size = stx.stx_size;
+    st.st_blksize = stx.stx_blksize;
+    st.st_blocks = stx.stx_blocks;
+    st.st_atim = {(time_t)stx.stx_atime.tv_sec, (long)stx.stx_atime.tv_nsec};
+    st.st_mtim = {(time_t)stx.stx_mtime.tv_sec, (long)stx.stx_mtime.tv_nsec};
+    st.st_ctim = {(time_t)stx.stx_ctime.tv_sec, (long)stx.stx_ctime.tv_nsec};
+}
+
+// Escape a Prometheus label value
+static std::string prometheus_label(const std::string& value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\n') {
+            escaped += "\\n";
+            continue;
+        }
+        if (c == '\\' || c == '"') escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+#ifndef __NR_openat2
+#define __NR_openat2 437
+#endif
+
+// Open relative `path` for reading without leaving `dirfd`: no "..", no
+// absolute symlinks, and no symlink pointing outside it. Kernels without
+// openat2 get a walk that refuses every symlink instead. -1 with errno set.
+static int open_beneath(int dirfd, const std::string& path) {
+    struct open_how how{};
+    how.flags = O_RDONLY | O_CLOEXEC;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    int fd = syscall(__NR_openat2, dirfd, path.c_str(), &how, sizeof(how));
+    if (fd >= 0 || (errno != ENOSYS && errno != EPERM)) return fd;  // EPERM: blocked by seccomp
+    
+    int parent = dirfd;
+    size_t at = 0;
+    while (true) {
+        size_t next = path.find('/', at);
+        std::string name = path.substr(at, next == std::string::npos ? std::string::npos : next - at);
+        bool last = next == std::string::npos;
+        if (name == "..") {
+            fd = -1;
+            errno = EXDEV;
+        } else {
+            fd = openat(parent, name.empty() ? "." : name.c_str(),
+                        (last ? O_RDONLY : O_PATH | O_DIRECTORY) | O_NOFOLLOW | O_CLOEXEC);
+            if (fd < 0 && errno == ELOOP) errno = EXDEV;
+        }
+        if (parent != dirfd) close(parent);
+        if (fd < 0 || last) return fd;
+        parent = fd;
+        at = next + 1;
+    }
+}
+
+// Peer tier protocol: one request and one response per chunk, over
+// persistent TCP connections. Fields are in host byte order, since every
+// node runs the same build.
+struct PeerRequest {
+    static constexpr uint32_t MAGIC = 0x52504b51;  // "QKPR"
+    
+    uint32_t magic;
+    uint32_t path_length;  // Path bytes follow
+    uint64_t index;
+    uint64_t chunk_size;   // Of the asking node; indexes only agree when these match
+    uint64_t file_size;    // Version the asking node sees, which a cached chunk must match
+    int64_t mtime_ns;
+};
+
+struct PeerResponse {
+    static constexpr uint32_t MAGIC = 0x53504b51;  // "QKPS"
+    
+    uint32_t magic;
+    int32_t error;  // 0, or the errno the owner got, and then no bytes follow
+    uint64_t file_size;
+    int64_t mtime_ns;
+    uint64_t length;  // Chunk bytes follow
+};
+
+// Whole-message socket I/O. send never raises SIGPIPE; both fail on a
+// closed peer, an error or the socket's timeout.
+static bool send_fully(int fd, struct iovec* iov, int count) {
+    struct msghdr message{};
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+    while (message.msg_iovlen > 0) {
+        ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        while (message.msg_iovlen > 0 && (size_t)n >= message.msg_iov->iov_len) {
+            n -= message.msg_iov->iov_len;
+            ++message.msg_iov;
+            --message.msg_iovlen;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov->iov_base = (char*)message.msg_iov->iov_base + n;
+            message.msg_iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static bool recv_fully(int fd, void* buf, size_t length) {
+    char* p = (char*)buf;
+    while (length > 0) {
+        ssize_t n = recv(fd, p, length, MSG_WAITALL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Resolve "host:port" ("[v6]:port" for IPv6 literals)
+static bool resolve_address(const std::string& address, struct sockaddr_storage& out, socklen_t& length) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0) {
+        errno = EINVAL;
+        return false;
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+    struct addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0 || found == nullptr) {
+        errno = EHOSTUNREACH;
+        return false;
+    }
+    std::memcpy(&out, found->ai_addr, found->ai_addrlen);
+    length = found->ai_addrlen;
+    freeaddrinfo(found);
+    return true;
+}
+
+// Consistent hashing of chunk keys over peer addresses. Each peer gets
+// VNODES points on the ring and owns the keys hashing up to its points, so
+// adding or removing a node only moves the keys next to its own points.
+// Every node builds the same ring from the same address list, whatever its
+// order.
+class PeerRing {
+public:
+    static constexpr size_t VNODES = 64;
+    
+private:
+    std::vector<std::pair<uint64_t, uint32_t>> points;  // Hash, peer index; sorted
+    
+public:
+    // FNV-1a, finished with splitmix64's mixer so similar names spread out
+    static uint64_t hash(std::string_view bytes, uint64_t seed) {
+        uint64_t h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+        for (unsigned char c : bytes) h = (h ^ c) * 0x100000001b3ULL;
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+    
+    explicit PeerRing(const std::vector<std::string>& peers) {
+        for (uint32_t peer = 0; peer < peers.size(); ++peer) {
+            for (size_t v = 0; v < VNODES; ++v) points.emplace_back(hash(peers[peer], v), peer);
+        }
+        std::sort(points.begin(), points.end());
+    }
+    
+    uint32_t owner(const ChunkRef& key) const {
+        uint64_t h = hash(key.path, key.index + 1);
+        auto it = std::lower_bound(points.begin(), points.end(), std::make_pair(h, (uint32_t)0));
+        return (it == points.end() ? points.front() : *it).second;
+    }
+};
+
+// Client side of one remote peer. Connections are pooled; a peer that
+// cannot be reached is not asked again for BACKOFF_NS.
+class PeerClient {
+private:
+    static constexpr size_t MAX_IDLE = 8;
+    static constexpr uint64_t BACKOFF_NS = 2000000000;
+    
+    std::string address;
+    int timeout_ms;
+    std::vector<int> idle;
+    std::mutex mutex;
+    std::atomic<uint64_t> down_until{0};
+    
+    int connect_peer() {
+        struct sockaddr_storage addr;
+        socklen_t length;
+        if (!resolve_address(address, addr, length)) return -1;
+        int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        // The send timeout bounds connect() as well
+        struct timeval tv{timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(fd, (struct sockaddr*)&addr, length) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    
+    // One request on `fd`. Returns false if the connection failed; `found`
+    // says whether the peer had the chunk.
+    bool exchange(int fd, const PeerRequest& request, std::string_view path, SlabAllocator& allocator,
+                  CachedChunk& chunk, bool& found) {
+        struct iovec iov[2] = {{(void*)&request, sizeof(request)}, {(void*)path.data(), path.size()}};
+        PeerResponse response;
+        if (!send_fully(fd, iov, 2) || !recv_fully(fd, &response, sizeof(response)) ||
+            response.magic != PeerResponse::MAGIC || (response.error == 0 && response.length > request.chunk_size)) {
+            return false;
+        }
+        found = response.error == 0;
+        if (!found) return true;
+        SlabBuffer bytes = allocator.allocate(response.length);
+        if (!recv_fully(fd, bytes.data(), response.length)) return false;
+        chunk = CachedChunk{std::move(bytes), response.file_size, 0, response.mtime_ns};
+        return true;
+    }
+    
+public:
+    PeerClient(std::string address, int timeout_ms) : address(std::move(address)), timeout_ms(timeout_ms) {}
+    
+    ~PeerClient() {
+        for (int fd : idle) close(fd);
+    }
+    
+    const std::string& get_address() const {
+        return address;
+    }
+    
+    bool is_down() const {
+        return Metrics::now_ns() < down_until.load(std::memory_order_relaxed);
+    }
+    
+    // Ask the peer for `key` as of `file_size` and `mtime`. False if it
+    // cannot serve the chunk or cannot be reached. A pooled connection the
+    // peer dropped is retried once on a fresh one before the peer counts as
+    // down.
+    bool fetch(const ChunkRef& key, size_t chunk_size, uint64_t file_size, int64_t mtime, SlabAllocator& allocator,
+               CachedChunk& chunk) {
+        if (is_down()) return false;
+        PeerRequest request{PeerRequest::MAGIC, (uint32_t)key.path.size(), key.index, chunk_size, file_size, mtime};
+        int fd = -1;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!idle.empty()) {
+                fd = idle.back();
+                idle.pop_back();
+            }
+        }
+        bool found = false;
+        bool pooled = fd >= 0;
+        if (!pooled) fd = connect_peer();
+        bool ok = fd >= 0 && exchange(fd, request, key.path, allocator, chunk, found);
+        if (!ok && pooled) {
+            close(fd);
+            fd = connect_peer();
+            ok = fd >= 0 && exchange(fd, request, key.path, allocator, chunk, found);
+        }
+        if (!ok) {
+            if (fd >= 0) close(fd);
+            down_until.store(Metrics::now_ns() + BACKOFF_NS, std::memory_order_relaxed);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < MAX_IDLE) {
+            idle.push_back(fd);
+        } else {
+            close(fd);
+        }
+        return found;
+    }
+};
+
+// Answers peers' chunk requests, one thread per connection. Peers keep
+// their connections open, so there are about as many threads as peers
+// times their readers; past MAX_CONNECTIONS new ones are refused, and one
+// idle for IDLE_TIMEOUT_S is dropped, which the peer's pool retries.
+class PeerServer {
+public:
+    static constexpr size_t MAX_CONNECTIONS = 256;
+    static constexpr int IDLE_TIMEOUT_S = 60;
+    
+    // Fill `data` with the chunk, or return the errno saying why not
+    using Handler = std::function<int(const std::string& path, uint64_t index, uint64_t file_size, int64_t mtime,
+                                      CacheData& data)>;
+    
+private:
+    struct Connection {
+        int fd;
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+    
+    size_t chunk_size;
+    Handler handler;
+    int listen_fd = -1;
+    bool running = false;
+    std::list<Connection> connections;
+    std::mutex mutex;
+    std::thread acceptor;
+    
+    void serve(Connection& connection) {
+        PeerRequest request;
+        std::string path;
+        while (recv_fully(connection.fd, &request, sizeof(request)) && request.magic == PeerRequest::MAGIC &&
+               request.path_length <= PATH_MAX) {
+            path.resize(request.path_length);
+            if (!recv_fully(connection.fd, path.data(), path.size())) break;
+            CacheData data;
+            int error = request.chunk_size != chunk_size
+                            ? EINVAL
+                            : handler(path, request.index, request.file_size, request.mtime_ns, data);
+            PeerResponse response{PeerResponse::MAGIC, error, 0, 0, 0};
+            if (error == 0) {
+                response.file_size = data->file_size;
+                response.mtime_ns = data->mtime_ns;
+                response.length = data->bytes.size();
+            }
+            struct iovec iov[2] = {{&response, sizeof(response)},
+                                   {error == 0 ? (void*)data->bytes.data() : nullptr, response.length}};
+            if (!send_fully(connection.fd, iov, error == 0 ? 2 : 1)) break;
+        }
+        // The peer sees the end now; the descriptor is closed when reaped
+        shutdown(connection.fd, SHUT_RDWR);
+        connection.done = true;
+    }
+    
+    // Caller holds mutex
+    void reap() {
+        for (auto it = connections.begin(); it != connections.end();) {
+            if (!it->done) {
+                ++it;
+                continue;
+            }
+            it->thread.join();
+            close(it->fd);
+            it = connections.erase(it);
+        }
+    }
+    
+    void accept_loop() {
+        while (true) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            int error = errno;
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!running) {
+                if (fd >= 0) close(fd);
+                return;
+            }
+            if (fd < 0) {
+                // Out of descriptors or memory: give connections time to finish
+                lock.unlock();
+                if (error != EINTR && error != ECONNABORTED) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                }
+                continue;
+            }
+            reap();
+            if (connections.size() >= MAX_CONNECTIONS) {
+                close(fd);
+                continue;
+            }
+            int one = 1;
+            struct timeval idle{IDLE_TIMEOUT_S, 0};
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof(idle));
+            connections.emplace_back();
+            Connection& connection = connections.back();
+            connection.fd = fd;
+            try {
+                connection.thread = std::thread(&PeerServer::serve, this, std::ref(connection));
+            } catch (const std::system_error&) {
+                connections.pop_back();
+                close(fd);
+            }
+        }
+    }
+    
+public:
+    PeerServer(size_t chunk_size, Handler handler) : chunk_size(chunk_size), handler(std::move(handler)) {}
+    
+    ~PeerServer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) return;
+            running = false;
+            // Wakes accept() and every connection's recv()
+            shutdown(listen_fd, SHUT_RDWR);
+            for (auto& connection : connections) shutdown(connection.fd, SHUT_RDWR);
+        }
+        acceptor.join();
+        for (auto& connection : connections) {
+            connection.thread.join();
+            close(connection.fd);
+        }
+        close(listen_fd);
+    }
+    
+    // Listen at `address` only: the tree is served to whoever connects, so
+    // it is never published on interfaces the peers were not told about.
+    // False with errno set on error.
+    bool start(const std::string& address) {
+        struct sockaddr_storage addr;
+        socklen_t length;
+        if (!resolve_address(address, addr, length)) return false;
+        listen_fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (listen_fd < 0 || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            bind(listen_fd, (struct sockaddr*)&addr, length) != 0 || listen(listen_fd, 64) != 0) {
+            int error = errno;
+            if (listen_fd >= 0) close(listen_fd);
+            listen_fd = -1;
+            errno = error;
+            return false;
+        }
+        running = true;
+        acceptor = std::thread(&PeerServer::accept_loop, this);
+        return true;
+    }
+};
+
+// Shares chunks between nodes mounting the same dataset. Every chunk has
+// one owner on a PeerRing of the nodes' addresses. A miss on a chunk owned
+// by another node asks the owner first, which answers from its cache or
+// reads the chunk from its own source into its cache, so each chunk comes
+// from the shared backend about once per cluster, and prefetches of other
+// nodes' chunks warm their owners too. Only a chunk of the version the
+// asking node sees (size and mtime) is taken; anything else, or a peer that
+// is down, falls back to the source. Peers are trusted: whoever reaches the
+// port can read the tree, so keep it on a private network.
+class PeerTier {
+private:
+    std::shared_mutex mutex;  // Guards the membership; fetches copy their owner out of it
+    std::unique_ptr<PeerRing> ring;
+    std::vector<std::shared_ptr<PeerClient>> clients;  // By ring index; null for this node
+    std::unique_ptr<PeerServer> server;
+    std::string self;
+    size_t chunk_size = 0;
+    std::atomic<bool> enabled{false};
+    
+public:
+    bool is_enabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    
+    // Join the cluster of `peers` as `address`, the host:port the others know
+    // this node by and the one it listens at. Replaces any earlier membership.
+    // False with errno set if the port cannot be bound.
+    bool join(const std::string& address, std::vector<std::string> peers, int timeout_ms, size_t chunk_size,
+              PeerServer::Handler handler) {
+        leave();
+        auto listener = std::make_unique<PeerServer>(chunk_size, std::move(handler));
+        if (!listener->start(address)) return false;
+        peers.push_back(address);
+        std::sort(peers.begin(), peers.end());
+        peers.erase(std::unique(peers.begin(), peers.end()), peers.end());
+        
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        ring = std::make_unique<PeerRing>(peers);
+        for (const auto& peer : peers) {
+            clients.push_back(peer == address ? nullptr : std::make_shared<PeerClient>(peer, timeout_ms));
+        }
+        server = std::move(listener);
+        self = address;
+        this->chunk_size = chunk_size;
+        enabled = true;
+        return true;
+    }
+    
+    void leave() {
+        std::unique_ptr<PeerServer> stopped;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            enabled = false;
+            ring.reset();
+            clients.clear();
+            stopped = std::move(server);
+        }
+        // Connection threads may be serving a read; stop them unlocked
+    }
+    
+    // Fetch `key` from its owner into `chunk`, if another node owns it and
+    // has its `file_size` / `mtime` version. Counts peer hits and misses.
+    // The exchange runs unlocked, so a slow peer does not hold up leave().
+    bool fetch(const ChunkRef& key, uint64_t file_size, int64_t mtime, SlabAllocator& allocator,
+               Metrics& metrics, CachedChunk& chunk) {
+        std::shared_ptr<PeerClient> owner;
+        size_t chunk_size;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            if (!ring) return false;
+            owner = clients[ring->owner(key)];
+            chunk_size = this->chunk_size;
+        }
+        if (owner == nullptr) return false;
+        CachedChunk fetched;
+        if (owner->fetch(key, chunk_size, file_size, mtime, allocator, fetched) && fetched.file_size == file_size &&
+            fetched.mtime_ns == mtime) {
+            metrics.add(Metrics::PeerHits);
+            chunk = std::move(fetched);
+            return true;
+        }
+        metrics.add(Metrics::PeerMisses);
+        return false;
+    }
+    
+    void status(std::ostream& os) {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        if (!ring) return;
+        os << "Peers:";
+        for (const auto& client : clients) {
+            if (client) {
+                os << " " << client->get_address() << (client->is_down() ? " (down)" : "");
+            } else {
+                os << " " << self << " (self)";
+            }
+        }
+        os << std::endl;
+    }
+};
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+// Minimal io_uring ring driven through the raw syscalls, so the extension
+// does not need liburing. Used by a single thread.
+class UringEngine {
+private:
+    int ring_fd;
+    unsigned sq_entries;
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+    unsigned local_tail;  // Tail including prepared but unpublished SQEs
+    unsigned unsubmitted;
+    unsigned outstanding;  // Taken by the kernel and not reaped yet
+    
+    // Pass every completion already posted to `on_complete`; returns how many
+    template <typename F>
+    unsigned reap(F& on_complete) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned reaped = 0;
+        while (head != tail) {
+            const io_uring_cqe& cqe = cqes[head & *cq_mask];
+            on_complete(cqe.user_data, cqe.res);
+            ++head;
+            ++reaped;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        outstanding -= reaped;
+        return reaped;
+    }
+    
+public:
+    UringEngine()
+        : ring_fd(-1), sq_entries(0), sq_ring(MAP_FAILED), cq_ring(MAP_FAILED),
+          sq_ring_size(0), cq_ring_size(0), sqes((io_uring_sqe*)MAP_FAILED), sqes_size(0),
+          local_tail(0), unsubmitted(0), outstanding(0) {}
+    
+    ~UringEngine() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        if (ring_fd >= 0) close(ring_fd);
+    }
+    
+    bool init(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd < 0) {
+            return false;
+        }
+        
+        sq_entries = params.sq_entries;
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED) return false;
+        cq_ring = single_mmap ? sq_ring
+                              : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) return false;
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                   ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+        
+        char* sq = (char*)sq_ring;
+        char* cq = (char*)cq_ring;
+        sq_head = (unsigned*)(sq + params.sq_off.head);
+        sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + params.sq_off.array);
+        cq_head = (unsigned*)(cq + params.cq_off.head);
+        cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        local_tail = *sq_tail;
+        return true;
+    }
+    
+    unsigned capacity() const {
+        return sq_entries;
+    }
+    
+    // Zeroed SQE for the caller to fill in, or nullptr if the ring is full
+    io_uring_sqe* next_sqe(uint64_t user_data) {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (local_tail - head >= sq_entries) {
+            return nullptr;
+        }
+        unsigned index = local_tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = user_data;
+        sq_array[index] = index;
+        ++local_tail;
+        ++unsubmitted;
+        return sqe;
+    }
+    
+    // Submit everything prepared and wait for `count` completions, passing
+    // each (user_data, res) to `on_complete`. EAGAIN and EBUSY are retried.
+    // On any other error, false with errno set, but only once every SQE the
+    // kernel took has completed, since those still point into the caller's
+    // buffers. The ring must not be used after that.
+    template <typename F>
+    bool submit_and_wait(unsigned count, F&& on_complete) {
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        unsigned reaped = 0;
+        while (reaped < count) {
+            int ret = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            int error = errno;
+            // The SQ head says what the kernel took, whatever enter returned
+            unsigned taken = unsubmitted - (local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+            unsubmitted -= taken;
+            outstanding += taken;
+            if (ret < 0 && error != EINTR && error != EAGAIN && error != EBUSY) {
+                drain(on_complete);
+                errno = error;
+                return false;
+            }
+            unsigned n = reap(on_complete);
+            reaped += n;
+            // Out of kernel resources, or the CQ is full: let completions land
+            if (ret < 0 && error != EINTR && n == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        return true;
+    }
+    
+    // Wait for every SQE the kernel took, without submitting more. Falls back
+    // to polling the CQ, which the kernel fills without io_uring_enter.
+    template <typename F>
+    void drain(F& on_complete) {
+        while (outstanding > 0) {
+            if (reap(on_complete) > 0) continue;
+            if (syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                errno != EINTR) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+};
+
+enum class IoBackend {
+    Threads,  // Pool of threads doing blocking pread
+    Uring,    // One thread keeping batches of open/statx/read in flight through io_uring
+};
+
+// Pool of file reader threads fed by a de-duplicated priority queue of chunks
+class FileReader {
+private:
+    struct ChunkRequest {
+        ChunkKey key;
+        uint8_t source;
+    };
+    
+    struct Queued {
+        uint64_t ticket;
+        uint8_t source;
+    };
+    
+    struct QueueItem {
+        int priority;
+        uint64_t ticket;  // Newer requests get larger tickets
+        ChunkKey key;
+        
+        bool operator<(const QueueItem& other) const {
+            if (priority != other.priority) return priority < other.priority;
+            return ticket < other.ticket;
+        }
+    };
+    
+    std::string root_dir;
+    std::shared_ptr<FileCache> cache;
+    std::shared_ptr<SlabAllocator> allocator;
+    std::shared_ptr<MetadataCache> metadata;
+    std::shared_ptr<FdTable> files;
+    size_t chunk_size;
+    bool map_files;  // Chunks map the file instead of copying it
+    std::shared_ptr<MappedFiles> mapped;
+    std::shared_ptr<PeerTier> peers;
+    std::priority_queue<QueueItem> file_queue;
+    // Latest ticket of every queued chunk; heap items with an older ticket are stale
+    std::unordered_map<ChunkKey, Queued, ChunkKeyHash> queued;
+    std::unordered_set<ChunkKey, ChunkKeyHash> in_flight;
+    uint64_t next_ticket;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable idle_cv;  // Signalled when the last in-flight chunk finishes
+    bool running;
+    std::vector<std::thread> workers;
+    
+    // Block until work is queued, then move up to `max_items` chunks into
+    // `batch` and mark them in flight. Returns false on shutdown.
+    bool pop_batch(std::vector<ChunkRequest>& batch, size_t max_items, std::string& root) {
+        batch.clear();
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        while (batch.empty()) {
+            queue_cv.wait(lock, [this]() { return !file_queue.empty() || !running; });
+            
+            if (!running) return false;
+            
+            while (!file_queue.empty() && batch.size() < max_items) {
+                QueueItem item = file_queue.top();
+                file_queue.pop();
+                
+                auto it = queued.find(item.key);
+                if (it == queued.end() || it->second.ticket != item.ticket) {
+                    continue;  // Superseded by a newer request for the same chunk
+                }
+                uint8_t source = it->second.source;
+                queued.erase(it);
+                in_flight.insert(item.key);
+                batch.push_back({std::move(item.key), source});
+            }
+        }
+        root = root_dir;
+        return true;
+    }
+    
+    void finish_batch(const std::vector<ChunkRequest>& batch) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        for (const auto& request : batch) {
+            in_flight.erase(request.key);
+        }
+        if (in_flight.empty() && queued.empty()) {
+            idle_cv.notify_all();
+        }
+    }
+    
+    // `start` is when the chunk's read began, for the prefetch latency
+    void store_chunk(const ChunkKey& key, CachedChunk&& chunk, uint64_t generation, const fs::path& filepath_real,
+                     uint64_t start) {
+        Metrics& metrics = cache->get_metrics();
+        metrics.add(Metrics::BytesRead, chunk.bytes.size());
+        metrics.record(Metrics::PrefetchLatency, start);
+        if (!cache->fill(key, std::move(chunk), generation)) {
+            std::cerr << "No room to cache " << filepath_real << " chunk " << key.index << std::endl;
+        }
+    }
+    
+    // Take the chunk from the peer that owns it, if that peer has the
+    // version `st` describes. True once the chunk is cached.
+    bool from_peer(const ChunkKey& key, uint8_t source, const struct stat& st, uint64_t generation, uint64_t start) {
+        if (!peers->is_enabled()) return false;
+        Metrics& metrics = cache->get_metrics();
+        CachedChunk chunk;
+        if (!peers->fetch(key, st.st_size, mtime_ns(st.st_mtim), *allocator, metrics, chunk)) {
+            return false;
+        }
+        chunk.source = source;
+        metrics.record(Metrics::PrefetchLatency, start);
+        cache->fill(key, std::move(chunk), generation);
+        return true;
+    }
+    
+    // lstat through the metadata cache, so prefetched files also warm it for
+    // getattr. Returns 0 or an errno.
+    int lookup_stat(const std::string& path, const fs::path& filepath_real, struct stat& st) {
+        int error = 0;
+        if (metadata->get_stat(path, st, error)) {
+            return error;
+        }
+        if (lstat(filepath_real.c_str(), &st) != 0) {
+            error = errno;
+            if (error == ENOENT) metadata->put_stat(path, nullptr, error);
+            return error;
+        }
+        metadata->put_stat(path, &st, 0);
+        return 0;
+    }
+    
+    void thread_worker() {
+        std::vector<ChunkRequest> batch;
+        std::string root;
+        while (pop_batch(batch, 1, root)) {
+            process_chunk(root, batch.front());
+            finish_batch(batch);
+        }
+    }
+    
+    void process_chunk(const std::string& root, const ChunkRequest& request) {
+        const ChunkKey& key = request.key;
+        fs::path filepath_real = fs::path(root) / key.path;
+        uint64_t generation = cache->fill_generation();
+        
+        // Check if already in cache
+        if (cache->contains(key)) {
+            return;
+        }
+        uint64_t start = Metrics::now_ns();
+        
+        // A file the filesystem has open is read through its descriptor
+        struct stat st;
+        FdTable::FileRef shared = files->find(key.path);
+        int fd = shared ? shared->fd : -1;
+        if (!shared) {
+            int error = lookup_stat(key.path, filepath_real, st);
+            if (error != 0) {
+                std::cerr << "Failed to open file: " << filepath_real << ": " << std::strerror(error) << std::endl;
+                return;
+            }
+            
+            fd = open(filepath_real.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                std::cerr << "Failed to open file: " << filepath_real << ": " << std::strerror(errno) << std::endl;
+                return;
+            }
+        }
+        
+        // The metadata cache only saved the existence check: size and version
+        // come from the open file, which also reads symlinks through
+        if (fstat(fd, &st) == 0) {
+            uint64_t file_size = st.st_size;
+            uint64_t chunk_start = key.index * chunk_size;
+            // Chunk 0 of an empty file is cached so the file still counts as cached
+            if ((chunk_start < file_size || key.index == 0) && !from_peer(key, request.source, st, generation, start)) {
+                size_t length = std::min<uint64_t>(chunk_size, file_size - chunk_start);
+                CachedChunk chunk{SlabBuffer(), file_size, request.source, mtime_ns(st.st_mtim)};
+                size_t got = 0;
+                if (map_files && length > 0) {
+                    chunk.bytes = SlabBuffer::map(fd, chunk_start, length, mapped->pin(st));
+                    got = chunk.bytes.size();
+                }
+                if (!chunk.bytes.is_mapped()) {
+                    // Empty, or a page would not come in: read it the usual way
+                    chunk.bytes = allocator->allocate(length);
+                    got = pread_fully(fd, chunk.bytes.data(), length, chunk_start);
+                }
+                if (got == length) {
+                    store_chunk(key, std::move(chunk), generation, filepath_real, start);
+                } else {
+                    std::cerr << "Read size mismatch: expected " << length 
+                              << ", got " << got << std::endl;
+                }
+            }
+        }
+        if (!shared) close(fd);
+    }
+    
+    // Each batch goes through the ring in two rounds: open + statx for every
+    // chunk, then one read per chunk that exists, so up to capacity() / 2
+    // files are in flight at once
+    void uring_worker(std::unique_ptr<UringEngine> ring) {
+        struct Pending {
+            ChunkKey key;
+            uint8_t source;
+            fs::path filepath_real;
+            FdTable::FileRef shared;  // Set when fd belongs to the fd table
+            int fd;
+            struct statx stx;
+            int stat_res;
+            struct stat st;
+            bool stat_cached;  // st came from the metadata cache, so no statx was sent
+            CachedChunk chunk;
+            int read_res;
+        };
+        
+        std::vector<ChunkRequest> batch;
+        std::string root;
+        size_t max_items = std::max<size_t>(1, ring->capacity() / 2);
+        while (pop_batch(batch, max_items, root)) {
+            uint64_t generation = cache->fill_generation();
+            uint64_t start = Metrics::now_ns();
+            std::vector<Pending> pending;
+            pending.reserve(batch.size());
+            for (const auto& request : batch) {
+                if (!cache->contains(request.key)) {
+                    pending.push_back({request.key, request.source, fs::path(root) / request.key.path,
+                                       nullptr, -1, {}, -1, {}, false, {}, -1});
+                    Pending& p = pending.back();
+                    int error = 0;
+                    if ((p.shared = files->find(p.key.path))) {
+                        p.fd = p.shared->fd;
+                        p.stat_res = fstat(p.fd, &p.st) == 0 ? 0 : -errno;
+                        p.stat_cached = true;
+                    } else if (metadata->get_stat(p.key.path, p.st, error)) {
+                        p.stat_res = -error;
+                        p.stat_cached = true;
+                    }
+                }
+            }
+            
+            unsigned submitted = 0;
+            for (size_t i = 0; i < pending.size(); ++i) {
+                Pending& p = pending[i];
+                if (p.shared || (p.stat_cached && p.stat_res < 0)) {
+                    continue;  // Already open, or known not to exist
+                }
+                io_uring_sqe* open_sqe = ring->next_sqe(i * 2);
+                open_sqe->opcode = IORING_OP_OPENAT;
+                open_sqe->fd = AT_FDCWD;
+                open_sqe->addr = (uint64_t)p.filepath_real.c_str();
+                open_sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                ++submitted;
+                if (!p.stat_cached) {
+                    io_uring_sqe* stat_sqe = ring->next_sqe(i * 2 + 1);
+                    stat_sqe->opcode = IORING_OP_STATX;
+                    stat_sqe->fd = AT_FDCWD;
+                    stat_sqe->addr = (uint64_t)p.filepath_real.c_str();
+                    stat_sqe->len = STATX_BASIC_STATS;
+                    stat_sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+                    stat_sqe->off = (uint64_t)&p.stx;
+                    ++submitted;
+                }
+            }
+            bool ok = ring->submit_and_wait(submitted, [&](uint64_t user_data, int res) {
+                Pending& p = pending[user_data / 2];
+                if (user_data % 2 == 0) {
+                    p.fd = res;
+                } else {
+                    p.stat_res = res;
+                }
+            });
+            int ring_error = ok ? 0 : errno;
+            
+            submitted = 0;
+            for (size_t i = 0; ok && i < pending.size(); ++i) {
+                Pending& p = pending[i];
+                if (!p.stat_cached) {
+                    if (p.stat_res >= 0) {
+                        stat_from_statx(p.stx, p.st);
+                        metadata->put_stat(p.key.path, &p.st, 0);
+                    } else if (p.stat_res == -ENOENT) {
+                        metadata->put_stat(p.key.path, nullptr, ENOENT);
+                    }
+                }
+                if (p.fd < 0 || p.stat_res < 0) {
+                    int err = p.stat_res < 0 ? -p.stat_res : -p.fd;
+                    std::cerr << "Failed to open file: " << p.filepath_real << ": " << std::strerror(err) << std::endl;
+                    continue;
+                }
+                // A cached stat only saved the existence check; size and version come
+                // from the open file. Symlinks are read through, so size by their target.
+                if (((p.stat_cached && !p.shared) || S_ISLNK(p.st.st_mode)) && fstat(p.fd, &p.st) != 0) {
+                    continue;
+                }
+                uint64_t file_size = p.st.st_size;
+                uint64_t chunk_start = p.key.index * chunk_size;
+                if (chunk_start >= file_size && p.key.index > 0) {
+                    continue;  // Past EOF
+                }
+                if (from_peer(p.key, p.source, p.st, generation, start)) {
+                    continue;
+                }
+                size_t length = std::min<uint64_t>(chunk_size, file_size - chunk_start);
+                p.chunk = CachedChunk{allocator->allocate(length), file_size, p.source, mtime_ns(p.st.st_mtim)};
+                if (length == 0) {
+                    p.read_res = 0;
+                    continue;
+                }
+                io_uring_sqe* read_sqe = ring->next_sqe(i);
+                read_sqe->opcode = IORING_OP_READ;
+                read_sqe->fd = p.fd;
+                read_sqe->addr = (uint64_t)p.chunk.bytes.data();
+                read_sqe->len = length;
+                read_sqe->off = chunk_start;
+                ++submitted;
+            }
+            if (ok && submitted > 0) {
+                ok = ring->submit_and_wait(submitted, [&](uint64_t user_data, int res) {
+                    pending[user_data].read_res = res;
+                });
+                if (!ok) ring_error = errno;
+            }
+            
+            for (auto& p : pending) {
+                size_t length = p.chunk.bytes.size();
+                // Finish a short read synchronously rather than dropping the chunk
+                size_t got = std::max(p.read_res, 0);
+                if (ok && p.read_res >= 0 && got < length && p.fd >= 0) {
+                    got += pread_fully(p.fd, p.chunk.bytes.data() + got, length - got,
+                                       p.key.index * chunk_size + got);
+                }
+                if (p.fd >= 0 && !p.shared) close(p.fd);
+                if (!ok || p.read_res < 0) continue;
+                if (got == length) {
+                    store_chunk(p.key, std::move(p.chunk), generation, p.filepath_real, start);
+                } else {
+                    std::cerr << "Read size mismatch: expected " << length 
+                              << ", got " << got << std::endl;
+                }
+            }
+            if (!ok) {
+                // The ring is done for; read this batch and everything after with pread
+                std::cerr << "io_uring submission failed (" << std::strerror(ring_error)
+                          << "), falling back to pread" << std::endl;
+                ring.reset();
+                for (const auto& request : batch) {
+                    process_chunk(root, request);
+                }
+                finish_batch(batch);
+                thread_worker();
+                return;
+            }
+            finish_batch(batch);
+        }
+    }
+    
+public:
+    FileReader(const std::string& root, std::shared_ptr<FileCache> cache,
+               std::shared_ptr<SlabAllocator> allocator, std::shared_ptr<MetadataCache> metadata,
+               std::shared_ptr<FdTable> files, size_t chunk_size, size_t num_threads, IoBackend backend,
+               size_t queue_depth, bool map_files, std::shared_ptr<MappedFiles> mapped,
+               std::shared_ptr<PeerTier> peers)
+        : root_dir(root), cache(cache), allocator(allocator), metadata(metadata), files(files),
+          chunk_size(chunk_size), map_files(map_files), mapped(mapped), peers(peers),
+          next_ticket(0), running(true) {
+        // A mapped chunk is read by MAP_POPULATE's page faults, which io_uring cannot queue
+        if (backend == IoBackend::Uring && !map_files) {
+            auto ring = std::make_unique<UringEngine>();
+            if (ring->init(std::max<size_t>(2, queue_depth * 2))) {
+                workers.emplace_back(&FileReader::uring_worker, this, std::move(ring));
+                return;
+            }
+            std::cerr << "io_uring unavailable (" << std::strerror(errno)
+                      << "), falling back to pread threads" << std::endl;
+        }
+        num_threads = std::max<size_t>(1, num_threads);
+        for (size_t i = 0; i < num_threads; ++i) {
+            workers.emplace_back(&FileReader::thread_worker, this);
+        }
+    }
+    
+    ~FileReader() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            running = false;
+        }
+        queue_cv.notify_all();
+        for (auto& worker : workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+    }
+    
+    // Queue chunks [first, first + count) of a normalized path for prefetch.
+    // Higher priority is served first; within a priority the most recent
+    // request wins, and re-requesting a queued chunk moves it to the front
+    // instead of queueing it twice. Lower chunk indices are queued last so
+    // the start of the range is read first. A chunk keeps the source of the
+    // first predictor that asked for it.
+    void request_chunks(const std::string& normalized, uint64_t first, uint64_t count, int priority = 0,
+                        uint8_t source = 0) {
+        bool queued_any = false;
+        for (uint64_t i = count; i-- > 0;) {
+            ChunkKey key{normalized, first + i};
+            if (cache->contains(key)) {
+                continue;
+            }
+            
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (in_flight.count(key)) {
+                continue;
+            }
+            uint64_t ticket = next_ticket++;
+            auto it = queued.try_emplace(key, Queued{ticket, source}).first;
+            it->second.ticket = ticket;
+            if (it->second.source == 0) it->second.source = source;
+            file_queue.push({priority, ticket, std::move(key)});
+            queued_any = true;
+        }
+        if (queued_any) {
+            queue_cv.notify_all();
+        }
+    }
+    
+    // Forget queued chunks of `prefix` and the files under it. Reads already
+    // in flight finish but are dropped by the cache's generation check.
+    void cancel(const std::string& prefix) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        for (auto it = queued.begin(); it != queued.end();) {
+            it = under_path(it->first.path, prefix) ? queued.erase(it) : std::next(it);
+        }
+        if (in_flight.empty() && queued.empty()) {
+            idle_cv.notify_all();
+        }
+    }
+    
+    void set_root(const std::string& root) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        root_dir = root;
+    }
+    
+    // Wait until nothing is queued or being read; false on timeout
+    bool wait_idle(int timeout_ms) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        return idle_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                [this] { return in_flight.empty() && queued.empty(); });
+    }
+    
+    // Chunks waiting in the queue and being read
+    std::pair<size_t, size_t> get_queue_depth() {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        return {queued.size(), in_flight.size()};
+    }
+};
+
+// Maps paths to dense integer ids so predictor tables store and compare
+// 4-byte ids instead of strings
+class PathInterner {
+private:
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<std::string> paths;
+    
+public:
+    uint32_t intern(const std::string& path) {
+        auto it = ids.find(path);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        uint32_t id = paths.size();
+        ids.emplace(path, id);
+        paths.push_back(path);
+        return id;
+    }
+    
+    // Id of an already interned path, or false if it was never seen
+    bool lookup(const std::string& path, uint32_t& id) const {
+        auto it = ids.find(path);
+        if (it == ids.end()) return false;
+        id = it->second;
+        return true;
+    }
+    
+    const std::string& path(uint32_t id) const {
+        return paths[id];
+    }
+    
+    size_t size() const {
+        return paths.size();
+    }
+};
+
+// Fixed-size set of the heaviest successors of one state. When full, a new
+// successor replaces the lightest one and inherits its weight (space-saving),
+// so heavy hitters survive while the table never grows.
+class SuccessorSet {
+public:
+    static constexpr size_t CAPACITY = 8;
+    
+    struct Successor {
+        uint32_t id;
+        float weight;
+    };
+    
+private:
+    std::array<Successor, CAPACITY> items;
+    uint8_t count = 0;
+    
+public:
+    void add(uint32_t id, float weight) {
+        size_t lightest = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (items[i].id == id) {
+                items[i].weight += weight;
+                return;
+            }
+            if (items[i].weight < items[lightest].weight) lightest = i;
+        }
+        if (count < CAPACITY) {
+            items[count++] = {id, weight};
+        } else {
+            items[lightest] = {id, items[lightest].weight + weight};
+        }
+    }
+    
+    // Halve every weight so old evidence fades; returns the heaviest weight left
+    float age() {
+        float heaviest = 0;
+        for (size_t i = 0; i < count; ++i) {
+            items[i].weight /= 2;
+            heaviest = std::max(heaviest, items[i].weight);
+        }
+        return heaviest;
+    }
+    
+    const Successor* begin() const { return items.data(); }
+    const Successor* end() const { return items.data() + count; }
+    bool empty() const { return count == 0; }
+};
+
+// Recently read path ids, newest last; bounded by the longest context any
+// predictor looks at
+class ReadHistory {
+public:
+    static constexpr size_t CAPACITY = 16;
+    
+private:
+    std::array<uint32_t, CAPACITY> ring;
+    size_t total = 0;
+    
+public:
+    void push(uint32_t id) {
+        ring[total % CAPACITY] = id;
+        ++total;
+    }
+    
+    size_t size() const {
+        return std::min(total, CAPACITY);
+    }
+    
+    // i = 0 is the most recent read
+    uint32_t back(size_t i) const {
+        return ring[(total - 1 - i) % CAPACITY];
+    }
+};
+
+// Keep a state table under max_states. Ages every state, drops those whose
+// heaviest edge fell below `threshold`, and if that is not enough drops
+// arbitrary states down to 3/4 of the limit, so pruning runs at most once
+// per max_states / 4 new states.
+template <typename Map>
+static void prune_states(Map& states, size_t max_states, float threshold) {
+    for (auto it = states.begin(); it != states.end();) {
+        it = it->second.age() < threshold ? states.erase(it) : std::next(it);
+    }
+    for (auto it = states.begin(); it != states.end() && states.size() > max_states / 4 * 3;) {
+        it = states.erase(it);
+    }
+}
+
+struct Prediction {
+    uint32_t id;
+    float confidence;  // Estimated probability in [0, 1] that the file is read next
+};
+
+enum class PredictorKind : uint32_t {
+    None = 0,
+    Markov = 1,
+    Adaptive = 2,
+    Locality = 3,
+};
+
+// One state table row as stored in a snapshot. `table` is the context
+// length for OrderKMarkov, 0 for DecayedMarkov, and 0 (transitions) or 1
+// (directory members) for PathLocality.
+struct SnapshotState {
+    uint64_t key;
+    uint32_t table;
+    uint32_t count;
+    SuccessorSet::Successor successors[SuccessorSet::CAPACITY];
+};
+
+static SnapshotState snapshot_state(uint64_t key, uint32_t table, const SuccessorSet& successors) {
+    SnapshotState state{key, table, 0, {}};
+    for (const auto& s : successors) {
+        state.successors[state.count++] = s;
+    }
+    return state;
+}
+
+static void restore_state(SuccessorSet& successors, const SnapshotState& state) {
+    for (size_t i = 0; i < std::min<size_t>(state.count, SuccessorSet::CAPACITY); ++i) {
+        successors.add(state.successors[i].id, state.successors[i].weight);
+    }
+}
+
+// Native counterpart of the Python predictors. Not thread-safe on its own;
+// the manager serializes access.
+class NativePredictor {
+public:
+    virtual ~NativePredictor() = default;
+    
+    // Record a read of `id`, which has already been pushed onto `history`
+    virtual void log(const ReadHistory& history) = 0;
+    
+    // Append up to `n` predictions following `context` (newest last) to `out`
+    virtual void predict(std::vector<uint32_t> context, size_t n, std::vector<Prediction>& out) = 0;
+    
+    virtual PredictorKind kind() const = 0;
+    
+    // Append every state to `out` / add states read back from a snapshot
+    virtual void save(std::vector<SnapshotState>& out) const = 0;
+    virtual void load(const SnapshotState* states, size_t count) = 0;
+    
+    virtual void status(std::ostream& os) = 0;
+};
+
+// Order-k Markov chain like Markov_Opt, keeping a table per order 1..k so
+// prediction can back off to shorter contexts
+class OrderKMarkov : public NativePredictor {
+private:
+    size_t order;
+    size_t max_states;  // Per order
+    std::vector<std::unordered_map<uint64_t, SuccessorSet>> tables;  // tables[j] has order j + 1
+    
+    // Hash of a `length`-id state, read oldest first through id_at
+    template <typename Get>
+    static uint64_t state_key(size_t length, Get&& id_at) {
+        uint64_t key = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < length; ++i) {
+            key = (key ^ id_at(i)) * 0x100000001b3ULL;
+        }
+        return key;
+    }
+    
+public:
+    OrderKMarkov(size_t order, size_t max_states)
+        : order(std::min<size_t>(std::max<size_t>(1, order), ReadHistory::CAPACITY - 1)),
+          max_states(std::max<size_t>(4, max_states)), tables(this->order) {}
+    
+    void log(const ReadHistory& history) override {
+        uint32_t current = history.back(0);
+        for (size_t j = 1; j <= order && j < history.size(); ++j) {
+            uint64_t key = state_key(j, [&](size_t i) { return history.back(j - i); });
+            auto& table = tables[j - 1];
+            table[key].add(current, 1.0f);
+            if (table.size() > max_states) {
+                prune_states(table, max_states, 1.0f);
+            }
+        }
+    }
+    
+    // Confidence is the edge's share of its state's weight, multiplied along
+    // the chain of predictions
+    void predict(std::vector<uint32_t> context, size_t n, std::vector<Prediction>& out) override {
+        float confidence = 1.0f;
+        for (size_t step = 0; step < n && !context.empty(); ++step) {
+            const SuccessorSet* successors = nullptr;
+            for (size_t j = std::min(order, context.size()); j >= 1 && !successors; --j) {
+                size_t start = context.size() - j;
+                uint64_t key = state_key(j, [&](size_t i) { return context[start + i]; });
+                auto it = tables[j - 1].find(key);
+                if (it != tables[j - 1].end() && !it->second.empty()) {
+                    successors = &it->second;
+                }
+            }
+            if (!successors) break;
+            
+            const SuccessorSet::Successor* best = nullptr;
+            float total = 0;
+            for (const auto& s : *successors) {
+                total += s.weight;
+                bool seen = s.id == context.back() ||
+                            std::find_if(out.begin(), out.end(),
+                                         [&](const Prediction& p) { return p.id == s.id; }) != out.end();
+                if (!seen && (!best || s.weight > best->weight)) best = &s;
+            }
+            if (!best) break;
+            confidence *= best->weight / total;
+            out.push_back({best->id, confidence});
+            context.push_back(best->id);
+        }
+    }
+    
+    PredictorKind kind() const override {
+        return PredictorKind::Markov;
+    }
+    
+    void save(std::vector<SnapshotState>& out) const override {
+        for (size_t j = 0; j < order; ++j) {
+            for (const auto& [key, successors] : tables[j]) {
+                out.push_back(snapshot_state(key, j + 1, successors));
+            }
+        }
+    }
+    
+    // States of a longer order than this model's are dropped
+    void load(const SnapshotState* states, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            const SnapshotState& state = states[i];
+            if (state.table < 1 || state.table > order) continue;
+            restore_state(tables[state.table - 1][state.key], state);
+        }
+    }
+    
+    void status(std::ostream& os) override {
+        size_t states = 0;
+        for (const auto& table : tables) states += table.size();
+        os << "Native Markov - Order: " << order << ", States: " << states;
+    }
+};
+
+// Decayed-weight transitions like AdaptiveMarkov_Opt: every read strengthens
+// the edges from the last history_length files, weighted by recency
+class DecayedMarkov : public NativePredictor {
+private:
+    size_t history_length;
+    float learning_rate;
+    float decay;
+    size_t max_states;
+    std::unordered_map<uint32_t, SuccessorSet> transitions;
+    
+public:
+    DecayedMarkov(size_t history_length, float learning_rate, float decay, size_t max_states)
+        : history_length(std::min<size_t>(std::max<size_t>(1, history_length), 10)),
+          learning_rate(std::min(std::max(0.01f, learning_rate), 1.0f)),
+          decay(std::min(std::max(0.5f, decay), 0.99f)),
+          max_states(std::max<size_t>(4, max_states)) {}
+    
+    void log(const ReadHistory& history) override {
+        uint32_t current = history.back(0);
+        float influence = 1.0f;
+        for (size_t i = 1; i <= history_length && i < history.size(); ++i) {
+            uint32_t prev = history.back(i);
+            if (prev != current) {
+                transitions[prev].add(current, learning_rate * influence);
+            }
+            influence *= decay;
+        }
+        if (transitions.size() > max_states) {
+            prune_states(transitions, max_states, learning_rate);
+        }
+    }
+    
+    // Confidence is a candidate's share of the total score
+    void predict(std::vector<uint32_t> context, size_t n, std::vector<Prediction>& out) override {
+        if (context.empty()) return;
+        std::vector<std::pair<uint32_t, float>> scores;
+        float influence = 1.0f;
+        size_t depth = std::min(history_length, context.size());
+        for (size_t i = 0; i < depth; ++i) {
+            auto it = transitions.find(context[context.size() - 1 - i]);
+            if (it != transitions.end()) {
+                for (const auto& s : it->second) {
+                    auto score = std::find_if(scores.begin(), scores.end(),
+                                              [&](const auto& entry) { return entry.first == s.id; });
+                    if (score == scores.end()) {
+                        scores.emplace_back(s.id, s.weight * influence);
+                    } else {
+                        score->second += s.weight * influence;
+                    }
+                }
+            }
+            influence *= decay;
+        }
+        
+        uint32_t current = context.back();
+        scores.erase(std::remove_if(scores.begin(), scores.end(),
+                                    [&](const auto& entry) { return entry.first == current; }),
+                     scores.end());
+        float total = 0;
+        for (const auto& entry : scores) total += entry.second;
+        size_t take = std::min(n, scores.size());
+        std::partial_sort(scores.begin(), scores.begin() + take, scores.end(),
+                          [](const auto& a, const auto& b) { return a.second > b.second; });
+        for (size_t i = 0; i < take; ++i) {
+            out.push_back({scores[i].first, scores[i].second / total});
+        }
+    }
+    
+    PredictorKind kind() const override {
+        return PredictorKind::Adaptive;
+    }
+    
+    void save(std::vector<SnapshotState>& out) const override {
+        for (const auto& [key, successors] : transitions) {
+            out.push_back(snapshot_state(key, 0, successors));
+        }
+    }
+    
+    void load(const SnapshotState* states, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            if (states[i].table == 0 && states[i].key <= UINT32_MAX) {
+                restore_state(transitions[states[i].key], states[i]);
+            }
+        }
+    }
+    
+    void status(std::ostream& os) override {
+        os << "Native Adaptive Markov - History: " << history_length << ", LR: " << learning_rate
+           << ", Decay: " << decay << ", States: " << transitions.size();
+    }
+};
+
+// `path` with the last run of digits in its file name advanced by `step`,
+// keeping the zero padding (shard_0041 -> shard_0042). Digits before the
+// extension win (take2.mp3 -> take3.mp3), so the extension is only used
+// when the stem has none (archive.001). Empty without digits.
+static std::string numeric_successor(const std::string& path, uint64_t step) {
+    size_t slash = path.rfind('/');
+    size_t base = slash == std::string::npos ? 0 : slash + 1;
+    size_t dot = path.rfind('.');
+    size_t end = dot != std::string::npos && dot > base ? dot : path.size();
+    while (end > base && !std::isdigit((unsigned char)path[end - 1])) --end;
+    if (end == base) {
+        end = path.size();
+        while (end > base && !std::isdigit((unsigned char)path[end - 1])) --end;
+    }
+    size_t start = end;
+    while (start > base && std::isdigit((unsigned char)path[start - 1])) --start;
+    if (start == end || end - start > 18) return "";
+    std::string next = std::to_string(std::stoull(path.substr(start, end - start)) + step);
+    if (next.size() < end - start) next.insert(0, end - start - next.size(), '0');
+    return path.substr(0, start) + next + path.substr(end);
+}
+
+static std::string parent_path(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash);
+}
+
+// Native counterpart of Locality_Opt: learned first-order transitions plus
+// guesses from the file's place in the tree, so files never read before can
+// still be predicted. Structural candidates are its numeric successors, the
+// names after it in its directory's sorted listing and the files read from
+// that directory before; a candidate backed by several signals combines
+// them as independent evidence. Only existing regular files are predicted,
+// checked through the metadata cache.
+class PathLocality : public NativePredictor {
+public:
+    using StatFn = std::function<bool(const std::string&, struct stat&)>;
+    using ListFn = std::function<bool(const std::string&, std::shared_ptr<const std::vector<std::string>>&)>;
+    
+    static constexpr float SUCCESSOR_CONFIDENCE = 0.6f;
+    static constexpr float SIBLING_CONFIDENCE = 0.4f;
+    static constexpr float COACCESS_CONFIDENCE = 0.3f;
+    static constexpr size_t MAX_LISTINGS = 64;
+    
+private:
+    // Sorted names of a directory, valid while its mtime matches
+    struct Listing {
+        int64_t mtime = -1;
+        std::vector<std::string> names;
+    };
+    
+    PathInterner& interner;
+    StatFn stat_path;
+    ListFn list_directory;
+    size_t max_states;
+    std::unordered_map<uint32_t, SuccessorSet> transitions;
+    std::unordered_map<uint32_t, SuccessorSet> directories;  // Directory id -> files read from it
+    std::unordered_map<std::string, Listing> listings;
+    
+    bool is_file(const std::string& path) {
+        struct stat st;
+        return stat_path(path, st) && (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode));
+    }
+    
+    const std::vector<std::string>* sorted_listing(const std::string& directory) {
+        struct stat st;
+        if (!stat_path(directory, st)) return nullptr;
+        auto it = listings.find(directory);
+        if (it != listings.end() && it->second.mtime == mtime_ns(st.st_mtim)) {
+            return &it->second.names;
+        }
+        std::shared_ptr<const std::vector<std::string>> names;
+        if (!list_directory(directory, names)) return nullptr;
+        if (it == listings.end()) {
+            if (listings.size() >= MAX_LISTINGS) listings.erase(listings.begin());
+            it = listings.try_emplace(directory).first;
+        }
+        it->second.mtime = mtime_ns(st.st_mtim);
+        it->second.names = *names;
+        std::sort(it->second.names.begin(), it->second.names.end());
+        return &it->second.names;
+    }
+    
+    static void vote(std::vector<std::pair<std::string, float>>& scores, std::string candidate, float confidence) {
+        for (auto& [path, score] : scores) {
+            if (path == candidate) {
+                score = 1 - (1 - score) * (1 - confidence);
+                return;
+            }
+        }
+        scores.emplace_back(std::move(candidate), confidence);
+    }
+    
+    static float total_weight(const SuccessorSet& successors) {
+        float total = 0;
+        for (const auto& s : successors) total += s.weight;
+        return total;
+    }
+    
+public:
+    PathLocality(PathInterner& interner, StatFn stat_path, ListFn list_directory, size_t max_states)
+        : interner(interner), stat_path(std::move(stat_path)), list_directory(std::move(list_directory)),
+          max_states(std::max<size_t>(4, max_states)) {}
+    
+    void log(const ReadHistory& history) override {
+        uint32_t current = history.back(0);
+        if (history.size() > 1 && history.back(1) != current) {
+            transitions[history.back(1)].add(current, 1.0f);
+        }
+        directories[interner.intern(parent_path(interner.path(current)))].add(current, 1.0f);
+        if (transitions.size() > max_states) prune_states(transitions, max_states, 1.0f);
+        if (directories.size() > max_states) prune_states(directories, max_states, 1.0f);
+    }
+    
+    void predict(std::vector<uint32_t> context, size_t n, std::vector<Prediction>& out) override {
+        if (context.empty() || n == 0) return;
+        uint32_t current = context.back();
+        std::string path = interner.path(current);
+        std::string directory = parent_path(path);
+        std::vector<std::pair<std::string, float>> scores;
+        
+        auto learned = transitions.find(current);
+        if (learned != transitions.end()) {
+            float total = total_weight(learned->second);
+            for (const auto& s : learned->second) vote(scores, interner.path(s.id), s.weight / total);
+        }
+        float confidence = SUCCESSOR_CONFIDENCE;
+        for (size_t k = 1; k <= n; ++k, confidence *= SUCCESSOR_CONFIDENCE) {
+            std::string next = numeric_successor(path, k);
+            if (next.empty()) break;
+            vote(scores, std::move(next), confidence);
+        }
+        if (const auto* names = sorted_listing(directory)) {
+            std::string name = path.substr(directory.empty() ? 0 : directory.size() + 1);
+            auto it = std::upper_bound(names->begin(), names->end(), name);
+            // Twice as many as wanted, since some siblings are directories
+            for (size_t i = 0; it != names->end() && i < 2 * n; ++it, ++i) {
+                vote(scores, directory.empty() ? *it : directory + "/" + *it, SIBLING_CONFIDENCE / (i + 1));
+            }
+        }
+        uint32_t directory_id;
+        if (interner.lookup(directory, directory_id)) {
+            auto members = directories.find(directory_id);
+            if (members != directories.end()) {
+                float total = total_weight(members->second);
+                for (const auto& s : members->second) {
+                    vote(scores, interner.path(s.id), COACCESS_CONFIDENCE * s.weight / total);
+                }
+            }
+        }
+        
+        std::sort(scores.begin(), scores.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+        for (const auto& [candidate, score] : scores) {
+            if (out.size() >= n) break;
+            if (candidate == path || !is_file(candidate)) continue;
+            out.push_back({interner.intern(candidate), score});
+        }
+    }
+    
+    PredictorKind kind() const override {
+        return PredictorKind::Locality;
+    }
+    
+    void save(std::vector<SnapshotState>& out) const override {
+        for (const auto& [key, successors] : transitions) {
+            out.push_back(snapshot_state(key, 0, successors));
+        }
+        for (const auto& [key, members] : directories) {
+            out.push_back(snapshot_state(key, 1, members));
+        }
+    }
+    
+    void load(const SnapshotState* states, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            if (states[i].key > UINT32_MAX || states[i].table > 1) continue;
+            auto& table = states[i].table == 0 ? transitions : directories;
+            restore_state(table[states[i].key], states[i]);
+        }
+    }
+    
+    void status(std::ostream& os) override {
+        os << "Native Locality - States: " << transitions.size() << ", Directories: " << directories.size()
+           << ", Listings: " << listings.size();
+    }
+};
+
+// Snapshot of the native predictor and the hottest cached files, written on
+// shutdown and periodically so a restart starts warm. Every section is an
+// array of fixed-size records in host byte order, so the file is used
+// straight from an mmap without parsing:
+//
+//   SnapshotHeader
+//   uint64_t path_offsets[path_count + 1]  // into path bytes; ids index this
+//   char path_bytes[]                       // padded to 8 bytes
+//   SnapshotHot hot[hot_count]              // hottest first
+//   SnapshotState states[state_count]
+struct SnapshotHeader {
+    static constexpr char MAGIC[8] = {'Q', 'U', 'A', 'R', 'K', 'S', 'N', 'P'};
+    static constexpr uint32_t VERSION = 1;
+    
+    char magic[8];
+    uint32_t version;
+    uint32_t predictor_kind;
+    uint64_t path_count;
+    uint64_t hot_count;
+    uint64_t state_count;
+    uint64_t paths_offset;
+    uint64_t hot_offset;
+    uint64_t states_offset;
+};
+
+struct SnapshotHot {
+    uint32_t path;
+    uint32_t reserved;
+    uint64_t score;
+};
+
+// Read-only mapping of a snapshot, validated once so lookups need no checks
+class SnapshotFile {
+private:
+    void* base = MAP_FAILED;
+    size_t length = 0;
+    const SnapshotHeader* header = nullptr;
+    const uint64_t* path_offsets = nullptr;
+    const char* path_bytes = nullptr;
+    
+    // [offset, offset + count * size) lies inside the file
+    bool fits(uint64_t offset, uint64_t count, size_t size) const {
+        return offset <= length && count <= (length - offset) / size;
+    }
+    
+    bool validate() {
+        if (length < sizeof(SnapshotHeader)) return false;
+        header = (const SnapshotHeader*)base;
+        if (std::memcmp(header->magic, SnapshotHeader::MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != SnapshotHeader::VERSION || header->path_count >= UINT32_MAX ||
+            !fits(header->paths_offset, header->path_count + 1, sizeof(uint64_t)) ||
+            !fits(header->hot_offset, header->hot_count, sizeof(SnapshotHot)) ||
+            !fits(header->states_offset, header->state_count, sizeof(SnapshotState))) {
+            return false;
+        }
+        path_offsets = (const uint64_t*)((const char*)base + header->paths_offset);
+        path_bytes = (const char*)(path_offsets + header->path_count + 1);
+        uint64_t bytes_offset = header->paths_offset + (header->path_count + 1) * sizeof(uint64_t);
+        if (path_offsets[0] != 0 || !fits(bytes_offset, path_offsets[header->path_count], 1)) return false;
+        for (uint64_t i = 0; i < header->path_count; ++i) {
+            if (path_offsets[i] > path_offsets[i + 1]) return false;
+        }
+        for (uint64_t i = 0; i < header->hot_count; ++i) {
+            if (hot()[i].path >= header->path_count) return false;
+        }
+        for (uint64_t i = 0; i < header->state_count; ++i) {
+            const SnapshotState& state = states()[i];
+            if (state.count > SuccessorSet::CAPACITY || (state.table == 0 && state.key >= header->path_count)) {
+                return false;
+            }
+            for (uint32_t j = 0; j < state.count; ++j) {
+                if (state.successors[j].id >= header->path_count) return false;
+            }
+        }
+        return true;
+    }
+    
+public:
+    ~SnapshotFile() {
+        if (base != MAP_FAILED) munmap(base, length);
+    }
+    
+    // Map and validate `filepath`; on failure `error` says why
+    bool open(const std::string& filepath, std::string& error) {
+        int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = std::strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            length = st.st_size;
+            base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        int err = errno;
+        close(fd);
+        if (base == MAP_FAILED) {
+            error = length ? std::strerror(err) : "empty file";
+            return false;
+        }
+        if (!validate()) {
+            error = "not a valid snapshot";
+            return false;
+        }
+        return true;
+    }
+    
+    PredictorKind predictor_kind() const { return (PredictorKind)header->predictor_kind; }
+    size_t path_count() const { return header->path_count; }
+    std::string_view path(size_t id) const {
+        return std::string_view(path_bytes + path_offsets[id], path_offsets[id + 1] - path_offsets[id]);
+    }
+    const SnapshotHot* hot() const { return (const SnapshotHot*)((const char*)base + header->hot_offset); }
+    size_t hot_count() const { return header->hot_count; }
+    const SnapshotState* states() const {
+        return (const SnapshotState*)((const char*)base + header->states_offset);
+    }
+    size_t state_count() const { return header->state_count; }
+};
+
+// Write a snapshot to `filepath` through a temporary file and rename, so a
+// crash mid-write leaves the previous snapshot intact
+static bool write_snapshot(const std::string& filepath, PredictorKind kind, const std::vector<std::string>& paths,
+                           const std::vector<SnapshotHot>& hot, const std::vector<SnapshotState>& states,
+                           std::string& error) {
+    auto align = [](uint64_t n) { return (n + 7) & ~uint64_t(7); };
+    std::vector<uint64_t> offsets{0};
+    for (const auto& path : paths) offsets.push_back(offsets.back() + path.size());
+    
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic));
+    header.version = SnapshotHeader::VERSION;
+    header.predictor_kind = (uint32_t)kind;
+    header.path_count = paths.size();
+    header.hot_count = hot.size();
+    header.state_count = states.size();
+    header.paths_offset = sizeof(SnapshotHeader);
+    header.hot_offset = align(header.paths_offset + offsets.size() * sizeof(uint64_t) + offsets.back());
+    header.states_offset = header.hot_offset + hot.size() * sizeof(SnapshotHot);
+    
+    std::vector<char> data(header.states_offset + states.size() * sizeof(SnapshotState), 0);
+    std::memcpy(data.data(), &header, sizeof(header));
+    std::memcpy(data.data() + header.paths_offset, offsets.data(), offsets.size() * sizeof(uint64_t));
+    char* bytes = data.data() + header.paths_offset + offsets.size() * sizeof(uint64_t);
+    for (const auto& path : paths) {
+        std::memcpy(bytes, path.data(), path.size());
+        bytes += path.size();
+    }
+    if (!hot.empty()) std::memcpy(data.data() + header.hot_offset, hot.data(), hot.size() * sizeof(SnapshotHot));
+    if (!states.empty()) {
+        std::memcpy(data.data() + header.states_offset, states.data(), states.size() * sizeof(SnapshotState));
+    }
+    
+    std::string temp = filepath + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = std::strerror(errno);
+        return false;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += n;
+    }
+    bool ok = written == data.size() && fsync(fd) == 0;
+    int err = errno;
+    close(fd);
+    if (!ok || rename(temp.c_str(), filepath.c_str()) != 0) {
+        error = std::strerror(ok ? errno : err);
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Read traces: a TraceHeader, then a stream of TraceRecords. A path is
+// named once, by a TracePath record followed by its bytes, before the first
+// read of it; reads refer to it by id from then on. Records are appended as
+// they happen, so a trace cut short by a crash is still readable up to its
+// last whole record. fcache-replay (replay.cpp) plays them back.
+struct TraceHeader {
+    static constexpr char MAGIC[8] = {'Q', 'U', 'A', 'R', 'K', 'T', 'R', 'C'};
+    static constexpr uint32_t VERSION = 1;
+    
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_size;  // Of the cache that recorded it, for reference
+    int64_t start_ns;     // Wall clock time of the first record's time 0
+};
+
+enum class TraceKind : uint32_t {
+    Miss = 0,
+    Hit = 1,
+    PartialHit = 2,  // Some of the chunks were cached
+    Path = 3,        // Names path id `path`; `size` bytes of name follow
+};
+
+struct TraceRecord {
+    static constexpr uint64_t UNKNOWN_SIZE = UINT64_MAX;
+    
+    uint64_t time_ns;    // Since the trace started
+    uint64_t offset;
+    uint64_t file_size;  // As the cache knew it, UNKNOWN_SIZE if the read told it nothing
+    uint32_t size;
+    uint32_t path_kind;  // Path id << 2 | TraceKind
+    
+    uint32_t path() const { return path_kind >> 2; }
+    TraceKind kind() const { return (TraceKind)(path_kind & 3); }
+};
+
+// Appends reads to a trace file in 1 MiB batches. Not thread-safe on its
+// own; the manager serializes access.
+class TraceWriter {
+private:
+    static constexpr size_t BATCH = 1 << 20;
+    
+    int fd;
+    uint64_t start;
+    PathInterner ids;
+    std::vector<char> buffer;
+    uint64_t reads = 0;
+    bool failed = false;
+    
+    void append(const void* data, size_t n) {
+        const char* bytes = (const char*)data;
+        buffer.insert(buffer.end(), bytes, bytes + n);
+    }
+    
+    // After a write error the rest of the trace is dropped
+    void flush() {
+        if (!failed && !write_all(buffer.data(), buffer.size())) {
+            std::cerr << "Trace write failed: " << std::strerror(errno) << ", recording stopped" << std::endl;
+            failed = true;
+        }
+        buffer.clear();
+    }
+    
+    bool write_all(const char* data, size_t n) {
+        while (n > 0) {
+            ssize_t written = write(fd, data, n);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            data += written;
+            n -= written;
+        }
+        return true;
+    }
+    
+    TraceWriter(int fd, uint64_t start) : fd(fd), start(start) {
+        buffer.reserve(BATCH + 4096);
+    }
+    
+public:
+    // Create (truncating) a trace at `filepath`; nullptr with errno set on error
+    static std::unique_ptr<TraceWriter> create(const std::string& filepath, size_t chunk_size) {
+        int fd = ::open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return nullptr;
+        std::unique_ptr<TraceWriter> writer(new TraceWriter(fd, Metrics::now_ns()));
+        TraceHeader header{};
+        std::memcpy(header.magic, TraceHeader::MAGIC, sizeof(header.magic));
+        header.version = TraceHeader::VERSION;
+        header.chunk_size = (uint32_t)std::min<size_t>(chunk_size, UINT32_MAX);
+        header.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        writer->append(&header, sizeof(header));
+        return writer;
+    }
+    
+    ~TraceWriter() {
+        flush();
+        close(fd);
+    }
+    
+    void record(const std::string& normalized, uint64_t offset, size_t size, uint64_t file_size, TraceKind kind) {
+        uint64_t now = Metrics::now_ns() - start;
+        size_t known = ids.size();
+        uint32_t id = ids.intern(normalized);
+        if (id == known) {
+            TraceRecord name{now, 0, 0, (uint32_t)normalized.size(), id << 2 | (uint32_t)TraceKind::Path};
+            append(&name, sizeof(name));
+            append(normalized.data(), normalized.size());
+        }
+        TraceRecord read{now, offset, file_size, (uint32_t)std::min<size_t>(size, UINT32_MAX),
+                         id << 2 | (uint32_t)kind};
+        append(&read, sizeof(read));
+        ++reads;
+        if (buffer.size() >= BATCH) flush();
+    }
+    
+    uint64_t get_reads() const {
+        return reads;
+    }
+};
+
+// Turns each source's measured prefetch accuracy into a prefetch depth.
+// Accuracy is the share of prefetched chunks read before eviction, smoothed
+// over windows of resolved chunks, and the depth is further scaled down as
+// unread prefetches fill their share of the cache. A source that is out of
+// accuracy or headroom still probes now and then: its new prefetches evict
+// the stale ones, which is how both measures recover.
+class PrefetchController {
+public:
+    static constexpr size_t WINDOW = 32;         // Resolved chunks per accuracy update
+    static constexpr double MIN_ACCURACY = 0.1;  // Below this a source only probes
+    static constexpr size_t PROBE_INTERVAL = 16;
+    
+private:
+    struct State {
+        std::string name;
+        uint64_t hits = 0;
+        uint64_t wasted = 0;
+        double accuracy = 0.5;  // No evidence yet
+        uint64_t calls = 0;
+    };
+    
+    std::shared_ptr<PrefetchStats> stats;
+    size_t budget;  // Bytes of unread prefetches allowed in the cache
+    std::array<State, PrefetchStats::MAX_SOURCES> states;
+    size_t registered = 1;  // Source 0 is demand reads
+    std::mutex mutex;
+    
+    void update(uint8_t source) {
+        State& state = states[source];
+        uint64_t hits = stats->sources[source].hits.load(std::memory_order_relaxed);
+        uint64_t wasted = stats->sources[source].wasted.load(std::memory_order_relaxed);
+        uint64_t resolved = (hits - state.hits) + (wasted - state.wasted);
+        if (resolved < WINDOW) return;
+        double window = (double)(hits - state.hits) / resolved;
+        state.accuracy = 0.7 * state.accuracy + 0.3 * window;
+        state.hits = hits;
+        state.wasted = wasted;
+    }
+    
+public:
+    PrefetchController(std::shared_ptr<PrefetchStats> stats, size_t budget)
+        : stats(std::move(stats)), budget(std::max<size_t>(1, budget)) {}
+    
+    void set_budget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = std::max<size_t>(1, bytes);
+    }
+    
+    // Id for a named source, reusing the id of an earlier registration.
+    // Returns 0 (untracked) once every id is taken.
+    uint8_t register_source(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 1; i < registered; ++i) {
+            if (states[i].name == name) return i;
+        }
+        if (registered == states.size()) return 0;
+        states[registered].name = name;
+        return registered++;
+    }
+    
+    // How many of up to max_depth predictions `source` should prefetch now
+    size_t depth(uint8_t source, size_t max_depth) {
+        if (source == 0 || max_depth == 0) return max_depth;
+        std::lock_guard<std::mutex> lock(mutex);
+        update(source);
+        State& state = states[source];
+        double headroom = 1.0 - (double)stats->outstanding_bytes.load(std::memory_order_relaxed) / budget;
+        if (headroom <= 0 || state.accuracy < MIN_ACCURACY) {
+            return ++state.calls % PROBE_INTERVAL == 0 ? 1 : 0;
+        }
+        size_t depth = (size_t)(max_depth * state.accuracy * headroom + 0.5);
+        return std::min(std::max<size_t>(1, depth), max_depth);
+    }
+    
+    void status(std::ostream& os) {
+        std::lock_guard<std::mutex> lock(mutex);
+        os << "Prefetch: " << stats->outstanding_bytes.load(std::memory_order_relaxed) / (1024.0 * 1024.0)
+           << " MB unread of " << budget / (1024.0 * 1024.0) << " MB budget";
+        for (size_t i = 1; i < registered; ++i) {
+            const auto& source = stats->sources[i];
+            os << " | " << states[i].name << ": " << source.hits.load(std::memory_order_relaxed) << " hit, "
+               << source.wasted.load(std::memory_order_relaxed) << " wasted of "
+               << source.issued.load(std::memory_order_relaxed) << ", accuracy " << states[i].accuracy;
+        }
+        os << std::endl;
+    }
+    
+    // Visit (name, issued, hits, wasted, accuracy) for every registered source
+    template <typename Fn>
+    void for_each_source(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 1; i < registered; ++i) {
+            update(i);
+            const auto& source = stats->sources[i];
+            fn(states[i].name, source.issued.load(std::memory_order_relaxed),
+               source.hits.load(std::memory_order_relaxed), source.wasted.load(std::memory_order_relaxed),
+               states[i].accuracy);
+        }
+    }
+};
+
+// Per-handle detection of sequential and strided reads, after the kernel's
+// on-demand readahead. A read that continues where the handle's last read
+// ended, or repeats its last stride, makes the handle a stream and queues a
+// window of chunks ahead of it. Each time the reader gets halfway through
+// that window it doubles, up to max_window; a broken pattern halves it.
+class StreamDetector {
+public:
+    // Chunk ranges to queue, as (first, count)
+    using Plan = std::vector<std::pair<uint64_t, uint64_t>>;
+    
+private:
+    struct Stream {
+        uint64_t offset = 0;   // Start of the latest read
+        uint64_t end = 0;      // Furthest byte read
+        int64_t stride = 0;    // Start-to-start distance of the last two reads
+        uint64_t run = 0;      // Reads in a row that followed the pattern
+        bool strided = false;
+        uint64_t window = 0;   // Chunks (sequential) or reads (strided) queued per round
+        uint64_t ahead = 0;    // Next chunk (sequential) or byte offset (strided) to queue
+        uint64_t trigger = 0;  // Reaching this chunk or offset queues the next round
+    };
+    
+    size_t chunk_size;
+    uint64_t min_window;
+    uint64_t max_window;
+    std::unordered_map<uint64_t, Stream> streams;
+    std::mutex mutex;
+    uint64_t detected = 0;
+    uint64_t broken = 0;
+    
+    static void add(Plan& plan, uint64_t first, uint64_t count) {
+        if (!plan.empty() && first <= plan.back().first + plan.back().second) {
+            uint64_t end = std::max(plan.back().first + plan.back().second, first + count);
+            plan.back().second = end - plan.back().first;
+        } else {
+            plan.emplace_back(first, count);
+        }
+    }
+    
+public:
+    StreamDetector(size_t chunk_size, uint64_t min_window, uint64_t max_window)
+        : chunk_size(chunk_size), min_window(std::max<uint64_t>(1, min_window)),
+          max_window(std::max(this->min_window, max_window)) {}
+    
+    // Record a read of [offset, offset + size) through handle `fh` and
+    // return the readahead it calls for, clamped to the file
+    Plan observe(uint64_t fh, uint64_t offset, size_t size, uint64_t file_size) {
+        Plan plan;
+        if (size == 0 || offset >= file_size) return plan;
+        uint64_t end = std::min<uint64_t>(offset + size, file_size);
+        uint64_t last_chunk = (file_size - 1) / chunk_size;
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        auto [it, fresh] = streams.try_emplace(fh);
+        Stream& s = it->second;
+        if (fresh) {
+            s.offset = offset;
+            s.end = end;
+            return plan;
+        }
+        
+        // FUSE threads deliver a stream's reads slightly out of order, so
+        // sequential allows a chunk of slack either way
+        bool sequential = offset + chunk_size >= s.offset && offset <= s.end + chunk_size;
+        int64_t delta = (int64_t)offset - (int64_t)s.offset;
+        bool match = sequential || (delta > 0 && delta == s.stride);
+        if (s.run > 0 && s.strided == sequential) {
+            match = false;  // Switching between sequential and strided starts over
+        }
+        s.stride = delta;
+        if (!match) {
+            if (s.run > 0) ++broken;
+            s.run = 0;
+            s.window /= 2;
+            s.offset = offset;
+            s.end = end;
+            return plan;
+        }
+        
+        s.strided = !sequential;
+        s.offset = s.strided ? offset : std::max(s.offset, offset);
+        s.end = s.strided ? end : std::max(s.end, end);
+        bool start = s.run++ == 0;
+        if (start) {
+            ++detected;
+            s.window = std::max(s.window, min_window);
+        }
+        
+        if (!s.strided) {
+            uint64_t current = (s.end - 1) / chunk_size;
+            if (!start && current < s.trigger) return plan;
+            if (!start) s.window = std::min(s.window * 2, max_window);
+            uint64_t first = start ? current + 1 : std::max(s.ahead, current + 1);
+            s.ahead = first + s.window;
+            s.trigger = s.ahead - s.window / 2;
+            if (first <= last_chunk) add(plan, first, std::min(s.window, last_chunk - first + 1));
+            return plan;
+        }
+        
+        uint64_t stride = s.stride;
+        if (!start && offset < s.trigger) return plan;
+        if (!start) s.window = std::min(s.window * 2, max_window);
+        uint64_t next = start ? offset + stride : std::max(s.ahead, offset + stride);
+        for (uint64_t k = 0; k < s.window && next + k * stride < file_size; ++k) {
+            uint64_t read_start = next + k * stride;
+            uint64_t read_end = std::min<uint64_t>(read_start + size, file_size);
+            uint64_t first = read_start / chunk_size;
+            add(plan, first, (read_end - 1) / chunk_size - first + 1);
+        }
+        s.ahead = next + s.window * stride;
+        s.trigger = s.ahead - s.window / 2 * stride;
+        return plan;
+    }
+    
+    void forget(uint64_t fh) {
+        std::lock_guard<std::mutex> lock(mutex);
+        streams.erase(fh);
+    }
+    
+    void status(std::ostream& os) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t active = 0;
+        for (const auto& [fh, stream] : streams) {
+            if (stream.run > 0) ++active;
+        }
+        os << "Streams: " << active << " of " << streams.size() << " handles | Detected: " << detected
+           << " | Broken: " << broken << std::endl;
+    }
+};
+
+// Bounded lock-free multi-producer, single-consumer queue of read events.
+// FUSE threads push paths without taking a lock and one predictor thread
+// drains them in batches. A full queue drops the event: losing a training
+// sample is cheaper than stalling a read.
+class AccessQueue {
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        std::string path;
+    };
+    
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) size_t head = 0;  // Consumer only, guarded by consumer_mutex
+    std::atomic<bool> sleeping{false};
+    std::atomic<uint64_t> dropped{0};
+    std::mutex consumer_mutex;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    
+    bool ready() const {
+        return slots[head & mask].sequence.load(std::memory_order_acquire) == head + 1;
+    }
+    
+    size_t drain(std::vector<std::string>& out, size_t max_batch) {
+        size_t taken = 0;
+        while (taken < max_batch && ready()) {
+            Slot& slot = slots[head & mask];
+            out.push_back(std::move(slot.path));
+            slot.sequence.store(head + mask + 1, std::memory_order_release);
+            ++head;
+            ++taken;
+        }
+        return taken;
+    }
+    
+public:
+    AccessQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    bool push(std::string path) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots[pos & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+        slot->path = std::move(path);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        
+        // Pairs with the fence in pop_batch: either the consumer sees the
+        // event before parking or we see it parked and wake it
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            wake.notify_one();
+        }
+        return true;
+    }
+    
+    // Move up to max_batch events into `out`, waiting up to timeout_ms for
+    // the first one. Returns the number taken.
+    size_t pop_batch(std::vector<std::string>& out, size_t max_batch, int timeout_ms) {
+        std::lock_guard<std::mutex> consumer(consumer_mutex);
+        size_t taken = drain(out, max_batch);
+        if (taken > 0 || timeout_ms <= 0) return taken;
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            wake.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return ready(); });
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+        return drain(out, max_batch);
+    }
+    
+    uint64_t get_dropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+};
+
+// Sizes the cache to the memory its cgroup can spare. Every interval it
+// takes the share of time tasks stalled on memory from PSI (the cgroup v2
+// memory.pressure, or /proc/pressure/memory) and the headroom under the
+// cgroup's memory.max (or MemAvailable when the group has no limit). A
+// stall above HIGH_STALL or headroom under the reserve gives back a quarter
+// of the cache, or the shortfall if that is more, at once; a quiet interval
+// with spare headroom grows a nearly full cache by at most an eighth, so it
+// backs off far faster than it grows. The limit stays in [min_limit, max_limit].
+class MemoryGovernor {
+public:
+    static constexpr double HIGH_STALL = 0.05;
+    static constexpr double LOW_STALL = 0.005;
+    static constexpr size_t MIN_RESERVE = 64 * 1024 * 1024;
+    
+    struct Hooks {
+        std::function<size_t()> limit;         // The cache's current limit
+        std::function<size_t()> usage;         // Bytes it holds
+        std::function<void(size_t)> resize;
+    };
+    
+private:
+    std::string pressure_path;
+    std::string max_path;  // Empty when headroom comes from /proc/meminfo
+    std::string current_path;
+    size_t min_limit;
+    size_t max_limit;
+    int interval_ms;
+    Hooks hooks;
+    std::atomic<double> stall{0};
+    uint64_t last_total = 0;  // Stalled microseconds at the last sample
+    uint64_t last_time = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool running = false;
+    std::thread thread;
+    
+    static bool read_file(const std::string& path, std::string& out) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        out.clear();
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+            if (n > 0) out.append(buf, n);
+        }
+        int error = errno;
+        close(fd);
+        errno = error;
+        return n == 0;
+    }
+    
+    // Number after `key` in `text`, e.g. "total=" in a PSI line
+    static bool find_number(const std::string& text, const std::string& key, uint64_t& value) {
+        size_t at = text.find(key);
+        if (at == std::string::npos) return false;
+        value = std::strtoull(text.c_str() + at + key.size(), nullptr, 10);
+        return true;
+    }
+    
+    // Microseconds some task stalled on memory, from the "some" line
+    bool read_stall_total(uint64_t& total) {
+        std::string text;
+        if (!read_file(pressure_path, text)) return false;
+        return find_number(text.substr(0, text.find('\n')), "total=", total);
+    }
+    
+    bool read_headroom(size_t& spare, size_t& reserve) {
+        std::string text;
+        uint64_t max = 0, current = 0;
+        if (!max_path.empty() && read_file(max_path, text) && std::isdigit((unsigned char)text[0])) {
+            max = std::strtoull(text.c_str(), nullptr, 10);
+            if (!read_file(current_path, text)) return false;
+            current = std::strtoull(text.c_str(), nullptr, 10);
+            spare = current < max ? max - current : 0;
+        } else {
+            uint64_t available;
+            if (!read_file("/proc/meminfo", text) || !find_number(text, "MemTotal:", max) ||
+                !find_number(text, "MemAvailable:", available)) {
+                return false;
+            }
+            max *= 1024;
+            spare = available * 1024;
+        }
+        reserve = std::max<size_t>(MIN_RESERVE, max / 20);
+        return true;
+    }
+    
+    void step() {
+        uint64_t total;
+        uint64_t now = Metrics::now_ns() / 1000;
+        double share = 0;
+        if (read_stall_total(total)) {
+            if (last_time != 0 && now > last_time && total >= last_total) {
+                share = std::min(1.0, (double)(total - last_total) / (now - last_time));
+            }
+            last_total = total;
+            last_time = now;
+        }
+        stall = share;
+        size_t spare, reserve;
+        if (!read_headroom(spare, reserve)) return;
+        
+        size_t current = hooks.limit();
+        size_t target = current;
+        if (share >= HIGH_STALL || spare < reserve) {
+            size_t cut = std::max(current / 4, reserve > spare ? reserve - spare : 0);
+            target = current > cut ? current - cut : 0;
+        } else if (share < LOW_STALL && spare > 2 * reserve && hooks.usage() >= current / 10 * 9) {
+            target = current + std::min((spare - 2 * reserve) / 2, std::max(current / 8, MIN_RESERVE));
+        }
+        target = std::min(std::max(target, min_limit), max_limit);
+        if (target != current) hooks.resize(target);
+    }
+    
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!cv.wait_for(lock, std::chrono::milliseconds(interval_ms), [this] { return !running; })) {
+            lock.unlock();
+            step();
+            lock.lock();
+        }
+    }
+    
+public:
+    MemoryGovernor(size_t min_limit, size_t max_limit, int interval_ms)
+        : min_limit(std::min(min_limit, max_limit)), max_limit(max_limit), interval_ms(std::max(10, interval_ms)) {}
+    
+    ~MemoryGovernor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cv.notify_all();
+        if (thread.joinable()) thread.join();
+    }
+    
+    // Find the files of `cgroup`, a cgroup v2 directory, or of this process's
+    // cgroup when empty. False with errno set when no PSI file is readable.
+    bool open(std::string cgroup) {
+        std::string text;
+        if (cgroup.empty() && read_file("/proc/self/cgroup", text)) {
+            size_t at = text.find("0::");
+            if (at != std::string::npos) {
+                std::string path = text.substr(at + 3, text.find('\n', at) - at - 3);
+                if (path == "/") path.clear();
+                for (const char* mount : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"}) {
+                    if (access((mount + path + "/memory.pressure").c_str(), R_OK) == 0) {
+                        cgroup = mount + path;
+                        break;
+                    }
+                }
+            }
+        }
+        uint64_t total;
+        pressure_path = cgroup + "/memory.pressure";
+        if (!cgroup.empty() && read_stall_total(total)) {
+            max_path = cgroup + "/memory.max";
+            current_path = cgroup + "/memory.current";
+            return true;
+        }
+        pressure_path = "/proc/pressure/memory";
+        return read_stall_total(total);
+    }
+    
+    void start(Hooks next) {
+        hooks = std::move(next);
+        running = true;
+        thread = std::thread(&MemoryGovernor::run, this);
+    }
+    
+    const std::string& source() const {
+        return pressure_path;
+    }
+    
+    double get_stall() const {
+        return stall.load(std::memory_order_relaxed);
+    }
+    
+    void status(std::ostream& os) {
+        os << "Memory pressure: " << pressure_path << " | Stall: " << get_stall() * 100 << "% | Limit: "
+           << hooks.limit() / (1024.0 * 1024.0) << " MB in [" << min_limit / (1024.0 * 1024.0) << ", "
+           << max_limit / (1024.0 * 1024.0) << "] MB" << std::endl;
+    }
+};
+
+// Chunks covering one read request. The requested bytes start at `offset`
+// within the first chunk and run for `length` bytes across `chunks`.
+struct CacheRead {
+    std::vector<CacheData> chunks;
+    size_t offset;
+    size_t length;
+};
+
+// Point-in-time totals for stats() and the Prometheus exposition
+struct CacheStats {
+    Metrics::Snapshot metrics;
+    size_t memory_bytes;
+    size_t memory_limit;
+    size_t mapped_bytes;
+    size_t chunks;
+    size_t queued;
+    size_t in_flight;
+    uint64_t prefetch_issued = 0;
+    uint64_t prefetch_used = 0;
+    uint64_t prefetch_wasted = 0;
+    int64_t prefetch_unread_bytes;
+    uint64_t metadata_hits;
+    uint64_t metadata_misses;
+    double memory_pressure = 0;  // Stall share seen by the memory governor, if any
+};
+
+// FileCacheManager implementation
+class FileCacheManagerImpl {
+private:
+    std::shared_ptr<FileCache> cache;
+    std::shared_ptr<SlabAllocator> allocator;
+    std::shared_ptr<MetadataCache> metadata;
+    std::shared_ptr<FdTable> files;
+    std::shared_ptr<MappedFiles> mapped;
+    std::unique_ptr<FileReader> reader;
+    std::shared_ptr<PeerTier> peers;
+    std::atomic<size_t> memory_limit;
+    std::mutex limit_mutex;  // Serializes resizes
+    size_t chunk_size;
+    size_t prefetch_chunks;
+    bool validate;
+    bool map_files;  // Chunks are mappings of the files' page cache
+    static constexpr int RESIZE_WAIT_MS = 1000;  // For mapped chunks held by readers, before a truncate
+    // Root directory, for stat calls on the hit path; AT_FDCWD until set_root
+    std::atomic<int> root_fd{AT_FDCWD};
+    
+    // Native predictor state, guarded by predictor_mutex
+    std::unique_ptr<NativePredictor> predictor;
+    PathInterner interner;
+    ReadHistory history;
+    uint8_t predictor_source = 0;
+    float min_confidence = 0;
+    // Model from load_snapshot, imported on first use of a matching predictor
+    std::unique_ptr<SnapshotFile> pending_snapshot;
+    std::mutex predictor_mutex;
+    
+    AccessQueue accesses;
+    std::unique_ptr<PrefetchController> prefetch_control;
+    StreamDetector streams;
+    uint8_t readahead_source;
+    // Read trace being recorded, if any; `tracing` keeps the check off the lock
+    std::atomic<bool> tracing{false};
+    std::mutex trace_mutex;
+    std::unique_ptr<TraceWriter> trace;
+    // Last, so its thread stops before anything it resizes is destroyed
+    std::mutex governor_mutex;
+    std::unique_ptr<MemoryGovernor> governor;
+    
+    // Move the pending snapshot's model into the predictor. Snapshot path ids
+    // are reused as-is, which holds as long as nothing was interned first;
+    // the import runs before the first read is interned. Caller holds
+    // predictor_mutex.
+    void import_snapshot() {
+        if (!pending_snapshot || !predictor) return;
+        auto snapshot = std::move(pending_snapshot);
+        if (snapshot->predictor_kind() != predictor->kind()) {
+            std::cerr << "Snapshot is from a different predictor, not loading its model" << std::endl;
+            return;
+        }
+        for (size_t i = 0; i < snapshot->path_count(); ++i) {
+            if (interner.intern(std::string(snapshot->path(i))) != i) {
+                std::cerr << "Paths were interned before the snapshot loaded, not loading its model" << std::endl;
+                return;
+            }
+        }
+        predictor->load(snapshot->states(), snapshot->state_count());
+    }
+    
+    // Keep the next prefetch_chunks chunks after `last` queued while a file
+    // is being consumed. Checking only the far end of the window keeps the
+    // hit path to a single extra lookup.
+    void read_ahead(const std::string& normalized, uint64_t last, uint64_t file_size) {
+        if (file_size == 0) return;
+        uint64_t last_in_file = (file_size - 1) / chunk_size;
+        uint64_t window_end = std::min<uint64_t>(last + prefetch_chunks, last_in_file);
+        if (window_end <= last || cache->contains({normalized, window_end})) {
+            return;
+        }
+        reader->request_chunks(normalized, last + 1, window_end - last);
+    }
+    
+    // Read-ahead for a read through a handle: only handles read as a stream
+    // get any, sized by the stream's window and the readahead source's
+    // accuracy and headroom
+    void stream_ahead(const std::string& normalized, uint64_t fh, uint64_t offset, size_t size, uint64_t file_size) {
+        StreamDetector::Plan plan = streams.observe(fh, offset, size, file_size);
+        if (plan.empty()) return;
+        uint64_t total = 0;
+        for (const auto& range : plan) total += range.second;
+        uint64_t allowed = prefetch_control->depth(readahead_source, total);
+        for (const auto& [first, count] : plan) {
+            if (allowed == 0) break;
+            uint64_t n = std::min(count, allowed);
+            reader->request_chunks(normalized, first, n, 0, readahead_source);
+            allowed -= n;
+        }
+    }
+    
+    // stat of the file behind `normalized`, following a final symlink. The
+    // lstat goes through the metadata cache unless `refresh` is set.
+    bool file_stat(const std::string& normalized, struct stat& st, bool refresh) {
+        if (!stat_path(normalized, st, refresh)) {
+            return false;
+        }
+        return !S_ISLNK(st.st_mode) || fstatat(get_root_fd(), normalized.c_str(), &st, 0) == 0;
+    }
+    
+    // False if the file changed since `chunk` was read from it, as far as
+    // the metadata cache's TTL lets us see
+    bool is_current(const std::string& normalized, const CachedChunk& chunk) {
+        struct stat st;
+        if (!file_stat(normalized, st, false)) {
+            return false;
+        }
+        return (uint64_t)st.st_size == chunk.file_size && mtime_ns(st.st_mtim) == chunk.mtime_ns;
+    }
+    
+    void trace_read(const std::string& normalized, uint64_t offset, size_t size, uint64_t file_size,
+                    TraceKind kind) {
+        if (!tracing.load(std::memory_order_relaxed)) return;
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        if (trace) trace->record(normalized, offset, size, file_size, kind);
+    }
+    
+    // Chunk size, rounded up to whole pages when chunks map their files so
+    // every chunk starts on a page boundary
+    static size_t effective_chunk_size(size_t chunk_size, bool map_files) {
+        chunk_size = std::max<size_t>(1, chunk_size);
+        if (!map_files) return chunk_size;
+        size_t page = sysconf(_SC_PAGESIZE);
+        return (chunk_size + page - 1) / page * page;
+    }
+    
+    // read_cache without the read-ahead. With `queue_missing`, a chunk missing
+    // partway through the range is queued for the prefetcher; `partial` says
+    // whether that is why the read missed. `accessed` is set to how many
+    // chunks from the first on were looked up, hit or miss.
+    bool read_cached(const std::string& normalized, size_t size, size_t offset, CacheRead& result,
+                     bool queue_missing, bool& partial, size_t& accessed) {
+        partial = false;
+        uint64_t first = offset / chunk_size;
+        accessed = 1;
+        CacheData head = cache->get({normalized, first});
+        if (head && validate && !is_current(normalized, *head)) {
+            cache->invalidate(normalized, head->file_size);
+            return false;
+        }
+        if (!head || offset >= head->file_size || size == 0) {
+            return false;
+        }
+        
+        uint64_t end = std::min<uint64_t>(offset + size, head->file_size);
+        uint64_t last = (end - 1) / chunk_size;
+        result.chunks.clear();
+        result.chunks.push_back(std::move(head));
+        for (uint64_t i = first + 1; i <= last; ++i) {
+            ++accessed;
+            CacheData chunk = cache->get({normalized, i});
+            if (!chunk) {
+                if (queue_missing) reader->request_chunks(normalized, i, prefetch_chunks);
+                partial = true;
+                return false;
+            }
+            const CachedChunk& front = *result.chunks.front();
+            if (chunk->mtime_ns != front.mtime_ns || chunk->file_size != front.file_size) {
+                cache->invalidate(normalized, std::max(chunk->file_size, front.file_size));
+                return false;
+            }
+            result.chunks.push_back(std::move(chunk));
+        }
+        result.offset = offset - first * chunk_size;
+        result.length = end - offset;
+        return true;
+    }
+    
+    // read_through's disk half: chunks of the current version already cached
+    // are reused, the rest are read from `fd`. Nothing is cached if the file
+    // turns out shorter than fstat said, since it is changing under us.
+    // `partial` is set when some of the chunks were cached. Chunks other
+    // nodes own are asked from them before the disk, unless this is for a
+    // peer, `for_peer`; then cached chunks are peeked, not accessed. So are
+    // the first `accessed` chunks, which read_cached already looked up.
+    bool fill_range(const std::string& normalized, int fd, size_t size, size_t offset, CacheRead& result,
+                    bool& partial, bool for_peer = false, size_t accessed = 0) {
+        uint64_t generation = cache->fill_generation();
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return false;
+        }
+        result.chunks.clear();
+        result.offset = 0;
+        result.length = 0;
+        uint64_t file_size = st.st_size;
+        if (offset >= file_size || size == 0) {
+            return true;
+        }
+        int64_t mtime = mtime_ns(st.st_mtim);
+        uint64_t end = std::min<uint64_t>(offset + size, file_size);
+        uint64_t first = offset / chunk_size;
+        uint64_t last = (end - 1) / chunk_size;
+        size_t count = last - first + 1;
+        
+        result.chunks.resize(count);
+        std::vector<CachedChunk> fresh(count);
+        std::vector<bool> fetched(count);
+        bool use_peers = !for_peer && peers->is_enabled();
+        std::shared_ptr<const void> pin = map_files ? mapped->pin(st) : nullptr;
+        for (size_t i = 0; i < count; ++i) {
+            bool peek = for_peer || i < accessed;
+            CacheData cached = peek ? cache->peek({normalized, first + i}) : cache->get({normalized, first + i});
+            if (cached && cached->file_size == file_size && cached->mtime_ns == mtime) {
+                result.chunks[i] = std::move(cached);
+                partial = true;
+                continue;
+            }
+            uint64_t start = (first + i) * chunk_size;
+            size_t length = std::min<uint64_t>(chunk_size, file_size - start);
+            if (use_peers && peers->fetch({normalized, first + i}, file_size, mtime, *allocator,
+                                          cache->get_metrics(), fresh[i])) {
+                fetched[i] = true;
+                continue;
+            }
+            fresh[i] = CachedChunk{SlabBuffer(), file_size, 0, mtime};
+            if (pin) fresh[i].bytes = SlabBuffer::map(fd, start, length, pin);
+            if (fresh[i].bytes.is_mapped()) {
+                cache->get_metrics().add(Metrics::BytesRead, length);
+            } else {
+                fresh[i].bytes = allocator->allocate(length);
+            }
+        }
+        
+        // Chunks neither cached nor mapped are read in runs
+        auto unread = [&](size_t i) { return !result.chunks[i] && !fetched[i] && !fresh[i].bytes.is_mapped(); };
+        bool complete = true;
+        std::vector<iovec> iov;
+        for (size_t i = 0; i < count && complete;) {
+            if (!unread(i)) {
+                ++i;
+                continue;
+            }
+            size_t run = i;
+            iov.clear();
+            for (; i < count && unread(i) && iov.size() < IOV_MAX; ++i) {
+                iov.push_back({fresh[i].bytes.data(), fresh[i].bytes.size()});
+            }
+            size_t want = 0;
+            for (const auto& v : iov) want += v.iov_len;
+            errno = 0;
+            size_t got = preadv_fully(fd, iov.data(), iov.size(), (first + run) * chunk_size);
+            cache->get_metrics().add(Metrics::BytesRead, got);
+            if (got < want) {
+                if (errno != 0 && got == 0) return false;
+                // Clip the answer to the bytes that were there
+                end = std::min<uint64_t>(end, (first + run) * chunk_size + got);
+                complete = false;
+            }
+        }
+        
+        for (size_t i = 0; i < count; ++i) {
+            if (result.chunks[i]) continue;
+            if (complete) {
+                cache->fill({normalized, first + i}, std::move(fresh[i]), generation, &result.chunks[i]);
+            }
+            if (!result.chunks[i]) {
+                result.chunks[i] = std::make_shared<const CachedChunk>(std::move(fresh[i]));
+            }
+        }
+        if (end <= offset) {
+            result.chunks.clear();
+            return true;
+        }
+        result.chunks.resize((end - 1) / chunk_size - first + 1);
+        result.offset = offset - first * chunk_size;
+        result.length = end - offset;
+        return true;
+    }
+    
+public:
+    FileCacheManagerImpl(size_t memory_limit, size_t chunk_size, size_t num_shards,
+                         size_t reader_threads, size_t prefetch_chunks,
+                         IoBackend backend, size_t queue_depth, PolicyKind policy, size_t compressed_limit,
+                         const std::string& spill_path, size_t spill_size, bool validate,
+                         int64_t metadata_ttl_ms, size_t metadata_entries, size_t max_readahead, bool map_files)
+        : memory_limit(memory_limit), chunk_size(effective_chunk_size(chunk_size, map_files)),
+          prefetch_chunks(std::max<size_t>(1, prefetch_chunks)), validate(validate), map_files(map_files),
+          accesses(4096), streams(this->chunk_size, this->prefetch_chunks, max_readahead) {
+        allocator = std::make_shared<SlabAllocator>(this->chunk_size);
+        cache = std::make_shared<FileCache>(memory_limit, num_shards, policy, this->chunk_size, allocator,
+                                            compressed_limit, spill_path, spill_size);
+        metadata = std::make_shared<MetadataCache>(metadata_ttl_ms, metadata_entries, num_shards);
+        files = std::make_shared<FdTable>();
+        mapped = std::make_shared<MappedFiles>();
+        peers = std::make_shared<PeerTier>();
+        reader = std::make_unique<FileReader>(".", cache, allocator, metadata, files, this->chunk_size,
+                                              reader_threads, backend, queue_depth, map_files, mapped, peers);
+        // Most entries start as prefetches; let unread ones take up to half
+        // the cache before throttling
+        prefetch_control = std::make_unique<PrefetchController>(cache->get_prefetch_stats(), memory_limit / 2);
+        readahead_source = prefetch_control->register_source("readahead");
+    }
+    
+    ~FileCacheManagerImpl() {
+        // Peer requests are answered from this object
+        peers->leave();
+        int fd = root_fd.load();
+        if (fd >= 0) close(fd);
+    }
+    
+    int get_root_fd() const {
+        return root_fd.load(std::memory_order_relaxed);
+    }
+    
+    // Prefetch the first prefetch_chunks chunks; the rest is read ahead as
+    // the file is consumed
+    void request_file(const std::string& filepath, int priority, uint8_t source = 0) {
+        reader->request_chunks(normalize_path(filepath), 0, prefetch_chunks, priority, source);
+    }
+    
+    uint8_t register_source(const std::string& name) {
+        return prefetch_control->register_source(name);
+    }
+    
+    size_t prefetch_depth(uint8_t source, size_t max_depth) {
+        return prefetch_control->depth(source, max_depth);
+    }
+    
+    PrefetchController& get_prefetch_controller() {
+        return *prefetch_control;
+    }
+    
+    bool is_in_cache(const std::string& filepath) {
+        std::string normalized = normalize_path(filepath);
+        return cache->get({normalized, 0}) != nullptr;
+    }
+    
+    // Hit only if every chunk covering [offset, offset + size), clamped to
+    // EOF, is cached. Partially cached files still hit on the chunks they have.
+    // With validation on, the file is stat'ed on every hit and a changed
+    // size or mtime drops all of its chunks; chunks from different versions
+    // of a file never make up one read either way.
+    bool read_cache(const std::string& filepath, size_t size, size_t offset, CacheRead& result) {
+        Metrics& metrics = cache->get_metrics();
+        uint64_t start = Metrics::now_ns();
+        std::string normalized = normalize_path(filepath);
+        bool partial;
+        size_t accessed;
+        if (!read_cached(normalized, size, offset, result, true, partial, accessed)) {
+            metrics.add(partial ? Metrics::PartialHits : Metrics::Misses);
+            trace_read(normalized, offset, size, TraceRecord::UNKNOWN_SIZE,
+                       partial ? TraceKind::PartialHit : TraceKind::Miss);
+            return false;
+        }
+        metrics.add(Metrics::Hits);
+        metrics.add(Metrics::BytesServed, result.length);
+        metrics.record(Metrics::HitLatency, start);
+        uint64_t file_size = result.chunks.front()->file_size;
+        trace_read(normalized, offset, size, file_size, TraceKind::Hit);
+        read_ahead(normalized, (offset + result.length - 1) / chunk_size, file_size);
+        return true;
+    }
+    
+    // Answer a read that read_cache would miss from disk. The uncached chunks
+    // covering it are read straight into new chunk buffers, one preadv per
+    // run of them, then cached and returned, so their bytes cross from disk
+    // once. `fd` is the caller's open handle, or -1 to use the fd table or
+    // open the file. Reads through a handle are read ahead only once they
+    // form a stream. An empty result means EOF; false with errno set on error.
+    bool read_through(const std::string& filepath, size_t size, size_t offset, int fd, CacheRead& result) {
+        Metrics& metrics = cache->get_metrics();
+        uint64_t start = Metrics::now_ns();
+        std::string normalized = normalize_path(filepath);
+        int handle = fd;
+        bool partial;
+        size_t accessed;
+        TraceKind outcome = TraceKind::Hit;
+        if (read_cached(normalized, size, offset, result, false, partial, accessed)) {
+            metrics.add(Metrics::Hits);
+            metrics.record(Metrics::HitLatency, start);
+        } else {
+            FdTable::FileRef shared;
+            int opened = -1;
+            if (fd < 0 && (shared = files->find(normalized))) {
+                fd = shared->fd;
+            } else if (fd < 0) {
+                opened = openat(get_root_fd(), normalized.c_str(), O_RDONLY | O_CLOEXEC);
+                if (opened < 0) return false;
+                fd = opened;
+            }
+            partial = false;
+            bool ok = fill_range(normalized, fd, size, offset, result, partial, false, accessed);
+            int error = errno;
+            if (opened >= 0) close(opened);
+            errno = error;
+            if (!ok) return false;
+            metrics.add(partial ? Metrics::PartialHits : Metrics::Misses);
+            metrics.record(Metrics::FillLatency, start);
+            outcome = partial ? TraceKind::PartialHit : TraceKind::Miss;
+        }
+        if (result.length == 0) {
+            trace_read(normalized, offset, size, TraceRecord::UNKNOWN_SIZE, outcome);
+            return true;
+        }
+        metrics.add(Metrics::BytesServed, result.length);
+        uint64_t file_size = result.chunks.front()->file_size;
+        trace_read(normalized, offset, size, file_size, outcome);
+        if (handle >= 0) {
+            stream_ahead(normalized, handle, offset, result.length, file_size);
+        } else {
+            read_ahead(normalized, (offset + result.length - 1) / chunk_size, file_size);
+        }
+        return true;
+    }
+    
+    // Share open handle `fh` of `filepath` with the prefetcher and the miss
+    // path; detach it on release
+    void attach(uint64_t fh, const std::string& filepath, int fd) {
+        files->attach(fh, normalize_path(filepath), fd);
+        streams.forget(fh);
+    }
+    
+    void detach(uint64_t fh) {
+        files->detach(fh);
+        streams.forget(fh);
+    }
+    
+    // Share chunks with the nodes at `addresses`, listening at `address`
+    // for their requests; see PeerTier. False with errno set if the port
+    // cannot be bound.
+    bool join_peers(const std::string& address, const std::vector<std::string>& addresses, int timeout_ms) {
+        return peers->join(address, addresses, timeout_ms, chunk_size,
+                           [this](const std::string& path, uint64_t index, uint64_t file_size, int64_t mtime,
+                                  CacheData& data) { return serve_peer(path, index, file_size, mtime, data); });
+    }
+    
+    void leave_peers() {
+        peers->leave();
+    }
+    
+    // A peer's request for chunk `index` of normalized `path`, from the cache
+    // if it holds the version the peer sees, else read from disk into the
+    // cache. Never asks other peers back. Returns 0 or an errno.
+    int serve_peer(const std::string& path, uint64_t index, uint64_t file_size, int64_t mtime, CacheData& data) {
+        // Requests come from the network; keep them inside the root
+        if (path.empty() || path[0] == '/' || path.find('\0') != std::string::npos) return EACCES;
+        for (size_t at = 0; at <= path.size();) {
+            size_t next = std::min(path.find('/', at), path.size());
+            if (path.compare(at, next - at, "..") == 0) return EACCES;
+            at = next + 1;
+        }
+        if (index > UINT64_MAX / chunk_size) return EINVAL;
+        if (get_root_fd() == AT_FDCWD) return ENOENT;  // No root yet
+        
+        // Resolved even for a cached chunk, which a local read may have cached
+        // through a symlink; not through the fd table, whose opens follow them
+        int fd = open_beneath(get_root_fd(), path);
+        if (fd < 0) return errno;
+        data = cache->peek({path, index});
+        if (!data || data->file_size != file_size || data->mtime_ns != mtime) {
+            CacheRead result;
+            bool partial = false;
+            errno = 0;
+            bool ok = fill_range(path, fd, 1, index * chunk_size, result, partial, true);
+            int error = errno;
+            close(fd);
+            if (!ok) return error != 0 ? error : EIO;
+            if (result.chunks.empty()) return ENODATA;  // Past EOF
+            data = std::move(result.chunks.front());
+        } else {
+            close(fd);
+        }
+        cache->get_metrics().add(Metrics::PeerServed);
+        return 0;
+    }
+    
+    // Record every read_cache and read_through to a trace at `filepath`,
+    // replacing the trace in progress, if any. False with errno set if the
+    // file cannot be created.
+    bool start_trace(const std::string& filepath) {
+        std::unique_ptr<TraceWriter> writer = TraceWriter::create(filepath, chunk_size);
+        if (!writer) return false;
+        std::unique_ptr<TraceWriter> previous;
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        previous = std::move(trace);
+        trace = std::move(writer);
+        tracing = true;
+        return true;
+    }
+    
+    // Finish the trace in progress; returns the number of reads it recorded
+    uint64_t stop_trace() {
+        std::unique_ptr<TraceWriter> finished;
+        {
+            std::lock_guard<std::mutex> lock(trace_mutex);
+            tracing = false;
+            finished = std::move(trace);
+        }
+        return finished ? finished->get_reads() : 0;
+    }
+    
+    // Totals for stats(). Only the chunk count takes the shard locks, one at a time.
+    CacheStats stats() {
+        CacheStats result;
+        result.metrics = cache->get_metrics().snapshot();
+        result.memory_bytes = cache->get_current_size();
+        result.memory_limit = memory_limit;
+        result.mapped_bytes = allocator->get_mapped_bytes();
+        result.chunks = cache->get_chunk_count();
+        std::tie(result.queued, result.in_flight) = reader->get_queue_depth();
+        const PrefetchStats& prefetch = *cache->get_prefetch_stats();
+        for (const auto& source : prefetch.sources) {
+            result.prefetch_issued += source.issued.load(std::memory_order_relaxed);
+            result.prefetch_used += source.hits.load(std::memory_order_relaxed);
+            result.prefetch_wasted += source.wasted.load(std::memory_order_relaxed);
+        }
+        result.prefetch_unread_bytes = prefetch.outstanding_bytes.load(std::memory_order_relaxed);
+        std::tie(result.metadata_hits, result.metadata_misses) = metadata->get_counts();
+        std::lock_guard<std::mutex> lock(governor_mutex);
+        if (governor) result.memory_pressure = governor->get_stall();
+        return result;
+    }
+    
+    // Prometheus text exposition format 0.0.4. Histogram buckets are every
+    // other power of two of nanoseconds, which are HDR bucket boundaries.
+    void write_prometheus(std::ostream& os) {
+        os.precision(10);  // Enough for the bucket bounds to print exactly
+        CacheStats totals = stats();
+        const auto& counters = totals.metrics.counters;
+        auto metric = [&](const std::string& name, const char* type, const char* help) {
+            os << "# HELP fcache_" << name << " " << help << "\n# TYPE fcache_" << name << " " << type << "\n";
+        };
+        
+        metric("reads_total", "counter", "Reads by how much of their range was cached.");
+        os << "fcache_reads_total{result=\"hit\"} " << counters[Metrics::Hits] << "\n"
+           << "fcache_reads_total{result=\"partial\"} " << counters[Metrics::PartialHits] << "\n"
+           << "fcache_reads_total{result=\"miss\"} " << counters[Metrics::Misses] << "\n";
+        metric("served_bytes_total", "counter", "Bytes returned by reads.");
+        os << "fcache_served_bytes_total " << counters[Metrics::BytesServed] << "\n";
+        metric("disk_read_bytes_total", "counter", "Bytes read from disk by misses and prefetches.");
+        os << "fcache_disk_read_bytes_total " << counters[Metrics::BytesRead] << "\n";
+        metric("evictions_total", "counter", "Chunks evicted from memory.");
+        os << "fcache_evictions_total " << counters[Metrics::Evictions] << "\n";
+        metric("peer_fetches_total", "counter", "Missing chunks asked from the peers owning them.");
+        os << "fcache_peer_fetches_total{result=\"hit\"} " << counters[Metrics::PeerHits] << "\n"
+           << "fcache_peer_fetches_total{result=\"miss\"} " << counters[Metrics::PeerMisses] << "\n";
+        metric("peer_served_total", "counter", "Chunks sent to peers.");
+        os << "fcache_peer_served_total " << counters[Metrics::PeerServed] << "\n";
+        metric("memory_bytes", "gauge", "Bytes held by cached chunks, including the compressed tier.");
+        os << "fcache_memory_bytes " << totals.memory_bytes << "\n";
+        metric("memory_limit_bytes", "gauge", "Current memory limit.");
+        os << "fcache_memory_limit_bytes " << totals.memory_limit << "\n";
+        metric("mapped_bytes", "gauge", "Bytes of slab memory mapped.");
+        os << "fcache_mapped_bytes " << totals.mapped_bytes << "\n";
+        metric("memory_pressure", "gauge", "Share of time tasks stalled on memory, while the limit follows it.");
+        os << "fcache_memory_pressure " << totals.memory_pressure << "\n";
+        metric("chunks", "gauge", "Chunks in memory.");
+        os << "fcache_chunks " << totals.chunks << "\n";
+        metric("queue_depth", "gauge", "Chunks waiting for the prefetcher.");
+        os << "fcache_queue_depth " << totals.queued << "\n";
+        metric("in_flight", "gauge", "Chunks being read by the prefetcher.");
+        os << "fcache_in_flight " << totals.in_flight << "\n";
+        metric("prefetch_unread_bytes", "gauge", "Bytes of prefetched chunks not read yet.");
+        os << "fcache_prefetch_unread_bytes " << totals.prefetch_unread_bytes << "\n";
+        metric("metadata_lookups_total", "counter", "Stat and listing lookups in the metadata cache.");
+        os << "fcache_metadata_lookups_total{result=\"hit\"} " << totals.metadata_hits << "\n"
+           << "fcache_metadata_lookups_total{result=\"miss\"} " << totals.metadata_misses << "\n";
+        
+        // Grouped by metric, as the format wants each metric's samples together
+        std::ostringstream issued, used, wasted, accuracy;
+        prefetch_control->for_each_source(
+            [&](const std::string& name, uint64_t n_issued, uint64_t hits, uint64_t n_wasted, double value) {
+                std::string label = "{source=\"" + prometheus_label(name) + "\"} ";
+                issued << "fcache_prefetch_issued_total" << label << n_issued << "\n";
+                used << "fcache_prefetch_used_total" << label << hits << "\n";
+                wasted << "fcache_prefetch_wasted_total" << label << n_wasted << "\n";
+                accuracy << "fcache_prefetch_accuracy" << label << value << "\n";
+            });
+        metric("prefetch_issued_total", "counter", "Prefetched chunks cached, by source.");
+        os << issued.str();
+        metric("prefetch_used_total", "counter", "Prefetched chunks read before eviction, by source.");
+        os << used.str();
+        metric("prefetch_wasted_total", "counter", "Prefetched chunks evicted unread, by source.");
+        os << wasted.str();
+        metric("prefetch_accuracy", "gauge", "Smoothed share of prefetched chunks read, by source.");
+        os << accuracy.str();
+        
+        const char* help[Metrics::NUM_LATENCIES] = {"Latency of reads served from memory.",
+                                                    "Latency of reads that went to disk.",
+                                                    "Latency of prefetcher chunk reads."};
+        for (size_t l = 0; l < Metrics::NUM_LATENCIES; ++l) {
+            const Metrics::Histogram& histogram = totals.metrics.latencies[l];
+            std::string name = std::string(Metrics::latency_name(l)) + "_seconds";
+            metric(name, "histogram", help[l]);
+            for (unsigned exponent = 8; exponent <= Metrics::MAX_EXPONENT; exponent += 2) {
+                uint64_t limit = uint64_t(1) << exponent;
+                os << "fcache_" << name << "_bucket{le=\"" << limit / 1e9 << "\"} "
+                   << histogram.count_below(limit) << "\n";
+            }
+            os << "fcache_" << name << "_bucket{le=\"+Inf\"} " << histogram.count << "\n"
+               << "fcache_" << name << "_sum " << histogram.sum_ns / 1e9 << "\n"
+               << "fcache_" << name << "_count " << histogram.count << "\n";
+        }
+    }
+    
+    // Summary only; nothing here walks the cached chunks or the queue
+    void cache_status() {
+        CacheStats totals = stats();
+        const auto& counters = totals.metrics.counters;
+        double mb = 1024.0 * 1024.0;
+        std::cout << "Cache: " << totals.memory_bytes / mb << " MB of " << totals.memory_limit / mb << " MB ("
+                  << totals.mapped_bytes / mb << " MB mapped) | Chunks: " << totals.chunks << " | Queue: "
+                  << totals.queued << " queued, " << totals.in_flight << " in flight" << std::endl;
+        std::cout << "Reads: " << counters[Metrics::Hits] << " hits, " << counters[Metrics::PartialHits]
+                  << " partial, " << counters[Metrics::Misses] << " misses | Served: "
+                  << counters[Metrics::BytesServed] / mb << " MB | Read from disk: "
+                  << counters[Metrics::BytesRead] / mb << " MB | Evictions: " << counters[Metrics::Evictions]
+                  << std::endl;
+        std::cout << "Latency p50/p99 (us):";
+        for (size_t l = 0; l < Metrics::NUM_LATENCIES; ++l) {
+            const Metrics::Histogram& histogram = totals.metrics.latencies[l];
+            std::cout << (l > 0 ? " |" : "") << " " << Metrics::latency_name(l) << " "
+                      << histogram.quantile(0.5) / 1e3 << "/" << histogram.quantile(0.99) / 1e3;
+        }
+        std::cout << std::endl;
+        cache->status(std::cout);
+        metadata->status(std::cout);
+        std::cout << "Shared descriptors: " << files->size() << std::endl;
+        streams.status(std::cout);
+        std::cout << "Accesses dropped: " << accesses.get_dropped() << std::endl;
+        prefetch_control->status(std::cout);
+        if (peers->is_enabled()) {
+            std::cout << "Peer fetches: " << counters[Metrics::PeerHits] << " hits, "
+                      << counters[Metrics::PeerMisses] << " misses | Served to peers: "
+                      << counters[Metrics::PeerServed] << std::endl;
+            peers->status(std::cout);
+        }
+        std::lock_guard<std::mutex> lock(governor_mutex);
+        if (governor) governor->status(std::cout);
+    }
+    
+    // Resize the cache, to at least one chunk per shard. A shrink evicts
+    // down to the new limit, in small batches, before returning.
+    void set_memory_limit(size_t limit) {
+        std::lock_guard<std::mutex> lock(limit_mutex);
+        size_t block = (chunk_size + 4095) / 4096 * 4096;
+        limit = std::max(limit, block * cache->get_shard_count());
+        memory_limit = limit;
+        prefetch_control->set_budget(limit / 2);
+        cache->set_max_size(limit);
+    }
+    
+    // Let memory pressure drive the limit within [min_limit, max_limit], and
+    // return freed slab memory to the kernel meanwhile; a max_limit of 0
+    // stops. `cgroup` is a cgroup v2 directory, or empty for our own. False
+    // with errno set if no PSI source is readable; `source` names the file
+    // being watched.
+    bool watch_memory_pressure(size_t min_limit, size_t max_limit, const std::string& cgroup, int interval_ms,
+                               std::string& source) {
+        std::lock_guard<std::mutex> lock(governor_mutex);
+        governor.reset();
+        allocator->set_release_freed(false);
+        if (max_limit == 0) {
+            return true;
+        }
+        auto next = std::make_unique<MemoryGovernor>(min_limit, max_limit, interval_ms);
+        if (!next->open(cgroup)) {
+            return false;
+        }
+        source = next->source();
+        allocator->set_release_freed(true);
+        next->start({[this] { return memory_limit.load(); }, [this] { return cache->get_current_size(); },
+                     [this](size_t limit) { set_memory_limit(limit); }});
+        governor = std::move(next);
+        return true;
+    }
+    
+    void set_root(const std::string& root) {
+        reader->set_root(root);
+        int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "Cannot open root " << root << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+        int old = root_fd.exchange(fd);
+        if (old >= 0) close(old);
+    }
+    
+    // Coherence hooks for a filesystem that modifies files under the root.
+    // Each bumps the cache generation, so disk reads already in flight are
+    // dropped rather than caching the old contents.
+    
+    // Forget everything cached for `filepath`, or under it for a directory.
+    // A regular file's size before the change, if the caller knows it,
+    // saves scanning the whole cache for its chunks.
+    void invalidate(const std::string& filepath, uint64_t file_size = FileCache::UNKNOWN_SIZE) {
+        std::string normalized = normalize_path(filepath);
+        bool subtree = file_size == FileCache::UNKNOWN_SIZE && metadata->maybe_directory(normalized);
+        metadata->forget(normalized, subtree);
+        // The name may now be another file; handles reopen to share again
+        files->erase_path(normalized);
+        reader->cancel(normalized);
+        cache->invalidate(normalized, file_size);
+    }
+    
+    // Truncate `filepath` to `length` through `fd`, or by name if it is -1,
+    // and drop its cached chunks. The filesystem's size changes go through
+    // here: in map mode a chunk mapping past the new EOF raises SIGBUS when
+    // read, so mapping the file stops and the chunks already mapped are
+    // waited for first. Returns 0 or an errno, EBUSY if they are still held
+    // after RESIZE_WAIT_MS.
+    int truncate(const std::string& filepath, int fd, uint64_t length) {
+        std::string normalized = normalize_path(filepath);
+        int opened = -1;
+        if (fd < 0) {
+            opened = fd = openat(get_root_fd(), normalized.c_str(), O_WRONLY | O_CLOEXEC);
+            if (fd < 0) return errno;
+        }
+        struct stat st;
+        bool known = fstat(fd, &st) == 0;
+        bool resizing = map_files && known;
+        uint64_t file_size = known ? std::max<uint64_t>(st.st_size, length) : FileCache::UNKNOWN_SIZE;
+        int error = 0;
+        if (resizing) {
+            // Unmapped from here on; drop what the cache holds, then wait for the readers
+            mapped->begin_resize(st);
+            invalidate(normalized, file_size);
+            if (!mapped->wait_unmapped(st, RESIZE_WAIT_MS)) error = EBUSY;
+        }
+        if (error == 0 && ftruncate(fd, length) != 0) error = errno;
+        invalidate(normalized, file_size);
+        if (resizing) mapped->end_resize(st);
+        if (opened >= 0) close(opened);
+        return error;
+    }
+    
+    // Move cached chunks to the file's (or directory's) new name. Call once
+    // the rename is done. `replaced_size` is the size of the file it
+    // replaced, 0 if it replaced nothing, which saves scanning the whole
+    // cache for that file's chunks.
+    void rename_path(const std::string& from, const std::string& to,
+                     uint64_t replaced_size = FileCache::UNKNOWN_SIZE) {
+        std::string old_path = normalize_path(from);
+        std::string new_path = normalize_path(to);
+        metadata->forget(old_path, true);
+        metadata->forget(new_path, true);
+        files->rename(old_path, new_path);
+        reader->cancel(old_path);
+        reader->cancel(new_path);
+        struct stat st;
+        bool file = fstatat(get_root_fd(), new_path.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode);
+        cache->rename(old_path, new_path, file ? (uint64_t)st.st_size : FileCache::UNKNOWN_SIZE, replaced_size);
+    }
+    
+    // Update the cache after `length` bytes were written at `offset`. Call
+    // once the write has reached the file, so its new size and mtime are
+    // known. `before`, the file's stat from just before the write, lets the
+    // chunks the write left alone stay cached.
+    void write_through(const std::string& filepath, uint64_t offset, const char* data, size_t length,
+                       const struct stat* before = nullptr) {
+        std::string normalized = normalize_path(filepath);
+        struct stat st;
+        if (!file_stat(normalized, st, true)) {
+            cache->invalidate(normalized);
+            return;
+        }
+        cache->write_through(normalized, offset, data, length, st.st_size, mtime_ns(st.st_mtim),
+                             before ? (uint64_t)before->st_size : FileCache::UNKNOWN_SIZE,
+                             before ? mtime_ns(before->st_mtim) : 0);
+    }
+    
+    // Drop cached metadata of `filepath` and its parent's listing, for
+    // changes that leave file contents alone (create, mkdir, chmod, ...)
+    void invalidate_metadata(const std::string& filepath) {
+        metadata->forget(normalize_path(filepath), false);
+    }
+    
+    // lstat relative to the root through the metadata cache, or straight
+    // from disk with `refresh`; false with errno set on failure. ENOENT
+    // results are cached as well.
+    bool stat_path(const std::string& normalized, struct stat& st, bool refresh = false) {
+        int error = 0;
+        if (!refresh && metadata->get_stat(normalized, st, error)) {
+            errno = error;
+            return error == 0;
+        }
+        if (fstatat(get_root_fd(), normalized.empty() ? "." : normalized.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            error = errno;
+            if (error == ENOENT) metadata->put_stat(normalized, nullptr, error);
+            errno = error;
+            return false;
+        }
+        metadata->put_stat(normalized, &st, 0);
+        return true;
+    }
+    
+    // Entry names of a directory, without "." and "..", through the metadata
+    // cache; false with errno set on failure
+    bool list_directory(const std::string& normalized, std::shared_ptr<const std::vector<std::string>>& names) {
+        int error = 0;
+        if (metadata->get_dir(normalized, names, error)) {
+            errno = error;
+            return error == 0;
+        }
+        int fd = openat(get_root_fd(), normalized.empty() ? "." : normalized.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR* dir = fd < 0 ? nullptr : fdopendir(fd);
+        if (dir == nullptr) {
+            error = errno;
+            if (fd >= 0) close(fd);
+            if (error == ENOENT) metadata->put_dir(normalized, nullptr, error);
+            errno = error;
+            return false;
+        }
+        auto entries = std::make_shared<std::vector<std::string>>();
+        while (struct dirent* entry = readdir(dir)) {
+            if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0) {
+                entries->push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        names = std::move(entries);
+        metadata->put_dir(normalized, names, 0);
+        return true;
+    }
+    
+    // PathLocality reading the tree through this manager's metadata cache.
+    // It interns candidate paths, which the predictor mutex it runs under
+    // already guards.
+    std::unique_ptr<NativePredictor> make_locality_predictor(size_t max_states) {
+        return std::make_unique<PathLocality>(
+            interner, [this](const std::string& path, struct stat& st) { return stat_path(path, st); },
+            [this](const std::string& path, std::shared_ptr<const std::vector<std::string>>& names) {
+                return list_directory(path, names);
+            },
+            max_states);
+    }
+    
+    void configure_predictor(std::unique_ptr<NativePredictor> next, const std::string& name,
+                             float confidence) {
+        uint8_t source = prefetch_control->register_source(name);
+        std::lock_guard<std::mutex> lock(predictor_mutex);
+        predictor = std::move(next);
+        history = ReadHistory();
+        predictor_source = source;
+        min_confidence = confidence;
+    }
+    
+    // Log a read, predict what follows it and queue those files for
+    // prefetch, best guess last so it is read first. Consecutive reads of
+    // the same file are logged once. When prefetching, the controller picks
+    // how many of num_predictions to make and guesses below min_confidence
+    // are dropped. Returns false if no predictor is set.
+    bool log_read(const std::string& filepath, size_t num_predictions, bool prefetch,
+                  std::vector<std::string>& predictions) {
+        std::string normalized = normalize_path(filepath);
+        std::vector<Prediction> predicted;
+        uint8_t source;
+        {
+            std::lock_guard<std::mutex> lock(predictor_mutex);
+            if (!predictor) return false;
+            import_snapshot();
+            source = predictor_source;
+            uint32_t id = interner.intern(normalized);
+            if (history.size() == 0 || history.back(0) != id) {
+                history.push(id);
+                predictor->log(history);
+            }
+            size_t depth = prefetch ? prefetch_control->depth(source, num_predictions) : num_predictions;
+            if (depth > 0) {
+                std::vector<uint32_t> context;
+                for (size_t i = history.size(); i-- > 0;) context.push_back(history.back(i));
+                predictor->predict(std::move(context), depth, predicted);
+            }
+            for (const Prediction& next : predicted) {
+                if (prefetch && next.confidence < min_confidence) break;
+                predictions.push_back(interner.path(next.id));
+            }
+        }
+        if (prefetch) {
+            for (auto it = predictions.rbegin(); it != predictions.rend(); ++it) {
+                reader->request_chunks(*it, 0, prefetch_chunks, 0, source);
+            }
+        }
+        return true;
+    }
+    
+    // Log a batch drained from the access queue. Predictions are only made
+    // for the last read, the earlier ones would be stale by the time their
+    // prefetches were queued.
+    bool log_reads(const std::vector<std::string>& filepaths, size_t num_predictions, bool prefetch) {
+        std::vector<std::string> predictions;
+        for (size_t i = 0; i < filepaths.size(); ++i) {
+            bool last = i + 1 == filepaths.size();
+            if (!log_read(filepaths[i], last ? num_predictions : 0, last && prefetch, predictions)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // Queue a read event for the predictor thread; never blocks
+    void record_access(std::string filepath) {
+        accesses.push(std::move(filepath));
+    }
+    
+    size_t drain_accesses(std::vector<std::string>& out, size_t max_batch, int timeout_ms) {
+        return accesses.pop_batch(out, max_batch, timeout_ms);
+    }
+    
+    // Predict the files following `filepath` without logging it
+    bool predict(const std::string& filepath, size_t num_predictions, std::vector<std::string>& predictions) {
+        std::string normalized = normalize_path(filepath);
+        std::lock_guard<std::mutex> lock(predictor_mutex);
+        if (!predictor) return false;
+        import_snapshot();
+        std::vector<uint32_t> context;
+        for (size_t i = history.size(); i-- > 0;) context.push_back(history.back(i));
+        // Interned even if never read, so structural predictors can still guess
+        uint32_t id = interner.intern(normalized);
+        if (context.empty() || context.back() != id) context.push_back(id);
+        std::vector<Prediction> predicted;
+        predictor->predict(std::move(context), num_predictions, predicted);
+        for (const Prediction& next : predicted) {
+            predictions.push_back(interner.path(next.id));
+        }
+        return true;
+    }
+    
+    void predictor_status() {
+        std::lock_guard<std::mutex> lock(predictor_mutex);
+        if (!predictor) {
+            std::cout << "No native predictor configured" << std::endl;
+            return;
+        }
+        predictor->status(std::cout);
+        std::cout << ", Paths: " << interner.size();
+        if (pending_snapshot) std::cout << " (snapshot not loaded yet)";
+        std::cout << std::endl;
+    }
+    
+    // Map a snapshot and list its up to `hot_limit` hottest files for
+    // warming. The model itself is read when the predictor is first used.
+    bool load_snapshot(const std::string& filepath, size_t hot_limit, std::vector<std::string>& hot_files,
+                       std::string& error) {
+        auto snapshot = std::make_unique<SnapshotFile>();
+        if (!snapshot->open(filepath, error)) {
+            return false;
+        }
+        for (size_t i = 0; i < std::min(hot_limit, snapshot->hot_count()); ++i) {
+            hot_files.emplace_back(snapshot->path(snapshot->hot()[i].path));
+        }
+        std::lock_guard<std::mutex> lock(predictor_mutex);
+        if (snapshot->predictor_kind() != PredictorKind::None) {
+            pending_snapshot = std::move(snapshot);
+        }
+        return true;
+    }
+    
+    // Save the native model and the `hot_limit` hottest cached files. A model
+    // that was loaded but never used is carried over unchanged.
+    bool save_snapshot(const std::string& filepath, size_t hot_limit, std::string& error) {
+        PredictorKind kind = PredictorKind::None;
+        std::vector<std::string> paths;
+        std::vector<SnapshotState> states;
+        {
+            std::lock_guard<std::mutex> lock(predictor_mutex);
+            import_snapshot();
+            if (pending_snapshot) {
+                kind = pending_snapshot->predictor_kind();
+                for (size_t i = 0; i < pending_snapshot->path_count(); ++i) {
+                    paths.emplace_back(pending_snapshot->path(i));
+                }
+                states.assign(pending_snapshot->states(),
+                              pending_snapshot->states() + pending_snapshot->state_count());
+            } else if (predictor) {
+                kind = predictor->kind();
+                for (size_t i = 0; i < interner.size(); ++i) {
+                    paths.push_back(interner.path(i));
+                }
+                predictor->save(states);
+            }
+        }
+        
+        // Hot files that the model never saw get ids after the model's paths
+        std::unordered_map<std::string, uint32_t> ids;
+        for (size_t i = 0; i < paths.size(); ++i) ids.emplace(paths[i], i);
+        std::vector<SnapshotHot> hot;
+        for (auto& [path, score] : cache->get_hot_files(hot_limit)) {
+            auto it = ids.try_emplace(path, (uint32_t)paths.size()).first;
+            if (it->second == paths.size()) paths.push_back(path);
+            hot.push_back({it->second, 0, score});
+        }
+        return write_snapshot(filepath, kind, paths, hot, states, error);
+    }
+    
+    bool wait_idle(int timeout_ms) {
+        return reader->wait_idle(timeout_ms);
+    }
+};
+
+#ifdef FCACHE_FUSE
+// Native FUSE frontend: serves a mount through libfuse's low-level API
+// with the cache in-process, so reads never enter the interpreter. Inodes
+// map to paths relative to the cache root and every operation is an *at()
+// call on the root directory fd. Reads are still queued on the access
+// queue, where the Python predictor thread picks them up.
+class FuseFrontend {
+private:
+    struct Node {
+        std::string path;  // Relative to the root, "" for the root itself
+        uint64_t lookups;  // Kernel references; the node is dropped when they are forgotten
+    };
+    
+    struct DirHandle {
+        DIR* dir;
+        off_t offset;
+        struct dirent* entry;  // Read but did not fit in the last reply
+    };
+    
+    static constexpr double TIMEOUT = 1.0;  // Entry and attribute cache seconds, as with fusepy
+    
+    FileCacheManagerImpl& manager;
+    int root_fd;
+    std::unordered_map<fuse_ino_t, Node> nodes;
+    std::unordered_map<std::string, fuse_ino_t> inodes;  // Inode currently linked at each path
+    fuse_ino_t next_ino = FUSE_ROOT_ID + 1;
+    std::shared_mutex nodes_mutex;
+    
+    static FuseFrontend& self(fuse_req_t req) {
+        return *static_cast<FuseFrontend*>(fuse_req_userdata(req));
+    }
+    
+    static const char* at_path(const std::string& path) {
+        return path.empty() ? "." : path.c_str();
+    }
+    
+    bool lookup_path(fuse_ino_t ino, std::string& path) {
+        std::shared_lock<std::shared_mutex> lock(nodes_mutex);
+        auto it = nodes.find(ino);
+        if (it == nodes.end()) return false;
+        path = it->second.path;
+        return true;
+    }
+    
+    // Path of `ino`; replies ENOENT and returns false for an unknown inode
+    bool path_of(fuse_req_t req, fuse_ino_t ino, std::string& path) {
+        if (lookup_path(ino, path)) return true;
+        fuse_reply_err(req, ENOENT);
+        return false;
+    }
+    
+    bool child_path(fuse_req_t req, fuse_ino_t parent, const char* name, std::string& path) {
+        if (!path_of(req, parent, path)) return false;
+        if (!path.empty()) path += '/';
+        path += name;
+        return true;
+    }
+    
+    // Size of the regular file at `path`, 0 if there is nothing there, for
+    // the manager to bound the chunks it drops; UNKNOWN_SIZE otherwise
+    uint64_t file_size(const std::string& path) {
+        struct stat st;
+        if (fstatat(root_fd, path.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            return errno == ENOENT ? 0 : FileCache::UNKNOWN_SIZE;
+        }
+        return S_ISREG(st.st_mode) ? (uint64_t)st.st_size : FileCache::UNKNOWN_SIZE;
+    }
+    
+    // Inode for `path`, counting one more kernel lookup
+    fuse_ino_t remember(const std::string& path) {
+        std::unique_lock<std::shared_mutex> lock(nodes_mutex);
+        auto [it, added] = inodes.try_emplace(path, next_ino);
+        if (added) {
+            nodes.emplace(next_ino++, Node{path, 0});
+        }
+        ++nodes[it->second].lookups;
+        return it->second;
+    }
+    
+    void forget(fuse_ino_t ino, uint64_t count) {
+        std::unique_lock<std::shared_mutex> lock(nodes_mutex);
+        auto it = nodes.find(ino);
+        if (it == nodes.end() || ino == FUSE_ROOT_ID) return;
+        if (it->second.lookups > count) {
+            it->second.lookups -= count;
+            return;
+        }
+        auto linked = inodes.find(it->second.path);
+        if (linked != inodes.end() && linked->second == ino) inodes.erase(linked);
+        nodes.erase(it);
+    }
+    
+    // A removed path gets a fresh inode if it is created again; the old one
+    // lives on until the kernel forgets it
+    void unlink_node(const std::string& path) {
+        std::unique_lock<std::shared_mutex> lock(nodes_mutex);
+        inodes.erase(path);
+    }
+    
+    // Re-point inodes under `from` to `to`, and the other way round for an exchange
+    void rename_nodes(const std::string& from, const std::string& to, bool exchange) {
+        std::unique_lock<std::shared_mutex> lock(nodes_mutex);
+        std::vector<std::pair<std::string, fuse_ino_t>> moved;
+        for (auto it = inodes.begin(); it != inodes.end();) {
+            if (under_path(it->first, from)) {
+                moved.emplace_back(to + it->first.substr(from.size()), it->second);
+            } else if (under_path(it->first, to)) {
+                // Replaced by the rename unless the two are swapped
+                if (exchange) moved.emplace_back(from + it->first.substr(to.size()), it->second);
+            } else {
+                ++it;
+                continue;
+            }
+            it = inodes.erase(it);
+        }
+        for (auto& [path, ino] : moved) {
+            nodes[ino].path = path;
+            inodes[path] = ino;
+        }
+    }
+    
+    // With `negative`, a missing path is answered with inode 0, which the
+    // kernel caches as a negative entry for entry_timeout
+    void reply_entry(fuse_req_t req, const std::string& path, bool negative = false) {
+        fuse_entry_param e{};
+        if (!manager.stat_path(path, e.attr)) {
+            if (negative && errno == ENOENT) {
+                e.entry_timeout = TIMEOUT;
+                fuse_reply_entry(req, &e);
+            } else {
+                fuse_reply_err(req, errno);
+            }
+            return;
+        }
+        e.ino = remember(path);
+        e.attr_timeout = TIMEOUT;
+        e.entry_timeout = TIMEOUT;
+        if (fuse_reply_entry(req, &e) != 0) forget(e.ino, 1);
+    }
+    
+    static void reply_result(fuse_req_t req, int res) {
+        fuse_reply_err(req, res == -1 ? errno : 0);
+    }
+    
+    // The O_TRUNC of an open, done after opening without it. A read-only
+    // descriptor cannot truncate, so the manager then opens the file itself.
+    static int truncate_opened(FuseFrontend& fs, const std::string& path, int fd, int flags) {
+        if (!(flags & O_TRUNC)) return 0;
+        return fs.manager.truncate(path, (flags & O_ACCMODE) == O_RDONLY ? -1 : fd, 0);
+    }
+    
+    static void op_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (fs.child_path(req, parent, name, path)) fs.reply_entry(req, path, true);
+    }
+    
+    static void op_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
+        self(req).forget(ino, nlookup);
+        fuse_reply_none(req);
+    }
+    
+    static void op_forget_multi(fuse_req_t req, size_t count, fuse_forget_data* forgets) {
+        for (size_t i = 0; i < count; ++i) {
+            self(req).forget(forgets[i].ino, forgets[i].nlookup);
+        }
+        fuse_reply_none(req);
+    }
+    
+    static void op_getattr(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.path_of(req, ino, path)) return;
+        struct stat st;
+        if (!fs.manager.stat_path(path, st)) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        fuse_reply_attr(req, &st, TIMEOUT);
+    }
+    
+    static void op_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set, fuse_file_info* fi) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.path_of(req, ino, path)) return;
+        const char* p = at_path(path);
+        int res = 0;
+        if (to_set & FUSE_SET_ATTR_MODE) {
+            res = fchmodat(fs.root_fd, p, attr->st_mode, 0);
+        }
+        if (res == 0 && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))) {
+            uid_t uid = (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t)-1;
+            gid_t gid = (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t)-1;
+            res = fchownat(fs.root_fd, p, uid, gid, AT_SYMLINK_NOFOLLOW);
+        }
+        if (res == 0 && (to_set & FUSE_SET_ATTR_SIZE)) {
+            int error = fs.manager.truncate(path, fi ? (int)fi->fh : -1, attr->st_size);
+            if (error != 0) {
+                errno = error;
+                res = -1;
+            }
+        }
+        if (res == 0 && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+            struct timespec times[2] = {{0, UTIME_OMIT}, {0, UTIME_OMIT}};
+            if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+                times[0].tv_nsec = UTIME_NOW;
+            } else if (to_set & FUSE_SET_ATTR_ATIME) {
+                times[0] = attr->st_atim;
+            }
+            if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+                times[1].tv_nsec = UTIME_NOW;
+            } else if (to_set & FUSE_SET_ATTR_MTIME) {
+                times[1] = attr->st_mtim;
+            }
+            res = utimensat(fs.root_fd, p, times, AT_SYMLINK_NOFOLLOW);
+        }
+        fs.manager.invalidate_metadata(path);
+        if (res != 0) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        op_getattr(req, ino, fi);
+    }
+    
+    static void op_readlink(fuse_req_t req, fuse_ino_t ino) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.path_of(req, ino, path)) return;
+        char target[PATH_MAX + 1];
+        ssize_t n = readlinkat(fs.root_fd, at_path(path), target, PATH_MAX);
+        if (n < 0) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        target[n] = '\0';
+        fuse_reply_readlink(req, target);
+    }
+    
+    static void op_mknod(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode, dev_t rdev) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.child_path(req, parent, name, path)) return;
+        if (mknodat(fs.root_fd, path.c_str(), mode, rdev) != 0) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        fs.manager.invalidate_metadata(path);
+        fs.reply_entry(req, path);
+    }
+    
+    static void op_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.child_path(req, parent, name, path)) return;
+        if (mkdirat(fs.root_fd, path.c_str(), mode) != 0) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        fs.manager.invalidate_metadata(path);
+        fs.reply_entry(req, path);
+    }
+    
+    static void op_symlink(fuse_req_t req, const char* link, fuse_ino_t parent, const char* name) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.child_path(req, parent, name, path)) return;
+        if (symlinkat(link, fs.root_fd, path.c_str()) != 0) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        fs.manager.invalidate_metadata(path);
+        fs.reply_entry(req, path);
+    }
+    
+    static void op_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char* newname) {
+        FuseFrontend& fs = self(req);
+        std::string path, new_path;
+        if (!fs.path_of(req, ino, path) || !fs.child_path(req, newparent, newname, new_path)) return;
+        if (linkat(fs.root_fd, at_path(path), fs.root_fd, new_path.c_str(), 0) != 0) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        fs.manager.invalidate_metadata(path);  // Link count changed
+        fs.manager.invalidate_metadata(new_path);
+        fs.reply_entry(req, new_path);
+    }
+    
+    static void remove(fuse_req_t req, fuse_ino_t parent, const char* name, int flags) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.child_path(req, parent, name, path)) return;
+        uint64_t size = fs.file_size(path);
+        int res = unlinkat(fs.root_fd, path.c_str(), flags);
+        if (res == 0) {
+            fs.manager.invalidate(path, size);
+            fs.unlink_node(path);
+        }
+        reply_result(req, res);
+    }
+    
+    static void op_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) {
+        remove(req, parent, name, 0);
+    }
+    
+    static void op_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) {
+        remove(req, parent, name, AT_REMOVEDIR);
+    }
+    
+    static void op_rename(fuse_req_t req, fuse_ino_t parent, const char* name, fuse_ino_t newparent,
+                          const char* newname, unsigned int flags) {
+        FuseFrontend& fs = self(req);
+        std::string from, to;
+        if (!fs.child_path(req, parent, name, from) || !fs.child_path(req, newparent, newname, to)) return;
+        uint64_t replaced = fs.file_size(to);
+        int res = flags ? (int)syscall(SYS_renameat2, fs.root_fd, from.c_str(), fs.root_fd, to.c_str(), flags)
+                        : renameat(fs.root_fd, from.c_str(), fs.root_fd, to.c_str());
+        if (res == 0) {
+            bool exchange = flags & RENAME_EXCHANGE;
+            if (exchange) {
+                fs.manager.invalidate(from);
+                fs.manager.invalidate(to);
+            } else {
+                fs.manager.rename_path(from, to, replaced);
+            }
+            fs.rename_nodes(from, to, exchange);
+        }
+        reply_result(req, res);
+    }
+    
+    static void op_open(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.path_of(req, ino, path)) return;
+        // O_TRUNC goes through the manager, which must see the size change first
+        int fd = openat(fs.root_fd, at_path(path), (fi->flags & ~O_TRUNC) | O_CLOEXEC);
+        if (fd < 0) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        if (int error = truncate_opened(fs, path, fd, fi->flags)) {
+            close(fd);
+            fuse_reply_err(req, error);
+            return;
+        }
+        fs.manager.attach(fd, path, fd);
+        fi->fh = fd;
+        if (fuse_reply_open(req, fi) != 0) {
+            fs.manager.detach(fd);
+            close(fd);
+        }
+    }
+    
+    static void op_create(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode, fuse_file_info* fi) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.child_path(req, parent, name, path)) return;
+        int fd = openat(fs.root_fd, path.c_str(), (fi->flags & ~O_TRUNC) | O_CREAT | O_CLOEXEC, mode);
+        if (fd < 0) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        if (int error = truncate_opened(fs, path, fd, fi->flags)) {
+            close(fd);
+            fuse_reply_err(req, error);
+            return;
+        }
+        fs.manager.invalidate_metadata(path);
+        fuse_entry_param e{};
+        if (fstat(fd, &e.attr) != 0) {
+            fuse_reply_err(req, errno);
+            close(fd);
+            return;
+        }
+        e.ino = fs.remember(path);
+        e.attr_timeout = TIMEOUT;
+        e.entry_timeout = TIMEOUT;
+        fs.manager.attach(fd, path, fd);
+        fi->fh = fd;
+        if (fuse_reply_create(req, &e, fi) != 0) {
+            fs.forget(e.ino, 1);
+            fs.manager.detach(fd);
+            close(fd);
+        }
+    }
+    
+    // Replies are written to the device straight from the pinned chunks;
+    // they stay alive until the reply returns.
+    static void op_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, fuse_file_info* fi) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.path_of(req, ino, path)) return;
+        // A miss is read into the cache through the handle and answered
+        // from the new chunks, rather than spliced past the cache
+        CacheRead result;
+        bool ok = fs.manager.read_through(path, size, off, fi->fh, result);
+        fs.manager.record_access("/" + path);
+        if (!ok) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        std::vector<iovec> iov;
+        iov.reserve(result.chunks.size());
+        size_t skip = result.offset;
+        size_t remaining = result.length;
+        for (const auto& chunk : result.chunks) {
+            size_t n = std::min(remaining, chunk->bytes.size() - skip);
+            iov.push_back({const_cast<char*>(chunk->bytes.data()) + skip, n});
+            remaining -= n;
+            skip = 0;
+        }
+        fuse_reply_iov(req, iov.data(), iov.size());
+    }
+    
+    static void op_write(fuse_req_t req, fuse_ino_t ino, const char* data, size_t size, off_t off,
+                         fuse_file_info* fi) {
+        FuseFrontend& fs = self(req);
+        struct stat before;
+        bool known = fstat(fi->fh, &before) == 0;
+        ssize_t written = pwrite(fi->fh, data, size, off);
+        if (written < 0) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        std::string path;
+        if (fs.lookup_path(ino, path)) {
+            fs.manager.write_through(path, off, data, written, known ? &before : nullptr);
+        }
+        fuse_reply_write(req, written);
+    }
+    
+    static void op_flush(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) {
+        // Report close errors such as deferred write failures, without closing the handle
+        reply_result(req, close(dup(fi->fh)));
+    }
+    
+    static void op_release(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) {
+        self(req).manager.detach(fi->fh);
+        close(fi->fh);
+        fuse_reply_err(req, 0);
+    }
+    
+    static void op_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, fuse_file_info* fi) {
+        reply_result(req, datasync ? fdatasync(fi->fh) : fsync(fi->fh));
+    }
+    
+    static void op_opendir(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (!fs.path_of(req, ino, path)) return;
+        int fd = openat(fs.root_fd, at_path(path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR* dir = fd < 0 ? nullptr : fdopendir(fd);
+        if (dir == nullptr) {
+            int err = errno;
+            if (fd >= 0) close(fd);
+            fuse_reply_err(req, err);
+            return;
+        }
+        fi->fh = (uint64_t)new DirHandle{dir, 0, nullptr};
+        if (fuse_reply_open(req, fi) != 0) {
+            closedir(dir);
+            delete (DirHandle*)fi->fh;
+        }
+    }
+    
+    static void op_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, fuse_file_info* fi) {
+        DirHandle* handle = (DirHandle*)fi->fh;
+        std::vector<char> buf(size);
+        size_t used = 0;
+        if (offset != handle->offset) {
+            seekdir(handle->dir, offset);
+            handle->entry = nullptr;
+            handle->offset = offset;
+        }
+        for (;;) {
+            if (handle->entry == nullptr) {
+                errno = 0;
+                handle->entry = readdir(handle->dir);
+                if (handle->entry == nullptr) {
+                    if (errno != 0 && used == 0) {
+                        fuse_reply_err(req, errno);
+                        return;
+                    }
+                    break;
+                }
+            }
+            struct stat st{};
+            st.st_ino = handle->entry->d_ino;
+            st.st_mode = handle->entry->d_type << 12;
+            off_t next = telldir(handle->dir);
+            size_t n = fuse_add_direntry(req, buf.data() + used, size - used, handle->entry->d_name, &st, next);
+            if (n > size - used) break;  // Sent with the next call
+            used += n;
+            handle->entry = nullptr;
+            handle->offset = next;
+        }
+        fuse_reply_buf(req, buf.data(), used);
+    }
+    
+    static void op_releasedir(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) {
+        DirHandle* handle = (DirHandle*)fi->fh;
+        closedir(handle->dir);
+        delete handle;
+        fuse_reply_err(req, 0);
+    }
+    
+    static void op_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, fuse_file_info* fi) {
+        fuse_reply_err(req, 0);
+    }
+    
+    static void op_statfs(fuse_req_t req, fuse_ino_t ino) {
+        struct statvfs st;
+        if (fstatvfs(self(req).root_fd, &st) != 0) {
+            fuse_reply_err(req, errno);
+            return;
+        }
+        fuse_reply_statfs(req, &st);
+    }
+    
+    static void op_access(fuse_req_t req, fuse_ino_t ino, int mask) {
+        FuseFrontend& fs = self(req);
+        std::string path;
+        if (fs.path_of(req, ino, path)) reply_result(req, faccessat(fs.root_fd, at_path(path), mask, 0));
+    }
+    
+    static fuse_lowlevel_ops make_ops() {
+        fuse_lowlevel_ops ops{};
+        ops.lookup = op_lookup;
+        ops.forget = op_forget;
+        ops.forget_multi = op_forget_multi;
+        ops.getattr = op_getattr;
+        ops.setattr = op_setattr;
+        ops.readlink = op_readlink;
+        ops.mknod = op_mknod;
+        ops.mkdir = op_mkdir;
+        ops.symlink = op_symlink;
+        ops.link = op_link;
+        ops.unlink = op_unlink;
+        ops.rmdir = op_rmdir;
+        ops.rename = op_rename;
+        ops.open = op_open;
+        ops.create = op_create;
+        ops.read = op_read;
+        ops.write = op_write;
+        ops.flush = op_flush;
+        ops.release = op_release;
+        ops.fsync = op_fsync;
+        ops.opendir = op_opendir;
+        ops.readdir = op_readdir;
+        ops.releasedir = op_releasedir;
+        ops.fsyncdir = op_fsyncdir;
+        ops.statfs = op_statfs;
+        ops.access = op_access;
+        return ops;
+    }
+    
+public:
+    FuseFrontend(FileCacheManagerImpl& manager, int root_fd) : manager(manager), root_fd(root_fd) {
+        nodes.emplace(FUSE_ROOT_ID, Node{"", 1});
+        inodes.emplace("", FUSE_ROOT_ID);
+    }
+    
+    // Mount at `mountpoint` and serve requests on libfuse's worker threads
+    // until unmounted or interrupted. `options` are extra libfuse arguments
+    // such as {"-o", "allow_other"}.
+    bool run(const std::string& mountpoint, const std::vector<std::string>& options, std::string& error) {
+        static const fuse_lowlevel_ops ops = make_ops();
+        std::vector<std::string> arg_strings{"quark"};
+        arg_strings.insert(arg_strings.end(), options.begin(), options.end());
+        std::vector<char*> argv;
+        for (auto& arg : arg_strings) argv.push_back(arg.data());
+        fuse_args args = FUSE_ARGS_INIT((int)argv.size(), argv.data());
+        
+        fuse_session* session = fuse_session_new(&args, &ops, sizeof(ops), this);
+        fuse_opt_free_args(&args);
+        if (session == nullptr) {
+            error = "cannot create FUSE session";
+            return false;
+        }
+        bool ok = false;
+        if (fuse_set_signal_handlers(session) != 0) {
+            error = "cannot install FUSE signal handlers";
+        } else {
+            if (fuse_session_mount(session, mountpoint.c_str()) != 0) {
+                error = "cannot mount " + mountpoint;
+            } else {
+                ok = fuse_session_loop_mt(session, 0) >= 0;
+                if (!ok) error = "FUSE session failed";
+                fuse_session_unmount(session);
+            }
+            fuse_remove_signal_handlers(session);
+        }
+        fuse_session_destroy(session);
+        return ok;
+    }
+};
+#endif
+
+#ifndef FCACHE_NO_PYTHON
+// Default shard count: one per hardware thread, rounded up to a power of two
+static size_t default_shard_count() {
+    size_t n = std::max(1u, std::thread::hardware_concurrency());
+    size_t shards = 1;
+    while (shards < n) shards <<= 1;
+    return shards;
+}
+
+// Copy a CacheRead's bytes into a contiguous buffer of result.length bytes
+static void copy_cache_read(const CacheRead& result, char* dest) {
+    size_t skip = result.offset;
+    size_t remaining = result.length;
+    for (const auto& chunk : result.chunks) {
+        size_t n = std::min(remaining, chunk->bytes.size() - skip);
+        std::memcpy(dest, chunk->bytes.data() + skip, n);
+        dest += n;
+        remaining -= n;
+        skip = 0;
+    }
+}
+
+// Python module implementation
+extern "C" {
+    // Define the Python object structure
+    typedef struct {
+        PyObject_HEAD
+        FileCacheManagerImpl* impl;
+    } FCMObject;
+
+    // Read-only view of a slice of a cached file. Holds a reference to the
+    // cached data so the bytes stay valid for as long as the object lives.
+    typedef struct {
+        PyObject_HEAD
+        CacheData* pin;
+        const char* buf;
+        Py_ssize_t len;
+    } CacheBufferObject;
+
+    static void CacheBuffer_dealloc(CacheBufferObject* self) {
+        delete self->pin;
+        Py_TYPE(self)->tp_free((PyObject*)self);
+    }
+
+    static int CacheBuffer_getbuffer(CacheBufferObject* self, Py_buffer* view, int flags) {
+        return PyBuffer_FillInfo(view, (PyObject*)self, (void*)self->buf, self->len, 1, flags);
+    }
+
+    static Py_ssize_t CacheBuffer_length(CacheBufferObject* self) {
+        return self->len;
+    }
+
+    // ctypes converts objects through _as_parameter_, which lets fusepy
+    // memmove straight out of the cache without an intermediate bytes object
+    static PyObject* CacheBuffer_as_parameter(CacheBufferObject* self, void* Py_UNUSED(closure)) {
+        return PyLong_FromVoidPtr((void*)self->buf);
+    }
+
+    static PyBufferProcs CacheBuffer_as_buffer = {
+        (getbufferproc)CacheBuffer_getbuffer, /* bf_getbuffer */
+        nullptr,                              /* bf_releasebuffer */
+    };
+
+    static PySequenceMethods CacheBuffer_as_sequence = {
+        (lenfunc)CacheBuffer_length,    /* sq_length */
+    };
+
+    static PyGetSetDef CacheBuffer_getset[] = {
+        {"_as_parameter_", (getter)CacheBuffer_as_parameter, nullptr, "Address of the cached bytes", nullptr},
+        {nullptr, nullptr, nullptr, nullptr, nullptr}  // Sentinel
+    };
+
+    static PyTypeObject CacheBufferType = {
+        PyVarObject_HEAD_INIT(nullptr, 0)
+        "fcache_cpp.CacheBuffer",       /* tp_name */
+        sizeof(CacheBufferObject),      /* tp_basicsize */
+        0,                              /* tp_itemsize */
+        (destructor)CacheBuffer_dealloc, /* tp_dealloc */
+        0,                              /* tp_vectorcall_offset */
+        0,                              /* tp_getattr */
+        0,                              /* tp_setattr */
+        0,                              /* tp_as_async */
+        0,                              /* tp_repr */
+        0,                              /* tp_as_number */
+        &CacheBuffer_as_sequence,       /* tp_as_sequence */
+        0,                              /* tp_as_mapping */
+        0,                              /* tp_hash */
+        0,                              /* tp_call */
+        0,                              /* tp_str */
+        0,                              /* tp_getattro */
+        0,                              /* tp_setattro */
+        &CacheBuffer_as_buffer,         /* tp_as_buffer */
+        Py_TPFLAGS_DEFAULT,             /* tp_flags */
+        "Read-only view of cached file data", /* tp_doc */
+        0,                              /* tp_traverse */
+        0,                              /* tp_clear */
+        0,                              /* tp_richcompare */
+        0,                              /* tp_weaklistoffset */
+        0,                              /* tp_iter */
+        0,                              /* tp_iternext */
+        0,                              /* tp_methods */
+        0,                              /* tp_members */
+        CacheBuffer_getset,             /* tp_getset */
+    };
+
+    // All FileCacheManager methods parse their arguments under the GIL, run
+    // the C++ side with the GIL released and only reacquire it to build the
+    // result, so cache lock waits never stall other Python threads.
+
+    static void FCM_dealloc(FCMObject* self) {
+        FileCacheManagerImpl* impl = self->impl;
+        // Joining the reader threads can wait on in-progress disk reads
+        Py_BEGIN_ALLOW_THREADS
+        delete impl;
+        Py_END_ALLOW_THREADS
+        Py_TYPE(self)->tp_free((PyObject*)self);
+    }
+    
+    static PyObject* FCM_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+        static char* kwlist[] = {(char*)"memory_limit", (char*)"chunk_size", (char*)"shards",
+                                 (char*)"reader_threads", (char*)"prefetch_chunks",
+                                 (char*)"io_backend", (char*)"queue_depth", (char*)"policy",
+                                 (char*)"compressed_limit", (char*)"spill_path", (char*)"spill_size",
+                                 (char*)"validate", (char*)"metadata_ttl_ms", (char*)"metadata_entries",
+                                 (char*)"max_readahead", (char*)"mmap", nullptr};
+        size_t memory_limit = 4ULL * 1024 * 1024 * 1024; // 4 GB default
+        size_t chunk_size = 1024 * 1024; // 1 MB default
+        size_t shards = 0; // 0 = one per hardware thread
+        size_t reader_threads = 4;
+        size_t prefetch_chunks = 4;
+        const char* io_backend = "threads";
+        size_t queue_depth = 32;
+        const char* policy_name = "lru";
+        size_t compressed_limit = 0; // 0 = no compressed tier
+        const char* spill_path = "";
+        size_t spill_size = 0; // 0 = no spill file
+        int validate = 1;
+        size_t metadata_ttl_ms = 1000; // 0 = no metadata cache
+        size_t metadata_entries = 65536;
+        size_t max_readahead = 64; // Chunks a stream's window grows to
+        int map_files = 0; // Chunks map the files instead of copying them
+        
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|KKKKKsKsKsKpKKKp", kwlist, &memory_limit, &chunk_size,
+                                         &shards, &reader_threads, &prefetch_chunks,
+                                         &io_backend, &queue_depth, &policy_name, &compressed_limit,
+                                         &spill_path, &spill_size, &validate, &metadata_ttl_ms,
+                                         &metadata_entries, &max_readahead, &map_files)) {
+            return nullptr;
+        }
+        
+        IoBackend backend;
+        if (std::strcmp(io_backend, "threads") == 0) {
+            backend = IoBackend::Threads;
+        } else if (std::strcmp(io_backend, "uring") == 0) {
+            backend = IoBackend::Uring;
+        } else {
+            PyErr_Format(PyExc_ValueError, "unknown io_backend '%s' (expected 'threads' or 'uring')", io_backend);
+            return nullptr;
+        }
+        
+        PolicyKind policy;
+        if (std::strcmp(policy_name, "lru") == 0) {
+            policy = PolicyKind::Lru;
+        } else if (std::strcmp(policy_name, "arc") == 0) {
+            policy = PolicyKind::Arc;
+        } else if (std::strcmp(policy_name, "tinylfu") == 0) {
+            policy = PolicyKind::TinyLfu;
+        } else {
+            PyErr_Format(PyExc_ValueError, "unknown policy '%s' (expected 'lru', 'arc' or 'tinylfu')", policy_name);
+            return nullptr;
+        }
+        
+        FCMObject* self = (FCMObject*)type->tp_alloc(type, 0);
+        if (self != nullptr) {
+            // Create the C++ implementation
+            if (shards == 0) shards = default_shard_count();
+            self->impl = new FileCacheManagerImpl(memory_limit, chunk_size, shards,
+                                                  reader_threads, prefetch_chunks,
+                                                  backend, queue_depth, policy, compressed_limit,
+                                                  spill_path, spill_size, validate != 0,
+                                                  metadata_ttl_ms, metadata_entries, max_readahead,
+                                                  map_files != 0);
+        }
+        return (PyObject*)self;
+    }
+    
+    static PyObject* FCM_request_file(PyObject* self, PyObject* args) {
+        const char* filepath;
+        int priority = 0;
+        unsigned char source = 0;
+        if (!PyArg_ParseTuple(args, "s|ib", &filepath, &priority, &source)) {
+            return nullptr;
+        }
+        if (source >= PrefetchStats::MAX_SOURCES) {
+            PyErr_SetString(PyExc_ValueError, "unknown prefetch source");
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->request_file(filepath, priority, source);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
+    }
+    
+    static PyObject* FCM_register_source(PyObject* self, PyObject* args) {
+        const char* name;
+        if (!PyArg_ParseTuple(args, "s", &name)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        return PyLong_FromLong(fcm->impl->register_source(name));
+    }
+    
+    static PyObject* FCM_prefetch_depth(PyObject* self, PyObject* args) {
+        unsigned char source;
+        size_t max_depth;
+        if (!PyArg_ParseTuple(args, "bn", &source, &max_depth)) {
+            return nullptr;
+        }
+        if (source >= PrefetchStats::MAX_SOURCES) {
+            PyErr_SetString(PyExc_ValueError, "unknown prefetch source");
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        return PyLong_FromSize_t(fcm->impl->prefetch_depth(source, max_depth));
+    }
+    
+    // {name: {'issued', 'hits', 'wasted', 'accuracy'}} for every registered source
+    static PyObject* FCM_prefetch_stats(PyObject* self, PyObject* Py_UNUSED(ignored)) {
+        FCMObject* fcm = (FCMObject*)self;
+        PyObject* result = PyDict_New();
+        if (!result) return nullptr;
+        bool failed = false;
+        fcm->impl->get_prefetch_controller().for_each_source(
+            [&](const std::string& name, uint64_t issued, uint64_t hits, uint64_t wasted, double accuracy) {
+                if (failed) return;
+                PyObject* entry = Py_BuildValue("{s:K,s:K,s:K,s:d}", "issued", (unsigned long long)issued,
+                                                "hits", (unsigned long long)hits,
+                                                "wasted", (unsigned long long)wasted, "accuracy", accuracy);
+                failed = !entry || PyDict_SetItemString(result, name.c_str(), entry) < 0;
+                Py_XDECREF(entry);
+            });
+        if (failed) {
+            Py_DECREF(result);
+            return nullptr;
+        }
+        return result;
+    }
+    
+    static PyObject* FCM_is_in_cache(PyObject* self, PyObject* args) {
+        const char* filepath;
+        if (!PyArg_ParseTuple(args, "s", &filepath)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        bool in_cache;
+        Py_BEGIN_ALLOW_THREADS
+        in_cache = fcm->impl->is_in_cache(filepath);
+        Py_END_ALLOW_THREADS
+        
+        if (in_cache) {
+            // Return (bytes, 1) - bytes is just a placeholder for compatibility
+            PyObject* bytes = PyBytes_FromStringAndSize("", 0);
+            PyObject* result = Py_BuildValue("Oi", bytes, 1);
+            Py_DECREF(bytes);
+            return result;
+        } else {
+            // Return (None, 0)
+            Py_INCREF(Py_None);
+            return Py_BuildValue("Oi", Py_None, 0);
+        }
+    }
+    
+    static PyObject* FCM_read_cache(PyObject* self, PyObject* args) {
+        const char* filepath;
+        size_t size, offset;
+        if (!PyArg_ParseTuple(args, "snn", &filepath, &size, &offset)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        CacheRead result;
+        bool hit;
+        Py_BEGIN_ALLOW_THREADS
+        hit = fcm->impl->read_cache(filepath, size, offset, result);
+        Py_END_ALLOW_THREADS
+        if (!hit) {
+            Py_RETURN_NONE;
+        }
+        
+        PyObject* bytes = PyBytes_FromStringAndSize(nullptr, result.length);
+        if (bytes == nullptr) {
+            return nullptr;
+        }
+        // Nothing else can see the new bytes object yet, so fill it unlocked
+        char* dest = PyBytes_AS_STRING(bytes);
+        Py_BEGIN_ALLOW_THREADS
+        copy_cache_read(result, dest);
+        Py_END_ALLOW_THREADS
+        return bytes;
+    }
+    
+    // One chunk pinning all of `result`. Reads spanning a chunk boundary
+    // need one contiguous copy; call without the GIL.
+    static CacheData join_cache_read(CacheRead& result) {
+        if (result.chunks.size() == 1) {
+            return std::move(result.chunks.front());
+        }
+        auto joined = std::make_shared<CachedChunk>();
+        joined->bytes = SlabBuffer::heap(result.length);
+        joined->file_size = result.chunks.front()->file_size;
+        copy_cache_read(result, joined->bytes.data());
+        result.offset = 0;
+        return joined;
+    }
+    
+    static PyObject* new_cache_buffer(CacheData&& data, const CacheRead& result) {
+        CacheBufferObject* view = PyObject_New(CacheBufferObject, &CacheBufferType);
+        if (view == nullptr) {
+            return nullptr;
+        }
+        view->buf = data->bytes.data() + result.offset;
+        view->len = result.length;
+        view->pin = new CacheData(std::move(data));
+        return (PyObject*)view;
+    }
+    
+    static PyObject* FCM_read_cache_view(PyObject* self, PyObject* args) {
+        const char* filepath;
+        size_t size, offset;
+        if (!PyArg_ParseTuple(args, "snn", &filepath, &size, &offset)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        CacheRead result;
+        CacheData data;
+        bool hit;
+        Py_BEGIN_ALLOW_THREADS
+        hit = fcm->impl->read_cache(filepath, size, offset, result);
+        if (hit) data = join_cache_read(result);
+        Py_END_ALLOW_THREADS
+        if (!hit) {
+            Py_RETURN_NONE;
+        }
+        return new_cache_buffer(std::move(data), result);
+    }
+    
+    // read_cache_view that reads a miss from disk through handle `fh` (-1
+    // for none), caching what it read; raises OSError like os.pread
+    static PyObject* FCM_read_through(PyObject* self, PyObject* args) {
+        const char* filepath;
+        size_t size, offset;
+        int fh = -1;
+        if (!PyArg_ParseTuple(args, "snn|i", &filepath, &size, &offset, &fh)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        CacheRead result;
+        CacheData data;
+        bool ok;
+        int error;
+        Py_BEGIN_ALLOW_THREADS
+        ok = fcm->impl->read_through(filepath, size, offset, fh, result);
+        error = errno;
+        if (ok && result.length > 0) data = join_cache_read(result);
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            errno = error;
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filepath);
+        }
+        if (result.length == 0) {
+            return PyBytes_FromStringAndSize(nullptr, 0);
+        }
+        return new_cache_buffer(std::move(data), result);
+    }
+    
+    static PyObject* FCM_attach(PyObject* self, PyObject* args) {
+        const char* filepath;
+        int fh;
+        if (!PyArg_ParseTuple(args, "si", &filepath, &fh)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->attach(fh, filepath, fh);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
+    }
+    
+    static PyObject* FCM_detach(PyObject* self, PyObject* args) {
+        int fh;
+        if (!PyArg_ParseTuple(args, "i", &fh)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->detach(fh);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
+    }
+    
+    static PyObject* FCM_cache_status(PyObject* self, PyObject* Py_UNUSED(ignored)) {
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->cache_status();
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
+    }
+    
+    // A latency histogram as a dict of nanoseconds; buckets lists the
+    // non-empty (upper bound, count) pairs
+    static PyObject* histogram_dict(const Metrics::Histogram& histogram) {
+        PyObject* buckets = PyList_New(0);
+        if (!buckets) return nullptr;
+        for (size_t i = 0; i < Metrics::BUCKETS; ++i) {
+            if (histogram.buckets[i] == 0) continue;
+            PyObject* bucket = Py_BuildValue("(KK)", (unsigned long long)Metrics::bucket_limit(i),
+                                             (unsigned long long)histogram.buckets[i]);
+            if (!bucket || PyList_Append(buckets, bucket) < 0) {
+                Py_XDECREF(bucket);
+                Py_DECREF(buckets);
+                return nullptr;
+            }
+            Py_DECREF(bucket);
+        }
+        double mean = histogram.count ? (double)histogram.sum_ns / histogram.count : 0.0;
+        return Py_BuildValue("{s:K,s:d,s:K,s:K,s:K,s:K,s:K,s:N}",
+                             "count", (unsigned long long)histogram.count, "mean_ns", mean,
+                             "p50_ns", (unsigned long long)histogram.quantile(0.5),
+                             "p90_ns", (unsigned long long)histogram.quantile(0.9),
+                             "p99_ns", (unsigned long long)histogram.quantile(0.99),
+                             "p999_ns", (unsigned long long)histogram.quantile(0.999),
+                             "max_ns", (unsigned long long)histogram.quantile(1.0), "buckets", buckets);
+    }
+    
+    static PyObject* FCM_stats(PyObject* self, PyObject* Py_UNUSED(ignored)) {
+        FCMObject* fcm = (FCMObject*)self;
+        CacheStats totals;
+        Py_BEGIN_ALLOW_THREADS
+        totals = fcm->impl->stats();
+        Py_END_ALLOW_THREADS
+        
+        const auto& counters = totals.metrics.counters;
+        uint64_t reads = counters[Metrics::Hits] + counters[Metrics::PartialHits] + counters[Metrics::Misses];
+        PyObject* result = Py_BuildValue(
+            "{s:K,s:K,s:K,s:d,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:L,s:n,s:n,s:n,s:n,s:n,s:n,s:K,s:K,s:d}",
+            "hits", (unsigned long long)counters[Metrics::Hits],
+            "partial_hits", (unsigned long long)counters[Metrics::PartialHits],
+            "misses", (unsigned long long)counters[Metrics::Misses],
+            "hit_ratio", reads ? (double)counters[Metrics::Hits] / reads : 0.0,
+            "bytes_served", (unsigned long long)counters[Metrics::BytesServed],
+            "bytes_read", (unsigned long long)counters[Metrics::BytesRead],
+            "evictions", (unsigned long long)counters[Metrics::Evictions],
+            "peer_hits", (unsigned long long)counters[Metrics::PeerHits],
+            "peer_misses", (unsigned long long)counters[Metrics::PeerMisses],
+            "peer_served", (unsigned long long)counters[Metrics::PeerServed],
+            "prefetch_issued", (unsigned long long)totals.prefetch_issued,
+            "prefetch_used", (unsigned long long)totals.prefetch_used,
+            "prefetch_wasted", (unsigned long long)totals.prefetch_wasted,
+            "prefetch_unread_bytes", (long long)totals.prefetch_unread_bytes,
+            "queue_depth", (Py_ssize_t)totals.queued, "in_flight", (Py_ssize_t)totals.in_flight,
+            "memory_bytes", (Py_ssize_t)totals.memory_bytes, "memory_limit", (Py_ssize_t)totals.memory_limit,
+            "mapped_bytes", (Py_ssize_t)totals.mapped_bytes, "chunks", (Py_ssize_t)totals.chunks,
+            "metadata_hits", (unsigned long long)totals.metadata_hits,
+            "metadata_misses", (unsigned long long)totals.metadata_misses,
+            "memory_pressure", totals.memory_pressure);
+        if (!result) return nullptr;
+        for (size_t l = 0; l < Metrics::NUM_LATENCIES; ++l) {
+            PyObject* histogram = histogram_dict(totals.metrics.latencies[l]);
+            if (!histogram || PyDict_SetItemString(result, Metrics::latency_name(l), histogram) < 0) {
+                Py_XDECREF(histogram);
+                Py_DECREF(result);
+                return nullptr;
+            }
+            Py_DECREF(histogram);
+        }
+        return result;
+    }
     
-    bool contains(const std::string& path) {
-        std::lock_guard<std::mutex> lock(mutex);
-        return cache.find(path) != cache.end();
+    static PyObject* FCM_prometheus(PyObject* self, PyObject* Py_UNUSED(ignored)) {
+        FCMObject* fcm = (FCMObject*)self;
+        std::string text;
+        Py_BEGIN_ALLOW_THREADS
+        std::ostringstream os;
+        fcm->impl->write_prometheus(os);
+        text = os.str();
+        Py_END_ALLOW_THREADS
+        return PyUnicode_FromStringAndSize(text.data(), text.size());
     }
     
-    std::vector<char>* get(const std::string& path) {
-        std::lock_guard<std::mutex> lock(mutex);
-        auto it = cache.find(path);
-        if (it == cache.end()) {
+    static PyObject* FCM_set_memory_limit(PyObject* self, PyObject* args) {
+        unsigned long long limit;
+        if (!PyArg_ParseTuple(args, "K", &limit)) {
             return nullptr;
         }
         
-        // Move to front of LRU
-        lru_order.erase(it->second.first);
-        lru_order.push_front(path);
-        it->second.first = lru_order.begin();
-        
-        return &it->second.second.data;
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->set_memory_limit(limit);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
     }
     
-    void insert(const std::string& path, std::vector<char>&& data) {
-        std::lock_guard<std::mutex> lock(mutex);
-        size_t size = data.size();
-        
-        // Check if already exists
-        auto it = cache.find(path);
-        if (it != cache.end()) {
-            // Update existing entry
-            current_size -= it->second.second.size;
-            current_size += size;
-            
-            // Update LRU position
-            lru_order.erase(it->second.first);
-            lru_order.push_front(path);
-            
-            // Update entry
-            it->second.first = lru_order.begin();
-            it->second.second.data = std::move(data);
-            it->second.second.size = size;
-            return;
+    static PyObject* FCM_watch_memory_pressure(PyObject* self, PyObject* args, PyObject* kwds) {
+        static char* kwlist[] = {(char*)"min_limit", (char*)"max_limit", (char*)"cgroup", (char*)"interval_ms",
+                                 nullptr};
+        unsigned long long min_limit, max_limit;
+        const char* cgroup = "";
+        int interval_ms = 1000;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "KK|si", kwlist, &min_limit, &max_limit, &cgroup,
+                                         &interval_ms)) {
+            return nullptr;
         }
         
-        // Make room if needed
-        while (!lru_order.empty() && current_size + size > max_size) {
-            // Remove least recently used item
-            std::string oldest = lru_order.back();
-            lru_order.pop_back();
-            
-            size_t removed_size = cache[oldest].second.size;
-            current_size -= removed_size;
-            cache.erase(oldest);
+        FCMObject* fcm = (FCMObject*)self;
+        std::string source;
+        bool ok;
+        Py_BEGIN_ALLOW_THREADS
+        ok = fcm->impl->watch_memory_pressure(min_limit, max_limit, cgroup, interval_ms, source);
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, *cgroup ? cgroup : "/proc/pressure/memory");
         }
-        
-        // Add new entry
-        lru_order.push_front(path);
-        CacheEntry entry{std::move(data), size};
-        cache[path] = {lru_order.begin(), std::move(entry)};
-        current_size += size;
+        if (max_limit == 0) {
+            Py_RETURN_NONE;
+        }
+        return PyUnicode_FromString(source.c_str());
     }
     
-    size_t get_current_size() const {
-        return current_size;
+    static PyObject* FCM_set_root(PyObject* self, PyObject* args) {
+        const char* root;
+        if (!PyArg_ParseTuple(args, "s", &root)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->set_root(root);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
     }
     
-    std::vector<std::string> get_cached_files() {
-        std::lock_guard<std::mutex> lock(mutex);
-        return std::vector<std::string>(lru_order.begin(), lru_order.end());
+    static PyObject* FCM_invalidate(PyObject* self, PyObject* args) {
+        const char* filepath;
+        long long size = -1;
+        if (!PyArg_ParseTuple(args, "s|L", &filepath, &size)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->invalidate(filepath, size < 0 ? FileCache::UNKNOWN_SIZE : (uint64_t)size);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
     }
-};
-
-// File reader thread
-class FileReader {
-private:
-    std::string root_dir;
-    std::shared_ptr<FileCache> cache;
-    std::queue<std::string> file_queue;
-    std::mutex queue_mutex;
-    std::condition_variable queue_cv;
-    bool running;
-    std::thread worker;
     
-    void worker_function() {
-        while (running) {
-            std::string filepath;
-            
-            {
-                std::unique_lock<std::mutex> lock(queue_mutex);
-                queue_cv.wait(lock, [this]() { return !file_queue.empty() || !running; });
-                
-                if (!running) break;
-                
-                filepath = file_queue.front();
-                file_queue.pop();
-            }
-            
-            process_file(filepath);
+    static PyObject* FCM_truncate(PyObject* self, PyObject* args) {
+        const char* filepath;
+        unsigned long long length;
+        int fd = -1;
+        if (!PyArg_ParseTuple(args, "sK|i", &filepath, &length, &fd)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        int error;
+        Py_BEGIN_ALLOW_THREADS
+        error = fcm->impl->truncate(filepath, fd, length);
+        Py_END_ALLOW_THREADS
+        if (error != 0) {
+            errno = error;
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filepath);
         }
+        Py_RETURN_NONE;
     }
     
-    void process_file(const std::string& filepath_virt) {
-        std::string normalized_path = normalize_path(filepath_virt);
-        fs::path filepath_real = fs::path(root_dir) / normalized_path;
-        
-        if (!fs::exists(filepath_real)) {
-            std::cerr << "File " << filepath_real << " does not exist" << std::endl;
-            return;
+    static PyObject* FCM_rename(PyObject* self, PyObject* args) {
+        const char* old_path;
+        const char* new_path;
+        long long replaced_size = -1;
+        if (!PyArg_ParseTuple(args, "ss|L", &old_path, &new_path, &replaced_size)) {
+            return nullptr;
         }
         
-        try {
-            size_t file_size = fs::file_size(filepath_real);
-            
-            // Check if already in cache
-            if (cache->contains(normalized_path)) {
-                return;
-            }
-            
-            // Read file
-            std::ifstream file(filepath_real, std::ios::binary);
-            if (!file) {
-                std::cerr << "Failed to open file: " << filepath_real << std::endl;
-                return;
-            }
-            
-            std::vector<char> file_data(file_size);
-            file.read(file_data.data(), file_size);
-            
-            if (file.gcount() != static_cast<std::streamsize>(file_size)) {
-                std::cerr << "Read size mismatch: expected " << file_size 
-                          << ", got " << file.gcount() << std::endl;
-                return;
-            }
-            
-            // Add to cache
-            cache->insert(normalized_path, std::move(file_data));
-            
-        } catch (const std::exception& e) {
-            std::cerr << "Error processing file " << filepath_real << ": " << e.what() << std::endl;
-        }
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->rename_path(old_path, new_path,
+                               replaced_size < 0 ? FileCache::UNKNOWN_SIZE : (uint64_t)replaced_size);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
     }
     
-public:
-    FileReader(const std::string& root, std::shared_ptr<FileCache> cache)
-        : root_dir(root), cache(cache), running(true) {
-        worker = std::thread(&FileReader::worker_function, this);
+    static PyObject* FCM_write_through(PyObject* self, PyObject* args) {
+        const char* filepath;
+        unsigned long long offset;
+        Py_buffer data;
+        long long old_size = -1;
+        long long old_mtime_ns = 0;
+        if (!PyArg_ParseTuple(args, "sKy*|LL", &filepath, &offset, &data, &old_size, &old_mtime_ns)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        struct stat before{};
+        before.st_size = old_size;
+        before.st_mtim = {(time_t)(old_mtime_ns / 1000000000), (long)(old_mtime_ns % 1000000000)};
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->write_through(filepath, offset, (const char*)data.buf, data.len, old_size < 0 ? nullptr : &before);
+        Py_END_ALLOW_THREADS
+        PyBuffer_Release(&data);
+        Py_RETURN_NONE;
     }
     
-    ~FileReader() {
-        {
-            std::lock_guard<std::mutex> lock(queue_mutex);
-            running = false;
+    static PyObject* string_list(const std::vector<std::string>& items) {
+        PyObject* list = PyList_New(items.size());
+        if (list == nullptr) {
+            return nullptr;
         }
-        queue_cv.notify_all();
-        if (worker.joinable()) {
-            worker.join();
+        for (size_t i = 0; i < items.size(); ++i) {
+            PyObject* item = PyUnicode_FromStringAndSize(items[i].data(), items[i].size());
+            if (item == nullptr) {
+                Py_DECREF(list);
+                return nullptr;
+            }
+            PyList_SET_ITEM(list, i, item);
         }
+        return list;
     }
     
-    void request_file(const std::string& filepath) {
-        {
-            std::lock_guard<std::mutex> lock(queue_mutex);
-            file_queue.push(filepath);
-        }
-        queue_cv.notify_one();
+    static double stat_time(const struct timespec& ts) {
+        return ts.tv_sec + ts.tv_nsec / 1e9;
     }
     
-    void set_root(const std::string& root) {
-        root_dir = root;
+    // The fields fusepy's getattr wants, raising OSError like os.lstat
+    static PyObject* FCM_stat(PyObject* self, PyObject* args) {
+        const char* filepath;
+        if (!PyArg_ParseTuple(args, "s", &filepath)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        struct stat st;
+        bool ok;
+        int error;
+        Py_BEGIN_ALLOW_THREADS
+        ok = fcm->impl->stat_path(normalize_path(filepath), st);
+        error = errno;
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            errno = error;
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filepath);
+        }
+        return Py_BuildValue("{s:d,s:d,s:K,s:I,s:d,s:K,s:L,s:K}",
+                             "st_atime", stat_time(st.st_atim), "st_ctime", stat_time(st.st_ctim),
+                             "st_gid", (unsigned long long)st.st_gid, "st_mode", (unsigned int)st.st_mode,
+                             "st_mtime", stat_time(st.st_mtim), "st_nlink", (unsigned long long)st.st_nlink,
+                             "st_size", (long long)st.st_size, "st_uid", (unsigned long long)st.st_uid);
     }
     
-    std::vector<std::string> get_queue_items() {
-        std::lock_guard<std::mutex> lock(queue_mutex);
-        std::vector<std::string> items;
-        std::queue<std::string> queue_copy = file_queue;
-        while (!queue_copy.empty()) {
-            items.push_back(queue_copy.front());
-            queue_copy.pop();
+    static PyObject* FCM_listdir(PyObject* self, PyObject* args) {
+        const char* filepath;
+        if (!PyArg_ParseTuple(args, "s", &filepath)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        std::shared_ptr<const std::vector<std::string>> names;
+        bool ok;
+        int error;
+        Py_BEGIN_ALLOW_THREADS
+        ok = fcm->impl->list_directory(normalize_path(filepath), names);
+        error = errno;
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            errno = error;
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filepath);
         }
-        return items;
+        return string_list(*names);
     }
-};
-
-// FileCacheManager implementation
-class FileCacheManagerImpl {
-private:
-    std::shared_ptr<FileCache> cache;
-    std::unique_ptr<FileReader> reader;
-    size_t memory_limit;
-    size_t chunk_size;
     
-public:
-    FileCacheManagerImpl(size_t memory_limit, size_t chunk_size)
-        : memory_limit(memory_limit), chunk_size(chunk_size) {
-        cache = std::make_shared<FileCache>(memory_limit);
-        reader = std::make_unique<FileReader>(".", cache);
+    static PyObject* FCM_invalidate_metadata(PyObject* self, PyObject* args) {
+        const char* filepath;
+        if (!PyArg_ParseTuple(args, "s", &filepath)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->invalidate_metadata(filepath);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
     }
     
-    void request_file(const std::string& filepath) {
-        reader->request_file(filepath);
+#ifdef FCACHE_FUSE
+    static PyObject* FCM_mount(PyObject* self, PyObject* args) {
+        const char* mountpoint;
+        PyObject* option_list = nullptr;
+        if (!PyArg_ParseTuple(args, "s|O!", &mountpoint, &PyList_Type, &option_list)) {
+            return nullptr;
+        }
+        std::vector<std::string> options;
+        Py_ssize_t count = option_list ? PyList_Size(option_list) : 0;
+        for (Py_ssize_t i = 0; i < count; ++i) {
+            const char* option = PyUnicode_AsUTF8(PyList_GetItem(option_list, i));
+            if (option == nullptr) {
+                return nullptr;
+            }
+            options.push_back(option);
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        std::string error;
+        bool ok;
+        // Blocks until the mount goes away; Python threads keep running meanwhile
+        Py_BEGIN_ALLOW_THREADS
+        FuseFrontend frontend(*fcm->impl, fcm->impl->get_root_fd());
+        ok = frontend.run(mountpoint, options, error);
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            PyErr_SetString(PyExc_RuntimeError, error.c_str());
+            return nullptr;
+        }
+        Py_RETURN_NONE;
     }
+#endif
     
-    bool is_in_cache(const std::string& filepath, std::vector<char>** data_ptr) {
-        std::string normalized = normalize_path(filepath);
-        *data_ptr = cache->get(normalized);
-        return *data_ptr != nullptr;
+    static PyObject* FCM_configure_predictor(PyObject* self, PyObject* args, PyObject* kwds) {
+        static char* kwlist[] = {(char*)"kind", (char*)"order", (char*)"history_length",
+                                 (char*)"learning_rate", (char*)"decay", (char*)"max_states",
+                                 (char*)"min_confidence", nullptr};
+        const char* kind;
+        size_t order = 2;
+        size_t history_length = 5;
+        float learning_rate = 0.1f;
+        float decay = 0.9f;
+        size_t max_states = 65536;
+        float min_confidence = 0.2f;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|KKffKf", kwlist, &kind, &order, &history_length,
+                                         &learning_rate, &decay, &max_states, &min_confidence)) {
+            return nullptr;
+        }
+        
+        std::unique_ptr<NativePredictor> predictor;
+        std::string name;
+        if (std::strcmp(kind, "markov") == 0) {
+            predictor = std::make_unique<OrderKMarkov>(order, max_states);
+            name = "Native Markov";
+        } else if (std::strcmp(kind, "adaptive") == 0) {
+            predictor = std::make_unique<DecayedMarkov>(history_length, learning_rate, decay, max_states);
+            name = "Native Adaptive Markov";
+        } else if (std::strcmp(kind, "locality") == 0) {
+            predictor = ((FCMObject*)self)->impl->make_locality_predictor(max_states);
+            name = "Native Locality";
+        } else {
+            PyErr_Format(PyExc_ValueError, "unknown predictor '%s' (expected 'markov', 'adaptive' or 'locality')",
+                         kind);
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->configure_predictor(std::move(predictor), name, min_confidence);
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
     }
     
-    std::vector<char>* read_cache(const std::string& filepath, size_t size, size_t offset) {
-        std::string normalized = normalize_path(filepath);
-        return cache->get(normalized);
+    static PyObject* FCM_log_read(PyObject* self, PyObject* args) {
+        const char* filepath;
+        size_t num_predictions = 2;
+        int prefetch = 1;
+        if (!PyArg_ParseTuple(args, "s|np", &filepath, &num_predictions, &prefetch)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        std::vector<std::string> predictions;
+        bool configured;
+        Py_BEGIN_ALLOW_THREADS
+        configured = fcm->impl->log_read(filepath, num_predictions, prefetch, predictions);
+        Py_END_ALLOW_THREADS
+        if (!configured) {
+            PyErr_SetString(PyExc_RuntimeError, "no native predictor configured");
+            return nullptr;
+        }
+        return string_list(predictions);
     }
     
-    void cache_status() {
-        double mb_size = cache->get_current_size() / (1024.0 * 1024.0);
-        std::cout << "Cache: " << mb_size << " MB | Files: ";
+    static PyObject* FCM_log_reads(PyObject* self, PyObject* args) {
+        PyObject* paths;
+        size_t num_predictions = 2;
+        int prefetch = 1;
+        if (!PyArg_ParseTuple(args, "O|np", &paths, &num_predictions, &prefetch)) {
+            return nullptr;
+        }
         
-        auto files = cache->get_cached_files();
-        for (size_t i = 0; i < files.size(); ++i) {
-            if (i > 0) std::cout << ", ";
-            std::cout << files[i];
+        PyObject* seq = PySequence_Fast(paths, "paths must be a sequence");
+        if (!seq) return nullptr;
+        std::vector<std::string> filepaths;
+        Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+        filepaths.reserve(count);
+        for (Py_ssize_t i = 0; i < count; ++i) {
+            Py_ssize_t length;
+            const char* path = PyUnicode_AsUTF8AndSize(PySequence_Fast_GET_ITEM(seq, i), &length);
+            if (!path) {
+                Py_DECREF(seq);
+                return nullptr;
+            }
+            filepaths.emplace_back(path, length);
         }
-        std::cout << std::endl;
+        Py_DECREF(seq);
         
-        std::cout << "Queue: ";
-        auto queue_items = reader->get_queue_items();
-        for (size_t i = 0; i < queue_items.size(); ++i) {
-            if (i > 0) std::cout << ", ";
-            std::cout << queue_items[i];
+        FCMObject* fcm = (FCMObject*)self;
+        bool configured;
+        Py_BEGIN_ALLOW_THREADS
+        configured = fcm->impl->log_reads(filepaths, num_predictions, prefetch);
+        Py_END_ALLOW_THREADS
+        if (!configured) {
+            PyErr_SetString(PyExc_RuntimeError, "no native predictor configured");
+            return nullptr;
         }
-        std::cout << std::endl;
+        Py_RETURN_NONE;
     }
     
-    void set_root(const std::string& root) {
-        reader->set_root(root);
-    }
-};
-
-// Python module implementation
-extern "C" {
-    // Define the Python object structure
-    typedef struct {
-        PyObject_HEAD
-        FileCacheManagerImpl* impl;
-    } FCMObject;
-
-    static void FCM_dealloc(FCMObject* self) {
-        delete self->impl;
-        Py_TYPE(self)->tp_free((PyObject*)self);
+    // Called on the FUSE read path with the GIL held; the push is lock-free
+    // so it is cheaper than releasing the GIL
+    static PyObject* FCM_record_access(PyObject* self, PyObject* args) {
+        const char* filepath;
+        if (!PyArg_ParseTuple(args, "s", &filepath)) {
+            return nullptr;
+        }
+        
+        FCMObject* fcm = (FCMObject*)self;
+        fcm->impl->record_access(filepath);
+        Py_RETURN_NONE;
     }
     
-    static PyObject* FCM_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
-        static char* kwlist[] = {(char*)"memory_limit", (char*)"chunk_size", nullptr};
-        size_t memory_limit = 4ULL * 1024 * 1024 * 1024; // 4 GB default
-        size_t chunk_size = 1024 * 1024; // 1 MB default
+    static PyObject* FCM_drain_accesses(PyObject* self, PyObject* args) {
+        size_t max_batch = 64;
+        int timeout_ms = 100;
+        if (!PyArg_ParseTuple(args, "|ni", &max_batch, &timeout_ms)) {
+            return nullptr;
+        }
         
-        if (!PyArg_ParseTupleAndKeywords(args, kwds, "|KK", kwlist, &memory_limit, &chunk_size)) {
+        FCMObject* fcm = (FCMObject*)self;
+        std::vector<std::string> paths;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->drain_accesses(paths, std::max<size_t>(1, max_batch), timeout_ms);
+        Py_END_ALLOW_THREADS
+        return string_list(paths);
+    }
+    
+    static PyObject* FCM_predict(PyObject* self, PyObject* args) {
+        const char* filepath;
+        size_t num_predictions = 1;
+        if (!PyArg_ParseTuple(args, "s|n", &filepath, &num_predictions)) {
             return nullptr;
         }
         
-        FCMObject* self = (FCMObject*)type->tp_alloc(type, 0);
-        if (self != nullptr) {
-            // Create the C++ implementation
-            self->impl = new FileCacheManagerImpl(memory_limit, chunk_size);
+        FCMObject* fcm = (FCMObject*)self;
+        std::vector<std::string> predictions;
+        bool configured;
+        Py_BEGIN_ALLOW_THREADS
+        configured = fcm->impl->predict(filepath, num_predictions, predictions);
+        Py_END_ALLOW_THREADS
+        if (!configured) {
+            PyErr_SetString(PyExc_RuntimeError, "no native predictor configured");
+            return nullptr;
         }
-        return (PyObject*)self;
+        return string_list(predictions);
     }
     
-    static PyObject* FCM_request_file(PyObject* self, PyObject* args) {
+    static PyObject* FCM_save_snapshot(PyObject* self, PyObject* args) {
         const char* filepath;
-        if (!PyArg_ParseTuple(args, "s", &filepath)) {
+        size_t hot_files = 1024;
+        if (!PyArg_ParseTuple(args, "s|n", &filepath, &hot_files)) {
             return nullptr;
         }
         
         FCMObject* fcm = (FCMObject*)self;
-        fcm->impl->request_file(filepath);
+        std::string error;
+        bool ok;
+        Py_BEGIN_ALLOW_THREADS
+        ok = fcm->impl->save_snapshot(filepath, hot_files, error);
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            PyErr_Format(PyExc_OSError, "cannot save snapshot %s: %s", filepath, error.c_str());
+            return nullptr;
+        }
         Py_RETURN_NONE;
     }
     
-    static PyObject* FCM_is_in_cache(PyObject* self, PyObject* args) {
+    static PyObject* FCM_load_snapshot(PyObject* self, PyObject* args) {
         const char* filepath;
-        if (!PyArg_ParseTuple(args, "s", &filepath)) {
+        size_t hot_files = 1024;
+        if (!PyArg_ParseTuple(args, "s|n", &filepath, &hot_files)) {
             return nullptr;
         }
         
         FCMObject* fcm = (FCMObject*)self;
-        std::vector<char>* data = nullptr;
-        bool in_cache = fcm->impl->is_in_cache(filepath, &data);
-        
-        if (in_cache) {
-            // Return (bytes, 1) - bytes is just a placeholder for compatibility
-            PyObject* bytes = PyBytes_FromStringAndSize("", 0);
-            PyObject* result = Py_BuildValue("Oi", bytes, 1);
-            Py_DECREF(bytes);
-            return result;
-        } else {
-            // Return (None, 0)
-            Py_INCREF(Py_None);
-            return Py_BuildValue("Oi", Py_None, 0);
+        std::vector<std::string> hot;
+        std::string error;
+        bool ok;
+        Py_BEGIN_ALLOW_THREADS
+        ok = fcm->impl->load_snapshot(filepath, hot_files, hot, error);
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            PyErr_Format(PyExc_OSError, "cannot load snapshot %s: %s", filepath, error.c_str());
+            return nullptr;
         }
+        return string_list(hot);
     }
     
-    static PyObject* FCM_read_cache(PyObject* self, PyObject* args) {
-        const char* filepath;
-        size_t size, offset;
-        if (!PyArg_ParseTuple(args, "snn", &filepath, &size, &offset)) {
+    static PyObject* FCM_wait_idle(PyObject* self, PyObject* args) {
+        int timeout_ms = 10000;
+        if (!PyArg_ParseTuple(args, "|i", &timeout_ms)) {
             return nullptr;
         }
         
         FCMObject* fcm = (FCMObject*)self;
-        std::vector<char>* data = fcm->impl->read_cache(filepath, size, offset);
-        if (!data) {
-            Py_RETURN_NONE;
+        bool idle;
+        Py_BEGIN_ALLOW_THREADS
+        idle = fcm->impl->wait_idle(timeout_ms);
+        Py_END_ALLOW_THREADS
+        return PyBool_FromLong(idle);
+    }
+    
+    static PyObject* FCM_start_trace(PyObject* self, PyObject* args) {
+        const char* filepath;
+        if (!PyArg_ParseTuple(args, "s", &filepath)) {
+            return nullptr;
         }
         
-        if (offset >= data->size()) {
-            Py_RETURN_NONE;
+        FCMObject* fcm = (FCMObject*)self;
+        bool ok;
+        Py_BEGIN_ALLOW_THREADS
+        ok = fcm->impl->start_trace(filepath);
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filepath);
         }
-        
-        size_t end = std::min(offset + size, data->size());
-        return PyBytes_FromStringAndSize(data->data() + offset, end - offset);
+        Py_RETURN_NONE;
     }
     
-    static PyObject* FCM_cache_status(PyObject* self, PyObject* Py_UNUSED(ignored)) {
+    static PyObject* FCM_stop_trace(PyObject* self, PyObject* Py_UNUSED(ignored)) {
         FCMObject* fcm = (FCMObject*)self;
-        fcm->impl->cache_status();
-        Py_RETURN_NONE;
+        uint64_t reads;
+        Py_BEGIN_ALLOW_THREADS
+        reads = fcm->impl->stop_trace();
+        Py_END_ALLOW_THREADS
+        return PyLong_FromUnsignedLongLong(reads);
     }
     
-    static PyObject* FCM_set_root(PyObject* self, PyObject* args) {
-        const char* root;
-        if (!PyArg_ParseTuple(args, "s", &root)) {
+    static PyObject* FCM_join_peers(PyObject* self, PyObject* args, PyObject* kwds) {
+        static char* kwlist[] = {(char*)"address", (char*)"peers", (char*)"timeout_ms", nullptr};
+        const char* address;
+        PyObject* peers;
+        int timeout_ms = 2000;
+        if (!PyArg_ParseTupleAndKeywords(args, kwds, "sO|i", kwlist, &address, &peers, &timeout_ms)) {
             return nullptr;
         }
         
+        PyObject* seq = PySequence_Fast(peers, "peers must be a sequence");
+        if (!seq) return nullptr;
+        std::vector<std::string> addresses;
+        Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+        addresses.reserve(count);
+        for (Py_ssize_t i = 0; i < count; ++i) {
+            Py_ssize_t length;
+            const char* peer = PyUnicode_AsUTF8AndSize(PySequence_Fast_GET_ITEM(seq, i), &length);
+            if (!peer) {
+                Py_DECREF(seq);
+                return nullptr;
+            }
+            addresses.emplace_back(peer, length);
+        }
+        Py_DECREF(seq);
+        
         FCMObject* fcm = (FCMObject*)self;
-        fcm->impl->set_root(root);
+        bool ok;
+        Py_BEGIN_ALLOW_THREADS
+        ok = fcm->impl->join_peers(address, addresses, std::max(1, timeout_ms));
+        Py_END_ALLOW_THREADS
+        if (!ok) {
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, address);
+        }
+        Py_RETURN_NONE;
+    }
+    
+    static PyObject* FCM_leave_peers(PyObject* self, PyObject* Py_UNUSED(ignored)) {
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->leave_peers();
+        Py_END_ALLOW_THREADS
+        Py_RETURN_NONE;
+    }
+    
+    static PyObject* FCM_predictor_status(PyObject* self, PyObject* Py_UNUSED(ignored)) {
+        FCMObject* fcm = (FCMObject*)self;
+        Py_BEGIN_ALLOW_THREADS
+        fcm->impl->predictor_status();
+        Py_END_ALLOW_THREADS
         Py_RETURN_NONE;
     }
     
     static PyMethodDef FCM_methods[] = {
         {"request_file", FCM_request_file, METH_VARARGS, "Request a file to be cached"},
+        {"register_source", FCM_register_source, METH_VARARGS, "Get the prefetch source id for a predictor"},
+        {"prefetch_depth", FCM_prefetch_depth, METH_VARARGS, "How many predictions a source should prefetch"},
+        {"prefetch_stats", FCM_prefetch_stats, METH_NOARGS, "Prefetch accuracy per source"},
         {"is_in_cache", FCM_is_in_cache, METH_VARARGS, "Check if a file is in the cache"},
         {"read_cache", FCM_read_cache, METH_VARARGS, "Read a file from the cache"},
+        {"read_cache_view", FCM_read_cache_view, METH_VARARGS, "Read a file from the cache without copying"},
+        {"read_through", FCM_read_through, METH_VARARGS,
+         "Read from the cache, or on a miss from disk into the cache, without copying"},
+        {"attach", FCM_attach, METH_VARARGS, "Share an open file descriptor with the prefetcher"},
+        {"detach", FCM_detach, METH_VARARGS, "Stop sharing a file descriptor before it is closed"},
         {"cache_status", FCM_cache_status, METH_NOARGS, "Print cache status"},
+        {"stats", FCM_stats, METH_NOARGS, "Hit, prefetch and eviction counters and latency histograms"},
+        {"prometheus", FCM_prometheus, METH_NOARGS, "Metrics in the Prometheus text format"},
+        {"set_memory_limit", FCM_set_memory_limit, METH_VARARGS, "Resize the cache, evicting down to a smaller limit"},
+        {"watch_memory_pressure", (PyCFunction)(void(*)(void))FCM_watch_memory_pressure,
+         METH_VARARGS | METH_KEYWORDS, "Size the cache from cgroup memory pressure, or stop with max_limit 0"},
         {"set_root", FCM_set_root, METH_VARARGS, "Set the root directory"},
+        {"invalidate", FCM_invalidate, METH_VARARGS, "Drop a file, or everything under a directory, from the cache"},
+        {"truncate", FCM_truncate, METH_VARARGS, "Truncate a file under the root and drop its cached chunks"},
+        {"rename", FCM_rename, METH_VARARGS, "Move cached chunks from an old path to a new one"},
+        {"write_through", FCM_write_through, METH_VARARGS, "Update the cache after a write reached the file"},
+        {"stat", FCM_stat, METH_VARARGS, "lstat a path relative to the root through the metadata cache"},
+        {"listdir", FCM_listdir, METH_VARARGS, "List a directory relative to the root through the metadata cache"},
+        {"invalidate_metadata", FCM_invalidate_metadata, METH_VARARGS,
+         "Drop cached metadata of a path and its parent directory's listing"},
+#ifdef FCACHE_FUSE
+        {"mount", FCM_mount, METH_VARARGS, "Serve the root at a mount point with the native FUSE frontend"},
+#endif
+        {"configure_predictor", (PyCFunction)(void(*)(void))FCM_configure_predictor, METH_VARARGS | METH_KEYWORDS,
+         "Select the native predictor ('markov', 'adaptive' or 'locality')"},
+        {"log_read", FCM_log_read, METH_VARARGS, "Log a read and prefetch the predicted next files"},
+        {"log_reads", FCM_log_reads, METH_VARARGS, "Log a batch of reads and prefetch after the last one"},
+        {"record_access", FCM_record_access, METH_VARARGS, "Queue a read event for the predictor thread"},
+        {"drain_accesses", FCM_drain_accesses, METH_VARARGS, "Wait for and return a batch of queued read events"},
+        {"predict", FCM_predict, METH_VARARGS, "Predict the files read after a path"},
+        {"predictor_status", FCM_predictor_status, METH_NOARGS, "Print native predictor status"},
+        {"save_snapshot", FCM_save_snapshot, METH_VARARGS, "Save the native model and hot files to a snapshot"},
+        {"load_snapshot", FCM_load_snapshot, METH_VARARGS, "Map a snapshot and return its hottest files"},
+        {"wait_idle", FCM_wait_idle, METH_VARARGS, "Wait until no prefetch is queued or in flight"},
+        {"start_trace", FCM_start_trace, METH_VARARGS, "Record every read to a binary trace file"},
+        {"stop_trace", FCM_stop_trace, METH_NOARGS, "Finish the trace and return how many reads it holds"},
+        {"join_peers", (PyCFunction)(void(*)(void))FCM_join_peers, METH_VARARGS | METH_KEYWORDS,
+         "Share chunks with other nodes, each chunk fetched from the peer owning it"},
+        {"leave_peers", FCM_leave_peers, METH_NOARGS, "Stop sharing chunks with peers"},
         {nullptr, nullptr, 0, nullptr}  // Sentinel
     };
     
@@ -443,6 +7952,8 @@ extern "C" {
     PyMODINIT_FUNC PyInit_fcache_cpp(void) {
         if (PyType_Ready(&FileCacheManagerType) < 0)
             return nullptr;
+        if (PyType_Ready(&CacheBufferType) < 0)
+            return nullptr;
         
         PyObject* m = PyModule_Create(&fcache_module);
         if (m == nullptr)
@@ -455,6 +7966,14 @@ extern "C" {
             return nullptr;
         }
         
+        Py_INCREF(&CacheBufferType);
+        if (PyModule_AddObject(m, "CacheBuffer", (PyObject*)&CacheBufferType) < 0) {
+            Py_DECREF(&CacheBufferType);
+            Py_DECREF(m);
+            return nullptr;
+        }
+        
         return m;
     }
 }
+#endif
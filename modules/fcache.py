@@ -1,3 +1,6 @@
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
 # Try to import the C++ implementation
 from fcache_cpp import FileCacheManager as CppFileCacheManager
 
@@ -6,21 +9,249 @@ class FileCacheManager:
     Python wrapper for the C++ FileCacheManager implementation.
     Maintains the same API as the original Python version.
     '''
-    def __init__(self, memory_limit=4 * 1024 ** 3, chunk_size=1024 * 1024):
-        self._cpp_manager = CppFileCacheManager(memory_limit, chunk_size)
+    def __init__(self, memory_limit=4 * 1024 ** 3, chunk_size=1024 * 1024, shards=0, reader_threads=4,
+                 prefetch_chunks=4, io_backend='threads', queue_depth=32, policy='lru', compressed_limit=0,
+                 spill_path='', spill_size=0, validate=True, metadata_ttl_ms=1000,
+                 metadata_entries=65536, max_readahead=64, mmap=False):
+        # shards=0 picks one cache shard per hardware thread
+        # prefetch_chunks is the initial prefetch and read-ahead window; a handle read as a
+        # sequential or strided stream doubles its window up to max_readahead chunks
+        # io_backend='uring' keeps up to queue_depth chunks in flight through io_uring,
+        # falling back to reader_threads pread threads if io_uring is unavailable
+        # policy is the eviction policy: 'lru', 'arc' or 'tinylfu' (scan resistant)
+        # compressed_limit bytes of memory_limit hold LZ4-compressed evictions instead of dropping them
+        # spill_size bytes of a scratch file at spill_path (ideally local NVMe) hold every eviction
+        # validate stats the file on every hit and drops its chunks if its size or mtime changed
+        # metadata_ttl_ms is how long stat results, listings and ENOENT lookups are trusted (0 = never)
+        # mmap makes chunks read-only mappings of the files, so cached bytes are the page cache's own;
+        # chunk_size is rounded up to whole pages and io_backend falls back to threads. Touching a
+        # mapping past EOF is SIGBUS, so truncate through truncate() and only on sources nothing
+        # else truncates behind the cache's back
+        self._cpp_manager = CppFileCacheManager(memory_limit, chunk_size, shards, reader_threads,
+                                                prefetch_chunks, io_backend, queue_depth, policy,
+                                                compressed_limit, spill_path, spill_size, validate,
+                                                metadata_ttl_ms, metadata_entries, max_readahead, mmap)
         self._root = '.'
     
-    def request_file(self, filepath):
-        self._cpp_manager.request_file(filepath)
+    def request_file(self, filepath, priority=0, source=0):
+        # source is a predictor id from register_source; 0 is an untracked request
+        self._cpp_manager.request_file(filepath, priority, source)
+
+    def register_source(self, name):
+        return self._cpp_manager.register_source(name)
+
+    def prefetch_depth(self, source, max_depth):
+        # scales max_depth by the source's prefetch accuracy and the unread-prefetch headroom
+        return self._cpp_manager.prefetch_depth(source, max_depth)
+
+    def prefetch_stats(self):
+        return self._cpp_manager.prefetch_stats()
     
     def is_in_cache(self, filepath):
         return self._cpp_manager.is_in_cache(filepath)
     
     def read_cache(self, filepath, size, offset):
         return self._cpp_manager.read_cache(filepath, size, offset)
+
+    def read_cache_view(self, filepath, size, offset):
+        '''
+        Zero-copy variant of read_cache. Returns a read-only CacheBuffer that
+        keeps the cached entry alive; wrap it in memoryview() to slice it.
+        '''
+        return self._cpp_manager.read_cache_view(filepath, size, offset)
+
+    def read_through(self, filepath, size, offset, fh=-1):
+        '''
+        read_cache_view that reads a miss with pread through the open handle
+        fh (or a shared descriptor, or the path), caching the chunks it read.
+        Returns b'' at EOF and raises OSError on a read error.
+        '''
+        return self._cpp_manager.read_through(filepath, size, offset, fh)
+
+    def attach(self, filepath, fh):
+        # shares an open handle's descriptor with the prefetcher; detach before closing it
+        self._cpp_manager.attach(filepath, fh)
+
+    def detach(self, fh):
+        self._cpp_manager.detach(fh)
     
     def cache_status(self):
         self._cpp_manager.cache_status()
+
+    def stats(self):
+        '''
+        Counters (hits, partial_hits, misses, bytes_served, bytes_read, evictions,
+        prefetch_issued/used/wasted, ...) and current gauges (memory_bytes,
+        queue_depth, ...), plus hit_latency, fill_latency and prefetch_latency
+        histograms. Counting never takes a cache lock; per-source prefetch
+        numbers are in prefetch_stats.
+        '''
+        return self._cpp_manager.stats()
+
+    def prometheus(self):
+        return self._cpp_manager.prometheus()
+
+    def serve_metrics(self, port, host='127.0.0.1'):
+        '''
+        Serve prometheus() over HTTP on a daemon thread, at any path. Returns
+        the server; port 0 picks a free one (server.server_port), and
+        server.shutdown() stops it.
+        '''
+        manager = self
+
+        class MetricsHandler(BaseHTTPRequestHandler):
+            def do_GET(self):
+                body = manager.prometheus().encode()
+                self.send_response(200)
+                self.send_header('Content-Type', 'text/plain; version=0.0.4; charset=utf-8')
+                self.send_header('Content-Length', str(len(body)))
+                self.end_headers()
+                self.wfile.write(body)
+
+            def log_message(self, format, *args):
+                pass  # scrapes every few seconds would flood the console
+
+        server = ThreadingHTTPServer((host, port), MetricsHandler)
+        server.daemon_threads = True
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        return server
+
+    def set_memory_limit(self, memory_limit):
+        # evicts down to a smaller limit before returning
+        self._cpp_manager.set_memory_limit(memory_limit)
+
+    def watch_memory_pressure(self, min_limit=256 * 1024 ** 2, max_limit=None, cgroup='', interval_ms=1000):
+        '''
+        Let cgroup v2 memory pressure (PSI) and the headroom under memory.max
+        drive memory_limit between min_limit and max_limit, which defaults
+        to the current limit. Freed cache memory goes back to the OS while
+        watching. cgroup is a cgroup v2 directory, '' for this process's own;
+        without one, system-wide PSI and MemAvailable are used. Returns the
+        pressure file watched; raises OSError if PSI is unavailable.
+        '''
+        if max_limit is None:
+            max_limit = self.stats()['memory_limit']
+        return self._cpp_manager.watch_memory_pressure(min_limit, max(1, max_limit), cgroup, interval_ms)
+
+    def stop_memory_watch(self):
+        # the limit stays where the watch left it
+        self._cpp_manager.watch_memory_pressure(0, 0)
+
+    def invalidate(self, filepath, size=-1):
+        # drops a file, or everything under a directory. size is a regular
+        # file's size before the change, if known; it saves scanning the
+        # whole cache for the file's chunks
+        self._cpp_manager.invalidate(filepath, size)
+
+    def truncate(self, filepath, length, fh=-1):
+        # size changes made through the mount must come here rather than to
+        # ftruncate: in mmap mode touching a mapped page past the new EOF
+        # raises SIGBUS, so the file's mappings are released first. fh must
+        # be writable, or -1 to open the file by name
+        self._cpp_manager.truncate(filepath, length, fh)
+
+    def rename(self, old, new, replaced_size=-1):
+        # call after the rename; replaced_size is the size of the file new
+        # replaced, 0 if none, as for invalidate
+        self._cpp_manager.rename(old, new, replaced_size)
+
+    def write_through(self, filepath, offset, data, before=None):
+        # call after the write reached the file, so its new size and mtime are
+        # known. before, the file's os.stat_result from just before the write,
+        # keeps the chunks the write left alone cached
+        if before is None:
+            self._cpp_manager.write_through(filepath, offset, data)
+        else:
+            self._cpp_manager.write_through(filepath, offset, data, before.st_size, before.st_mtime_ns)
+
+    def stat(self, filepath):
+        # lstat fields as a getattr dict; raises OSError (FileNotFoundError for ENOENT)
+        return self._cpp_manager.stat(filepath)
+
+    def listdir(self, filepath):
+        return self._cpp_manager.listdir(filepath)
+
+    def invalidate_metadata(self, filepath):
+        # call after a change to a path's attributes or its directory's entries
+        self._cpp_manager.invalidate_metadata(filepath)
+
+    def configure_predictor(self, kind, order=2, history_length=5, learning_rate=0.1, decay=0.9,
+                            max_states=65536, min_confidence=0.2):
+        # kind is 'markov' (order-k), 'adaptive' (decayed weights) or 'locality'
+        # (transitions plus numeric successors, sibling order and directory co-access)
+        # max_states bounds each transition table; low-weight states are pruned past it
+        # predictions below min_confidence are not prefetched
+        self._cpp_manager.configure_predictor(kind, order, history_length, learning_rate, decay,
+                                              max_states, min_confidence)
+
+    def log_read(self, filepath, num_predictions=2, prefetch=True):
+        return self._cpp_manager.log_read(filepath, num_predictions, prefetch)
+
+    def log_reads(self, filepaths, num_predictions=2, prefetch=True):
+        self._cpp_manager.log_reads(filepaths, num_predictions, prefetch)
+
+    def record_access(self, filepath):
+        # lock-free push for the read path; dropped if the queue is full
+        self._cpp_manager.record_access(filepath)
+
+    def drain_accesses(self, max_batch=64, timeout_ms=100):
+        # blocks (without the GIL) for up to timeout_ms; returns [] on timeout
+        return self._cpp_manager.drain_accesses(max_batch, timeout_ms)
+
+    def predict(self, filepath, num_predictions=1):
+        return self._cpp_manager.predict(filepath, num_predictions)
+
+    def predictor_status(self):
+        self._cpp_manager.predictor_status()
+
+    def save_snapshot(self, filepath, hot_files=1024):
+        # native model plus the hottest cached files, in an mmap-able binary file
+        self._cpp_manager.save_snapshot(filepath, hot_files)
+
+    def load_snapshot(self, filepath, hot_files=1024):
+        # returns the hottest files, best first; the model loads on first use
+        return self._cpp_manager.load_snapshot(filepath, hot_files)
+
+    def wait_idle(self, timeout_ms=10000):
+        # True once nothing is queued or being read
+        return self._cpp_manager.wait_idle(timeout_ms)
+
+    def start_trace(self, filepath):
+        '''
+        Record every read_cache and read_through, with its offset, size and
+        whether it hit, to a binary trace at filepath until stop_trace. Build
+        modules/replay.cpp to play a trace back against other policies and
+        predictors offline.
+        '''
+        self._cpp_manager.start_trace(filepath)
+
+    def stop_trace(self):
+        # flushes the trace and returns how many reads it recorded
+        return self._cpp_manager.stop_trace()
+
+    def join_peers(self, address, peers, timeout_ms=2000):
+        '''
+        Share cached chunks with the other mounts of the same dataset at
+        peers ("host:port" each). Every chunk is owned by one node, picked by
+        consistent hashing of its path and index; a miss on a chunk another
+        node owns, demand read or prefetch, asks that node before the disk.
+        address is how the others reach this node, and the only address it
+        listens at. Peers are trusted with the whole tree: keep it private.
+        '''
+        self._cpp_manager.join_peers(address, list(peers), timeout_ms)
+
+    def leave_peers(self):
+        self._cpp_manager.leave_peers()
+
+    def mount(self, mountpoint, options=()):
+        '''
+        Serve root at mountpoint with the native FUSE frontend until it is
+        unmounted. Reads still reach drain_accesses for Python predictors.
+        options are extra libfuse arguments, e.g. ['-o', 'allow_other'].
+        '''
+        if not hasattr(self._cpp_manager, 'mount'):
+            raise RuntimeError('fcache_cpp was built without the native FUSE frontend (build with FCACHE_FUSE=1 and libfuse3)')
+        self._cpp_manager.mount(mountpoint, list(options))
     
     @property
     def root(self):
@@ -0,0 +1,519 @@
+// replay.cpp - fcache-replay: play a read trace back against the cache offline
+//
+// Drives FileCache and the native predictors from fcache.cpp with a trace
+// recorded by FileCacheManager.start_trace, without FUSE, Python or the
+// traced files, and reports for every policy and predictor asked for the
+// hit ratio, byte hit ratio, wasted prefetch bytes and simulated read
+// latency. Build it with
+//
+//     g++ -std=c++17 -O3 modules/replay.cpp -o fcache-replay -pthread
+//
+// Reads are issued at their recorded times. The device is modeled as
+// --queue-depth channels; a read of missing chunks, a prefetch or a
+// read-ahead takes --device-us plus its bytes over --bandwidth on the
+// first free channel. A hit costs --hit-us. Prefetches land in the cache
+// when they complete; a read that needs one still in flight waits for it.
+// The locality predictor sees the tree as the set of every path in the
+// trace. Chunks hold uninitialized slab blocks, so the replay touches
+// little of the memory it simulates.
+#define FCACHE_NO_PYTHON
+#include "fcache.cpp"
+
+#include <cstdio>
+#include <iomanip>
+
+namespace {
+
+struct TraceRead {
+    uint64_t time_ns;
+    uint64_t offset;
+    uint64_t file_size;
+    uint32_t size;
+    uint32_t path;
+};
+
+struct Trace {
+    TraceHeader header;
+    std::vector<std::string> paths;  // By trace path id
+    std::vector<TraceRead> reads;
+};
+
+// Read all of `filepath`. A torn last record, as left by a crash, ends the
+// trace; anything else malformed fails it.
+bool load_trace(const std::string& filepath, Trace& trace, std::string& error) {
+    int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        error = std::strerror(errno);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    size_t length = st.st_size;
+    void* base = length ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    int err = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+        error = length ? std::strerror(err) : "empty file";
+        return false;
+    }
+    
+    const char* bytes = (const char*)base;
+    bool ok = length >= sizeof(TraceHeader);
+    if (ok) {
+        std::memcpy(&trace.header, bytes, sizeof(TraceHeader));
+        ok = std::memcmp(trace.header.magic, TraceHeader::MAGIC, sizeof(trace.header.magic)) == 0 &&
+             trace.header.version == TraceHeader::VERSION;
+    }
+    error = "not a valid trace";
+    // A partial last record fails the loop's check and is dropped
+    for (size_t at = sizeof(TraceHeader); ok && length - at >= sizeof(TraceRecord);) {
+        TraceRecord record;
+        std::memcpy(&record, bytes + at, sizeof(record));
+        at += sizeof(record);
+        if (record.kind() == TraceKind::Path) {
+            if (record.path() != trace.paths.size()) {
+                ok = false;
+                break;
+            }
+            if (length - at < record.size) break;  // Torn name
+            trace.paths.emplace_back(bytes + at, record.size);
+            at += record.size;
+        } else if (record.path() >= trace.paths.size()) {
+            ok = false;
+        } else {
+            trace.reads.push_back({record.time_ns, record.offset, record.file_size, record.size, record.path()});
+        }
+    }
+    munmap(base, length);
+    return ok;
+}
+
+struct Options {
+    size_t memory = 256ULL << 20;
+    size_t chunk_size = 0;  // 0 = the recording cache's
+    size_t shards = 1;
+    std::vector<std::string> policies{"lru"};
+    std::vector<std::string> predictors{"none"};
+    size_t predictions = 2;
+    size_t prefetch_chunks = 4;
+    float min_confidence = 0.2f;
+    bool read_ahead = true;
+    double hit_us = 5;
+    double device_us = 100;
+    double bandwidth = 1000;  // MB/s
+    size_t queue_depth = 16;
+};
+
+struct Result {
+    uint64_t reads = 0;
+    uint64_t hits = 0;
+    uint64_t bytes = 0;
+    uint64_t hit_bytes = 0;
+    uint64_t prefetched_bytes = 0;
+    uint64_t used_prefetch_bytes = 0;  // Read before the end of the trace
+    uint64_t late_prefetches = 0;      // Chunks a read had to wait for
+    Metrics::Histogram latency;
+    
+    void add_latency(uint64_t ns) {
+        ++latency.count;
+        latency.sum_ns += ns;
+        ++latency.buckets[Metrics::bucket_of(ns)];
+    }
+};
+
+// One replay of a trace against one cache configuration
+class Replay {
+private:
+    struct Pending {
+        uint64_t done_ns;
+        ChunkKey key;
+        uint32_t path;
+        uint8_t source;
+        size_t length;
+        
+        bool operator>(const Pending& other) const { return done_ns > other.done_ns; }
+    };
+    
+    const Trace& trace;
+    const Options& options;
+    size_t chunk_size;
+    std::shared_ptr<SlabAllocator> allocator;
+    std::unique_ptr<FileCache> cache;
+    std::unique_ptr<PrefetchController> prefetch_control;
+    std::unique_ptr<NativePredictor> predictor;
+    PathInterner interner;
+    ReadHistory history;
+    uint8_t predictor_source = 0;
+    uint8_t readahead_source = 0;
+    std::vector<uint64_t> file_sizes;  // By path id, UNKNOWN_SIZE until a read tells
+    // Directory -> entries, and the parents of every traced path, for the locality predictor
+    std::unordered_map<std::string, std::vector<std::string>> listings;
+    
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> in_flight;
+    std::unordered_map<ChunkKey, Pending, ChunkKeyHash> in_flight_done;  // Latest prefetch of each key
+    std::unordered_map<ChunkKey, size_t, ChunkKeyHash> unread;  // Prefetched, not read yet
+    std::vector<uint64_t> channels;  // When each device channel is next free
+    Result result;
+    
+    uint64_t device_read(uint64_t now, size_t bytes) {
+        auto channel = std::min_element(channels.begin(), channels.end());
+        uint64_t start = std::max(now, *channel);
+        *channel = start + (uint64_t)(options.device_us * 1000 + bytes / options.bandwidth * 1000 / 1.048576);
+        return *channel;
+    }
+    
+    void store(const ChunkKey& key, size_t length, uint64_t file_size, uint8_t source) {
+        CachedChunk chunk;
+        chunk.bytes = allocator->allocate(length);
+        chunk.file_size = file_size;
+        chunk.source = source;
+        cache->fill(key, std::move(chunk), cache->fill_generation());
+    }
+    
+    // Bytes of chunk `index` of a file, as far as its size is known
+    size_t chunk_length(uint64_t file_size, uint64_t index) const {
+        if (file_size == TraceRecord::UNKNOWN_SIZE) return chunk_size;
+        uint64_t start = index * chunk_size;
+        return start >= file_size ? 0 : std::min<uint64_t>(chunk_size, file_size - start);
+    }
+    
+    void land(const Pending& done) {
+        in_flight_done.erase(done.key);
+        store(done.key, done.length, file_sizes[done.path], done.source);
+    }
+    
+    void land(uint64_t now) {
+        while (!in_flight.empty() && in_flight.top().done_ns <= now) {
+            // Skip prefetches a read waited for, which landed then
+            auto pending = in_flight_done.find(in_flight.top().key);
+            if (pending != in_flight_done.end() && pending->second.done_ns == in_flight.top().done_ns) {
+                land(Pending(pending->second));
+            }
+            in_flight.pop();
+        }
+    }
+    
+    // Queue chunks [first, first + count) that are neither cached nor in flight
+    void prefetch(uint64_t now, uint32_t path, uint64_t first, uint64_t count, uint8_t source) {
+        const std::string& name = trace.paths[path];
+        for (uint64_t i = first; i < first + count; ++i) {
+            size_t length = chunk_length(file_sizes[path], i);
+            ChunkKey key{name, i};
+            if (length == 0) break;
+            if (in_flight_done.count(key) || cache->contains(key)) continue;
+            uint64_t done = device_read(now, length);
+            Pending pending{done, key, path, source, length};
+            in_flight.push(pending);
+            in_flight_done.emplace(key, std::move(pending));
+            unread[key] = length;
+            result.prefetched_bytes += length;
+        }
+    }
+    
+    void predict(uint64_t now, uint32_t path) {
+        if (history.size() > 0 && history.back(0) == path) return;
+        history.push(path);
+        predictor->log(history);
+        size_t depth = prefetch_control->depth(predictor_source, options.predictions);
+        if (depth == 0) return;
+        std::vector<uint32_t> context;
+        for (size_t i = history.size(); i-- > 0;) context.push_back(history.back(i));
+        std::vector<Prediction> predicted;
+        predictor->predict(std::move(context), depth, predicted);
+        for (const Prediction& next : predicted) {
+            if (next.confidence < options.min_confidence) break;
+            // Candidates the locality predictor made up may not be in the trace
+            if (next.id < trace.paths.size()) {
+                prefetch(now, next.id, 0, options.prefetch_chunks, predictor_source);
+            }
+        }
+    }
+    
+    // The manager's read_ahead, throttled like a stream's
+    void read_ahead(uint64_t now, uint32_t path, uint64_t last) {
+        uint64_t file_size = file_sizes[path];
+        if (file_size == TraceRecord::UNKNOWN_SIZE || file_size == 0) return;
+        uint64_t last_in_file = (file_size - 1) / chunk_size;
+        uint64_t window_end = std::min<uint64_t>(last + options.prefetch_chunks, last_in_file);
+        if (window_end <= last) return;
+        uint64_t count = prefetch_control->depth(readahead_source, window_end - last);
+        prefetch(now, path, last + 1, count, readahead_source);
+    }
+    
+    void replay(const TraceRead& read) {
+        uint64_t now = read.time_ns;
+        land(now);
+        if (read.file_size != TraceRecord::UNKNOWN_SIZE) file_sizes[read.path] = read.file_size;
+        uint64_t file_size = file_sizes[read.path];
+        uint64_t end = read.offset + read.size;
+        if (file_size != TraceRecord::UNKNOWN_SIZE) end = std::min(end, file_size);
+        if (predictor) predict(now, read.path);
+        if (end <= read.offset) return;
+        
+        const std::string& name = trace.paths[read.path];
+        uint64_t first = read.offset / chunk_size;
+        uint64_t last = (end - 1) / chunk_size;
+        uint64_t ready = now;
+        uint64_t hit_bytes = 0;
+        uint64_t missing_bytes = 0;
+        std::vector<ChunkKey> missing, late;
+        for (uint64_t i = first; i <= last; ++i) {
+            ChunkKey key{name, i};
+            uint64_t overlap = std::min(end, (i + 1) * chunk_size) - std::max(read.offset, i * chunk_size);
+            auto pending = in_flight_done.end();
+            if (cache->get(key)) {
+                hit_bytes += overlap;
+            } else if ((pending = in_flight_done.find(key)) != in_flight_done.end()) {
+                ready = std::max(ready, pending->second.done_ns);
+                late.push_back(key);
+            } else {
+                missing.push_back(key);
+                missing_bytes += chunk_length(file_size, i);
+                continue;
+            }
+            auto prefetched = unread.find(key);
+            if (prefetched != unread.end()) {
+                result.used_prefetch_bytes += prefetched->second;
+                unread.erase(prefetched);
+            }
+        }
+        if (!missing.empty()) {
+            // One request for the missing chunks, as read_through's preadv does
+            ready = std::max(ready, device_read(now, missing_bytes));
+            for (const ChunkKey& key : missing) {
+                size_t length = chunk_length(file_size, key.index);
+                if (length) store(key, length, file_size, 0);
+            }
+        }
+        // This read's late prefetches land by the time it completes, and
+        // count as read. Others still in flight land at a later read's time.
+        for (const ChunkKey& key : late) {
+            land(Pending(in_flight_done.at(key)));
+            cache->get(key);
+        }
+        result.late_prefetches += late.size();
+        
+        ++result.reads;
+        result.bytes += end - read.offset;
+        result.hit_bytes += hit_bytes;
+        if (hit_bytes == end - read.offset) ++result.hits;
+        result.add_latency(ready - now + (uint64_t)(options.hit_us * 1000));
+        if (options.read_ahead) read_ahead(now, read.path, last);
+    }
+    
+    bool stat_path(const std::string& path, struct stat& st) {
+        std::memset(&st, 0, sizeof(st));
+        uint32_t id;
+        if (listings.count(path)) {
+            st.st_mode = S_IFDIR | 0755;
+        } else if (interner.lookup(path, id) && id < trace.paths.size()) {
+            st.st_mode = S_IFREG | 0644;
+            st.st_size = file_sizes[id] == TraceRecord::UNKNOWN_SIZE ? 0 : file_sizes[id];
+        } else {
+            errno = ENOENT;
+            return false;
+        }
+        return true;
+    }
+    
+    bool list_directory(const std::string& path, std::shared_ptr<const std::vector<std::string>>& names) {
+        auto it = listings.find(path);
+        if (it == listings.end()) {
+            errno = ENOENT;
+            return false;
+        }
+        names = std::make_shared<std::vector<std::string>>(it->second);
+        return true;
+    }
+
+public:
+    Replay(const Trace& trace, const Options& options, PolicyKind policy, const std::string& predictor_name)
+        : trace(trace), options(options),
+          chunk_size(options.chunk_size ? options.chunk_size : std::max<uint32_t>(1, trace.header.chunk_size)),
+          allocator(std::make_shared<SlabAllocator>(chunk_size)),
+          cache(std::make_unique<FileCache>(options.memory, options.shards, policy, chunk_size, allocator)),
+          file_sizes(trace.paths.size(), TraceRecord::UNKNOWN_SIZE),
+          channels(std::max<size_t>(1, options.queue_depth), 0) {
+        // Trace ids double as predictor ids
+        for (const std::string& path : trace.paths) interner.intern(path);
+        prefetch_control = std::make_unique<PrefetchController>(cache->get_prefetch_stats(), options.memory / 2);
+        readahead_source = prefetch_control->register_source("readahead");
+        
+        if (predictor_name == "markov") {
+            predictor = std::make_unique<OrderKMarkov>(2, 65536);
+        } else if (predictor_name == "adaptive") {
+            predictor = std::make_unique<DecayedMarkov>(5, 0.1f, 0.9f, 65536);
+        } else if (predictor_name == "locality") {
+            std::unordered_set<std::string> seen;
+            for (const std::string& path : trace.paths) {
+                std::string child = path;
+                for (std::string parent = parent_path(child);; child = parent, parent = parent_path(child)) {
+                    if (seen.insert(child).second) listings[parent].push_back(child.substr(child.rfind('/') + 1));
+                    if (parent.empty()) break;
+                }
+            }
+            predictor = std::make_unique<PathLocality>(
+                interner, [this](const std::string& path, struct stat& st) { return stat_path(path, st); },
+                [this](const std::string& path, std::shared_ptr<const std::vector<std::string>>& names) {
+                    return list_directory(path, names);
+                },
+                65536);
+        }
+        if (predictor) predictor_source = prefetch_control->register_source(predictor_name);
+    }
+    
+    Result run() {
+        for (const TraceRead& read : trace.reads) {
+            if (read.path < trace.paths.size()) replay(read);
+        }
+        return result;
+    }
+};
+
+bool parse_size(const char* text, size_t& out) {
+    char* end;
+    double value = std::strtod(text, &end);
+    if (end == text || value < 0) return false;
+    switch (std::toupper((unsigned char)*end)) {
+        case 'K': value *= 1024; ++end; break;
+        case 'M': value *= 1024 * 1024; ++end; break;
+        case 'G': value *= 1024.0 * 1024 * 1024; ++end; break;
+        default: break;
+    }
+    out = (size_t)value;
+    return *end == '\0';
+}
+
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    for (std::string item; std::getline(stream, item, ',');) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+bool parse_policy(const std::string& name, PolicyKind& policy) {
+    if (name == "lru") {
+        policy = PolicyKind::Lru;
+    } else if (name == "arc") {
+        policy = PolicyKind::Arc;
+    } else if (name == "tinylfu") {
+        policy = PolicyKind::TinyLfu;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] <trace-file>\n"
+              << "  --memory=SIZE           cache size (default 256M)\n"
+              << "  --chunk-size=SIZE       chunk size (default: the traced cache's)\n"
+              << "  --shards=N              cache shards (default 1)\n"
+              << "  --policy=LIST           lru, arc, tinylfu, comma separated (default lru)\n"
+              << "  --predictor=LIST        none, markov, adaptive, locality (default none)\n"
+              << "  --predictions=N         files predicted per read (default 2)\n"
+              << "  --prefetch-chunks=N     chunks prefetched and read ahead per file (default 4)\n"
+              << "  --min-confidence=F      smallest confidence prefetched (default 0.2)\n"
+              << "  --no-read-ahead         do not read ahead of sequential reads\n"
+              << "  --hit-us=F              latency of a hit (default 5)\n"
+              << "  --device-us=F           latency of a device read (default 100)\n"
+              << "  --bandwidth=F           device bandwidth in MB/s (default 1000)\n"
+              << "  --queue-depth=N         device reads in parallel (default 16)\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    std::string trace_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        const char* value = eq == std::string::npos ? "" : argv[i] + eq + 1;
+        size_t n;
+        bool ok = true;
+        if (arg[0] != '-' && trace_path.empty()) {
+            trace_path = arg;
+        } else if (name == "--memory") {
+            ok = parse_size(value, options.memory);
+        } else if (name == "--chunk-size") {
+            ok = parse_size(value, options.chunk_size);
+        } else if (name == "--shards") {
+            ok = parse_size(value, options.shards) && options.shards > 0;
+        } else if (name == "--policy") {
+            options.policies = split(value);
+            PolicyKind policy;
+            for (const auto& policy_name : options.policies) ok = ok && parse_policy(policy_name, policy);
+        } else if (name == "--predictor") {
+            options.predictors = split(value);
+            for (const auto& predictor : options.predictors) {
+                ok = ok && (predictor == "none" || predictor == "markov" || predictor == "adaptive" ||
+                            predictor == "locality");
+            }
+        } else if (name == "--predictions") {
+            ok = parse_size(value, options.predictions);
+        } else if (name == "--prefetch-chunks") {
+            ok = parse_size(value, options.prefetch_chunks);
+        } else if (name == "--min-confidence") {
+            options.min_confidence = std::strtof(value, nullptr);
+        } else if (name == "--no-read-ahead") {
+            options.read_ahead = false;
+        } else if (name == "--hit-us") {
+            options.hit_us = std::strtod(value, nullptr);
+        } else if (name == "--device-us") {
+            options.device_us = std::strtod(value, nullptr);
+        } else if (name == "--bandwidth") {
+            options.bandwidth = std::strtod(value, nullptr);
+            ok = options.bandwidth > 0;
+        } else if (name == "--queue-depth") {
+            ok = parse_size(value, n) && n > 0;
+            options.queue_depth = n;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Bad argument: " << arg << "\n";
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (trace_path.empty() || options.policies.empty() || options.predictors.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+    
+    Trace trace;
+    std::string error;
+    if (!load_trace(trace_path, trace, error)) {
+        std::cerr << "Cannot read trace " << trace_path << ": " << error << std::endl;
+        return 1;
+    }
+    double seconds = trace.reads.empty() ? 0 : trace.reads.back().time_ns / 1e9;
+    std::cout << trace.reads.size() << " reads of " << trace.paths.size() << " files over " << std::fixed
+              << std::setprecision(1) << seconds << " s, " << options.memory / (1024.0 * 1024.0) << " MB cache\n\n"
+              << std::left << std::setw(9) << "policy" << std::setw(10) << "predictor" << std::right
+              << std::setw(8) << "hit%" << std::setw(10) << "byte hit%" << std::setw(15) << "prefetch MB"
+              << std::setw(11) << "wasted MB" << std::setw(7) << "late" << std::setw(10) << "mean us"
+              << std::setw(9) << "p50 us" << std::setw(9) << "p99 us" << "\n";
+    for (const std::string& policy_name : options.policies) {
+        for (const std::string& predictor_name : options.predictors) {
+            PolicyKind policy;
+            parse_policy(policy_name, policy);
+            Result result = Replay(trace, options, policy, predictor_name).run();
+            double reads = std::max<uint64_t>(1, result.reads);
+            std::cout << std::left << std::setw(9) << policy_name << std::setw(10) << predictor_name << std::right
+                      << std::setw(8) << 100.0 * result.hits / reads << std::setw(10)
+                      << 100.0 * result.hit_bytes / std::max<uint64_t>(1, result.bytes) << std::setw(15)
+                      << result.prefetched_bytes / (1024.0 * 1024.0) << std::setw(11)
+                      << (result.prefetched_bytes - result.used_prefetch_bytes) / (1024.0 * 1024.0)
+                      << std::setw(7) << result.late_prefetches << std::setw(10)
+                      << result.latency.sum_ns / reads / 1000 << std::setw(9)
+                      << result.latency.quantile(0.5) / 1000.0 << std::setw(9)
+                      << result.latency.quantile(0.99) / 1000.0 << "\n";
+        }
+    }
+    return 0;
+}
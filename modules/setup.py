@@ -1,9 +1,24 @@
+import os
+import subprocess
 from setuptools import setup, Extension
 
+def pkg_config(*args):
+    try:
+        return subprocess.check_output(['pkg-config', *args], text=True).split()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+# The native FUSE frontend (FileCacheManager.mount) is experimental: it has
+# not been mount-tested yet, so it is only built with FCACHE_FUSE=1, and
+# then only when libfuse3 is found
+fuse_cflags = pkg_config('--cflags', 'fuse3') if os.environ.get('FCACHE_FUSE', '0') == '1' else None
+fuse_libs = pkg_config('--libs', 'fuse3') if fuse_cflags is not None else None
+
 module = Extension(
     'fcache_cpp',
     sources=['modules/fcache.cpp'],
-    extra_compile_args=['-std=c++17', '-O3'],  # High optimization level
+    extra_compile_args=['-std=c++17', '-O3'] + (['-DFCACHE_FUSE'] + fuse_cflags if fuse_libs is not None else []),  # High optimization level
+    extra_link_args=fuse_libs or [],
 )
 
 setup(
@@ -2,29 +2,73 @@
 import os
 import sys
 import errno
-from threading import Thread
+import signal
+import stat
+import time
+from threading import Thread, Lock
 from fuse import FUSE, Operations, FuseOSError
 from modules.OPT_base import Base_Opt
 from modules.fcache import FileCacheManager
 from modules.OPT_swg import SWG_Opt
 from modules.OPT_markov import Markov_Opt
 from modules.OPT_markovadaptive import AdaptiveMarkov_Opt
+from modules.OPT_locality import Locality_Opt
+from modules.OPT_ensemble import Ensemble_Opt
+from modules.OPT_native import NativeMarkov_Opt
+
+WARM_FILES = 256  # hottest files from the snapshot to load before serving
+SNAPSHOT_INTERVAL = 300  # seconds
 
 class QuarkFS(Operations):
     OPTM: Base_Opt
     CACHE: FileCacheManager
     enable_opt: bool
 
-    def __init__(self, root: str, optimizer: Base_Opt, fcache: FileCacheManager):
+    def __init__(self, root: str, optimizer: Base_Opt, fcache: FileCacheManager, snapshot: str | None = None):
         print(f'Optimizer: {optimizer.name}')
         self.root = os.path.realpath(root)
         self.OPTM = optimizer
         self.CACHE = fcache
         self.CACHE.root = self.root
         self.enable_opt = False
+        self.snapshot = snapshot
+        self.model_lock = Lock()  # the predictor thread trains while snapshots are saved
+        if snapshot:
+            self._load_snapshot()
+            Thread(target=self._snapshot_loop, daemon=True).start()
         Thread(target=self._log_cache, daemon=True).start()
+        Thread(target=self._predict_loop, daemon=True).start()
         self.prediction_count = 0 #TODO:make it so it only predicts every x runs
 
+    def _load_snapshot(self):
+        # warm the cache with the hottest files before the mount serves reads
+        if not os.path.exists(self.snapshot):
+            return
+        try:
+            hot = self.CACHE.load_snapshot(self.snapshot, WARM_FILES)
+            self.OPTM.load_state(self.snapshot + '.opt')
+        except (OSError, ValueError) as e:
+            print(f'Ignoring snapshot: {e}')
+            return
+        # newest requests are served first, so queue the hottest last
+        for file in reversed(hot):
+            self.CACHE.request_file(file)
+        warmed = self.CACHE.wait_idle(30000)
+        print(f'Warmed {len(hot)} files from {self.snapshot}{"" if warmed else " (still loading)"}')
+
+    def save_snapshot(self):
+        with self.model_lock:
+            self.CACHE.save_snapshot(self.snapshot)
+            self.OPTM.save_state(self.snapshot + '.opt')
+
+    def _snapshot_loop(self):
+        while True:
+            time.sleep(SNAPSHOT_INTERVAL)
+            try:
+                self.save_snapshot()
+            except OSError as e:
+                print(f'Snapshot failed: {e}')
+
     def _log_cache(self):
         while True:
             ui = input().lower()
@@ -48,85 +92,93 @@ class QuarkFS(Operations):
             elif ui == 'exit':
                 break
 
+    def _predict_loop(self):
+        # trains the model and queues prefetches off the read path
+        while True:
+            paths = self.CACHE.drain_accesses(64, 100)
+            if paths:
+                # up to 4 predictions; the cache scales this by measured accuracy
+                with self.model_lock:
+                    self.OPTM.log_predict_batch(paths, self.CACHE, self.enable_opt, num_predictions=4)
+
     # Helper to map paths
     def full_path(self, partial):
         return os.path.join(self.root, partial.lstrip('/'))
 
     def read(self, path, size, offset, fh):
-        def log_predict(p_header='Read'):  # logs the read and predicts next
-            if self.OPTM.last_file_read() != path:
-                self.OPTM.log_read(path)
-                #print(f"{p_header}: {path} @ offset {offset} size {size}")
-                if self.enable_opt:
-                    predictions = self.OPTM.predict_nexts(path, num_predictions=2)
-                    if predictions:
-                        #print(f'Predicted: {predictions}')
-                        if isinstance(predictions, str):
-                            self.CACHE.request_file(predictions)
-                        elif isinstance(predictions, list):  # TODO: confirm order works
-                            for file in predictions:
-                                self.CACHE.request_file(file)
-
         # Check if the file is already in cache
         # buff_cached, len_cached = self.CACHE.is_in_cache(path)
-        buff_cached = self.CACHE.read_cache(path, size, offset)
+        # fusepy memmoves the view straight into the kernel buffer
+        # a miss is pread through fh into the cache and answered from it
+        buff_cached = self.CACHE.read_through(path, size, offset, fh)
         # if len_cached: print(f'{len(buff_cached)} == {len_cached}')
-        if buff_cached:
-            log_predict('Cache hit')
-            return buff_cached
-        os.lseek(fh, offset, os.SEEK_SET)
-        buf = os.read(fh, size)
-        log_predict()
-        return buf
+        # the predictor thread logs the read and prefetches what follows
+        self.CACHE.record_access(path)
+        return buff_cached
 
     def write(self, path, data, offset, fh):
-        os.lseek(fh, offset, os.SEEK_SET)
-        written = os.write(fh, data)
+        before = os.fstat(fh)
+        written = os.pwrite(fh, data, offset)
         #print(f"Write: {path} @ offset {offset} size {len(data)}")
+        self.CACHE.write_through(path, offset, data[:written], before)
         return written
 
     def create(self, path, mode, fi=None):
         full_path = self.full_path(path)
         print(f"Creating file: {path} with mode {oct(mode)}")
-        return os.open(full_path, os.O_WRONLY | os.O_CREAT, mode)
+        fh = os.open(full_path, os.O_WRONLY | os.O_CREAT, mode)
+        self.CACHE.invalidate_metadata(path)
+        self.CACHE.attach(path, fh)
+        return fh
 
     def chmod(self, path, mode):
         full_path = self.full_path(path)
-        return os.chmod(full_path, mode)
+        os.chmod(full_path, mode)
+        self.CACHE.invalidate_metadata(path)
 
     def getattr(self, path, fh=None):
-        full_path = self.full_path(path)
-        st = os.lstat(full_path)
-        return dict((key, getattr(st, key)) for key in ('st_atime', 'st_ctime',
-                    'st_gid', 'st_mode', 'st_mtime', 'st_nlink', 'st_size', 'st_uid'))
+        return self.CACHE.stat(path)
 
     def readdir(self, path, fh):
-        full_path = self.full_path(path)
-        dirents = ['.', '..'] + os.listdir(full_path)
+        dirents = ['.', '..'] + self.CACHE.listdir(path)
         for r in dirents:
             yield r
 
     def open(self, path, flags):
         full_path = self.full_path(path)
-        return os.open(full_path, flags)
+        # the cache does the truncate, after seeing it coming
+        fh = os.open(full_path, flags & ~os.O_TRUNC)
+        if flags & os.O_TRUNC:
+            try:
+                self.CACHE.truncate(path, 0, -1 if (flags & os.O_ACCMODE) == os.O_RDONLY else fh)
+            except OSError:
+                os.close(fh)
+                raise
+        self.CACHE.attach(path, fh)
+        return fh
 
     def release(self, path, fh):
+        self.CACHE.detach(fh)
         return os.close(fh)
 
     def mkdir(self, path, mode):
         full_path = self.full_path(path)
         print(f"Creating directory: {path}")
-        return os.mkdir(full_path, mode)
+        os.mkdir(full_path, mode)
+        self.CACHE.invalidate_metadata(path)
 
     def unlink(self, path):
         full_path = self.full_path(path)
         print(f"Deleting file: {path}")
-        return os.unlink(full_path)
+        st = os.lstat(full_path)
+        os.unlink(full_path)
+        self.CACHE.invalidate(path, st.st_size if stat.S_ISREG(st.st_mode) else -1)
 
     def rmdir(self, path):
         full_path = self.full_path(path)
         print(f"Removing directory: {path}")
-        return os.rmdir(full_path)
+        os.rmdir(full_path)
+        self.CACHE.invalidate(path)
 
     def access(self, path, amode):
         full_path = self.full_path(path)
@@ -145,16 +197,16 @@ class QuarkFS(Operations):
 
     def chown(self, path, uid, gid):
         full_path = self.full_path(path)
-        return os.chown(full_path, uid, gid)
+        os.chown(full_path, uid, gid)
+        self.CACHE.invalidate_metadata(path)
 
     def utimens(self, path, times=None):
         full_path = self.full_path(path)
-        return os.utime(full_path, times)
+        os.utime(full_path, times)
+        self.CACHE.invalidate_metadata(path)
 
     def truncate(self, path, length, fh=None):
-        full_path = self.full_path(path)
-        with open(full_path, 'r+') as f:
-            f.truncate(length)
+        self.CACHE.truncate(path, length)
         return 0
 
     def readlink(self, path):
@@ -163,21 +215,31 @@ class QuarkFS(Operations):
 
     def mknod(self, path, mode, dev):
         full_path = self.full_path(path)
-        return os.mknod(full_path, mode, dev)
+        os.mknod(full_path, mode, dev)
+        self.CACHE.invalidate_metadata(path)
 
     def symlink(self, target, source):
         target_full = self.full_path(target)
-        return os.symlink(source, target_full)
+        os.symlink(source, target_full)
+        self.CACHE.invalidate_metadata(target)
 
     def link(self, target, source):
         target_full = self.full_path(target)
         source_full = self.full_path(source)
-        return os.link(source_full, target_full)
+        os.link(source_full, target_full)
+        self.CACHE.invalidate_metadata(source)
+        self.CACHE.invalidate_metadata(target)
 
     def rename(self, old, new):
         old_full = self.full_path(old)
         new_full = self.full_path(new)
-        return os.rename(old_full, new_full)
+        try:
+            st = os.lstat(new_full)
+            replaced = st.st_size if stat.S_ISREG(st.st_mode) else -1
+        except FileNotFoundError:
+            replaced = 0
+        os.rename(old_full, new_full)
+        self.CACHE.rename(old, new, replaced)
 
     def statfs(self, path):
         full_path = self.full_path(path)
@@ -194,7 +256,8 @@ class QuarkFS(Operations):
         return os.close(fh)
 
     def destroy(self, path):
-        pass
+        if self.snapshot:
+            self.save_snapshot()
 
     def getxattr(self, path, name, position=0):
         full_path = self.full_path(path)
@@ -237,19 +300,58 @@ class QuarkFS(Operations):
             raise FuseOSError(errno.ENOTSUP)
 
 if __name__ == '__main__':
-    if len(sys.argv) != 3:
-        print(f'Usage: {sys.argv[0]} <source-dir> <mount-point>')
+    # --native serves the mount from fcache_cpp's libfuse3 frontend instead of fusepy
+    native = '--native' in sys.argv
+    # --native-opt runs the ensemble's Markov member inside fcache_cpp; its model is then
+    # saved in the mmap-able cache snapshot and loaded on first use instead of at startup
+    native_opt = '--native-opt' in sys.argv
+    # --metrics-port=N serves Prometheus metrics on localhost:N
+    metrics_port = None
+    # --trace=FILE records every read to FILE for modules/replay.cpp
+    trace = None
+    # --peers=SELF,OTHER,... shares the cache with the other mounts; SELF is this node's host:port
+    peers = None
+    args = []
+    for arg in sys.argv[1:]:
+        if arg.startswith('--metrics-port='):
+            metrics_port = int(arg.split('=', 1)[1])
+        elif arg.startswith('--trace='):
+            trace = arg.split('=', 1)[1]
+        elif arg.startswith('--peers='):
+            peers = arg.split('=', 1)[1].split(',')
+        elif arg not in ('--native', '--native-opt'):
+            args.append(arg)
+    if len(args) not in (2, 3):
+        print(f'Usage: {sys.argv[0]} [--native] [--native-opt] [--metrics-port=N] [--trace=FILE] [--peers=SELF,OTHER,...] <source-dir> <mount-point> [snapshot-file]')
         exit(1)
     # TODO: make the source_dir a temporary folder? or write a seperate benchmark program that reads and writes
-    source_dir = sys.argv[1]
-    mount_point = sys.argv[2]
+    source_dir = args[0]
+    mount_point = args[1]
+    snapshot = args[2] if len(args) == 3 else None
 
-    test_OPT = Markov_Opt()
     file_cache = FileCacheManager()
+    if metrics_port is not None:
+        file_cache.serve_metrics(metrics_port)
+    if trace is not None:
+        file_cache.start_trace(trace)
+    # the ensemble follows whichever model fits the current workload
+    markov = NativeMarkov_Opt(file_cache) if native_opt else Markov_Opt()
+    test_OPT = Ensemble_Opt([markov, AdaptiveMarkov_Opt(), Locality_Opt(file_cache)])
 
     # cmp --silent ./data/a ./test || echo "files are different"
     try:
-        fuse = FUSE(QuarkFS(source_dir, test_OPT, file_cache),
-                mount_point, foreground=True)
+        quark = QuarkFS(source_dir, test_OPT, file_cache, snapshot)
+        # after QuarkFS sets the root the peers are served from
+        if peers is not None:
+            file_cache.join_peers(peers[0], peers[1:])
+        if native:
+            # libfuse only takes over signals left at their defaults, so Ctrl-C unmounts
+            signal.signal(signal.SIGINT, signal.SIG_DFL)
+            file_cache.mount(mount_point)
+            quark.destroy('/')
+        else:
+            fuse = FUSE(quark, mount_point, foreground=True)
     except RuntimeError:
         print(f'run umount {mount_point}')
+    if trace is not None:
+        print(f'Recorded {file_cache.stop_trace()} reads to {trace}')